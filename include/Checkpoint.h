@@ -0,0 +1,31 @@
+#pragma once
+#include <Arduino.h>
+
+// Playback checkpoint in RTC slow memory.
+//
+// RTC memory is not cleared by watchdog, panic or brownout resets, so the mode, macro
+// slot, the macro itself and the player's position survive them. After such a reset
+// setup() restores all of it without touching NVS or Wi-Fi, and the macro continues at the
+// step it was on as soon as BLE reconnects. Power-on and ESP.restart() boots ignore the
+// checkpoint. A macro that keeps crashing the device is resumed CHECKPOINT_MAX_RESUMES
+// times, then the checkpoint is dropped and the device boots normally.
+
+// Boot-to-resume figures of the current boot.
+struct CheckpointMetrics
+{
+    uint32_t saves;          // Checkpoint writes this boot (only passes that changed something)
+    bool restored;           // This boot came up through the fast path
+    uint32_t restoreUs;      // Validating and restoring the checkpoint
+    uint32_t resumedAtMs;    // millis() of the first HID edge after the restore (0 = not yet)
+    int resumedStep;         // Step the player resumed at
+    uint8_t resumes;         // Resumes in a row, this one included
+};
+
+// Call once per loop() pass. Rewrites the checkpoint when the mode, the active macro or the
+// player position changed since the last call; costs a few comparisons otherwise.
+void checkpoint_update(uint8_t mode);
+// Fast boot path. True when the last reset was unexpected and left a valid checkpoint
+// taken in resumableMode; the active macro and the player position are then restored.
+bool checkpoint_restore(uint8_t resumableMode);
+
+CheckpointMetrics checkpoint_get_metrics();
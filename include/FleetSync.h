@@ -0,0 +1,63 @@
+#pragma once
+#include <Arduino.h>
+#include "config.h"
+
+// Fleet distribution of macros over UDP multicast.
+//
+// While in MODE_STA_CONNECTED_BLE the device announces itself over mDNS (_patro._udp and
+// _http._tcp) and listens on FLEET_MULTICAST_GROUP:FLEET_PORT. A sender multicasts one
+// MANIFEST, the bundle in chunks of FLEET_CHUNK_BYTES, then the MANIFEST again as a poll.
+// Each device unicasts a NACK bitmap of the chunks it is missing (spread over
+// FLEET_NACK_JITTER_MS), and the sender multicasts the union once, so a push to 50 devices
+// costs about the same airtime as a push to one.
+//
+// Once every chunk is in, the bundle's HMAC-SHA256 is checked against the fleet key, every
+// macro in it is parsed and analyzed, and only if all of them pass are they stored
+// together, in one pass of the loop. The device then answers DONE with the outcome. Bundle
+// ids must increase, so an old bundle cannot be replayed.
+//
+// Datagrams (little endian), all starting with "PFB1", type u8, bundle id u32:
+//   MANIFEST  1  chunk count u8, total length u16, HMAC u8[32]   sender -> group
+//   CHUNK     2  index u8, data                                     sender -> group
+//   NACK      3  missing chunks u32 bitmap                          device -> sender
+//   DONE      4  status u8, device name                             device -> sender
+// HMAC input: "PFB1", bundle id, total length, bundle.
+// Bundle: active slot u8 (0xFF = keep), frame rate u8 (0xFF = keep), then per macro:
+//   slot u8, text length u16, "button,duration;..." text
+
+enum FleetStatus : uint8_t
+{
+    FLEET_APPLIED = 0,
+    FLEET_BAD_SIGNATURE,
+    FLEET_REJECTED, // Malformed bundle, or a macro refused by the analysis
+    FLEET_NO_KEY,   // No fleet key set on this device
+    FLEET_STALE,    // Bundle id not newer than the last one applied
+};
+
+struct FleetMetrics
+{
+    uint32_t bundlesApplied;
+    uint32_t bundlesRefused; // Bad signature, rejected content or no key
+    uint32_t chunksReceived;
+    uint32_t duplicateChunks;
+    uint32_t nacksSent;
+    uint32_t lastBundleId;
+    uint32_t lastTransferMs; // First datagram of the last completed bundle -> activation
+};
+
+// Sets the HMAC key shared by the fleet and persists it.
+void fleet_set_key(const uint8_t key[FLEET_KEY_BYTES]);
+bool fleet_has_key();
+
+// Starts mDNS and joins the multicast group on first call; then processes datagrams,
+// sends due NACKs and drops stale transfers. Returns true when a bundle was applied.
+bool fleet_loop();
+// Leaves the group and stops announcing. No-op when not started.
+void fleet_stop();
+
+// Validates and applies a complete, already authenticated bundle: all macros or none.
+FleetStatus fleet_apply_bundle(const uint8_t *bundle, size_t length);
+
+// mDNS host name, "patro-" and the last three bytes of the MAC address.
+String fleet_device_name();
+FleetMetrics fleet_get_metrics();
@@ -0,0 +1,105 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+#include <functional>
+#include <vector>
+
+// HTTP/1.1 server for the configuration portal, replacing the core WebServer, which
+// serves one client at a time and closes the socket after every response.
+//
+// Connections are kept alive: a page load reuses one socket for the page and the fetches
+// that follow it. Each connection buffers what it receives, so pipelined requests are
+// parsed and answered in order. At most HTTP_MAX_CLIENTS sockets are open; an idle socket
+// is closed after HTTP_IDLE_TIMEOUT_MS or HTTP_MAX_REQUESTS_PER_CONN requests, and the
+// oldest idle one is closed early when a new client needs the room. When none is idle,
+// new clients wait in the listen backlog instead of being reset.
+//
+// Arguments come from the query string and from application/x-www-form-urlencoded bodies.
+
+enum class HttpMethod : uint8_t
+{
+    ANY,
+    GET,
+    POST,
+    OTHER
+};
+
+struct HttpStats
+{
+    uint32_t accepted;     // Connections opened by clients
+    uint32_t requests;     // Requests answered
+    uint32_t reused;       // Requests that arrived on an already used connection
+    uint32_t pipelined;    // Requests that were already buffered behind another one
+    uint32_t closedIdle;   // Connections closed by HTTP_IDLE_TIMEOUT_MS
+    uint32_t evicted;      // Idle connections closed to make room for a new client
+    uint32_t backlogged;   // Passes in which a new client waited because every connection was busy
+    uint32_t badRequests;  // Malformed or oversized requests (answered, then closed)
+};
+
+class HttpServer
+{
+public:
+    using Handler = std::function<void()>;
+
+    explicit HttpServer(uint16_t port);
+
+    void begin();
+    void stop();
+    // Accepts new clients, answers complete requests and closes expired connections.
+    void handleClient();
+
+    void on(const char *uri, HttpMethod method, Handler handler);
+    void on(const char *uri, Handler handler) { on(uri, HttpMethod::ANY, handler); }
+    void onNotFound(Handler handler) { notFoundHandler = handler; }
+
+    // --- Current request, valid inside a handler ---
+    const String &uri() const { return requestUri; }
+    HttpMethod method() const { return requestMethod; }
+    bool hasArg(const char *name) const;
+    String arg(const char *name) const;
+    // Adds a header to the response of the current request; call before send()
+    void sendHeader(const char *name, const String &value);
+    void send(int code, const char *contentType, const String &content);
+    void send(int code, const char *contentType, const char *content);
+
+    HttpStats stats() const { return httpStats; }
+    size_t openConnections() const { return connections.size(); }
+
+private:
+    struct Connection
+    {
+        WiFiClient client;
+        String buffer;             // Received bytes not yet consumed by a request
+        unsigned long lastActivityMs;
+        uint16_t requests;
+        bool closeAfterResponse;
+        bool responded;            // The current request has been answered
+    };
+
+    struct Route
+    {
+        String uri;
+        HttpMethod method;
+        Handler handler;
+    };
+
+    void accept_clients();
+    bool read_into(Connection &conn);
+    // Parses and answers the request at the head of conn.buffer. Returns false when more
+    // bytes are needed or the connection has to be closed.
+    bool serve_one(Connection &conn);
+    void dispatch();
+    void write_response(int code, const char *contentType, const char *content, size_t length);
+
+    WiFiServer listener;
+    std::vector<Connection> connections;
+    std::vector<Route> routes;
+    Handler notFoundHandler;
+    HttpStats httpStats = {};
+
+    Connection *current = nullptr;
+    HttpMethod requestMethod = HttpMethod::GET;
+    String requestUri;
+    std::vector<std::pair<String, String>> requestArgs;
+    String responseHeaders; // "Name: value\r\n" lines from sendHeader()
+};
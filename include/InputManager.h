@@ -1,4 +1,46 @@
 #pragma once
+#include <Arduino.h>
+#include "config.h"
+
+// Buttons and the optional matrix, debounced by a periodic scan. Presses of the direct
+// buttons come from their GPIO interrupt instead: the first falling edge after a quiet
+// line counts at once and wakes the loop task, so a macro started by the action button
+// sends its first report within the same pass; the bounces that follow are ignored. A
+// press the interrupt misses is still reported by the scan, one debounce later.
+
+constexpr size_t INPUT_LATENCY_BUCKET_COUNT = sizeof(INPUT_LATENCY_BUCKETS_US) / sizeof(INPUT_LATENCY_BUCKETS_US[0]) + 1;
+
+struct InputLatencyMetrics
+{
+    uint32_t presses; // Presses whose first report was sent
+    uint32_t lastLatencyUs;
+    uint32_t maxLatencyUs;
+    uint64_t latencySumUs;
+    uint32_t buckets[INPUT_LATENCY_BUCKET_COUNT]; // Counts per INPUT_LATENCY_BUCKETS_US bound, then the rest
+};
+
+// Must be called from the loop task: the button interrupts wake it up.
 void input_init();
+// Same with other direct buttons than INPUT_PINS and another matrix than MATRIX_ROW_PINS x
+// MATRIX_COL_PINS (none if rows is 0), replacing those of an earlier call. A matrix with a
+// row outside GPIO0-31 or more than 32 keys is left out.
+void input_init(const int *pins, size_t count, const int *rowPins = nullptr, size_t rows = 0, const int *colPins = nullptr, size_t cols = 0);
+// Samples every configured input and advances the debounce. Call once per loop() pass.
+void input_scan();
+// True once per debounced press of a direct button (GPIO number as in config.h).
+bool input_was_pressed(int pin);
+// Debounced level of a direct button.
+bool input_is_held(int pin);
+// True once per debounced press of a key in the optional button matrix. Keys are numbered
+// row by row: row * columns + column.
+bool input_matrix_was_pressed(int key);
+// micros() at the last press edge of a direct button, taken in its interrupt.
+uint32_t input_press_time_us(int pin);
+
 bool input_is_mode_btn_pressed();
-bool input_is_action_btn_pressed();
\ No newline at end of file
+bool input_is_action_btn_pressed();
+
+// Call once the first report for a button press has been sent, with both micros() stamps.
+void input_record_reaction(uint32_t pressedUs, uint32_t reportUs);
+InputLatencyMetrics input_get_latency();
+void input_print_latency(Print &out);
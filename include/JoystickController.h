@@ -1,7 +1,51 @@
 #pragma once
 #include <vector>
-#include "WebPortal.h"
+#include <Arduino.h>
+#include "MacroStore.h"
+
+// HID edge timing as observed by the player (all times in microseconds).
+struct JoystickMetrics
+{
+    uint32_t leadUs;              // Current moving estimate of the report send latency
+    uint32_t lastLatencyUs;       // Send latency of the most recent edge
+    int32_t lastResidualUs;       // Sent-at minus deadline of the most recent edge
+    uint32_t maxResidualUs;       // Largest |residual| seen
+    uint64_t residualSumUs;       // Sum of |residual|, for the mean
+    uint32_t edges;               // Edges sent by the macro player
+    uint32_t edgesOutOfTolerance; // Edges with |residual| > HID_TIMING_TOLERANCE_US
+    uint32_t reanchors;           // Edges sent that late, which restarted the timeline from their send time
+};
 
 void joystick_init();
 void joystick_run_macro(const std::vector<MacroStep>& sequence, bool isRunning);
-bool joystick_is_connected();
\ No newline at end of file
+bool joystick_is_connected();
+// Time until the macro player has to run again to hit its next edge (0 = now, ~0UL = nothing scheduled).
+unsigned long joystick_us_until_next_edge();
+JoystickMetrics joystick_get_metrics();
+// micros() when the macro player's last report was handed to the BLE stack.
+unsigned long joystick_last_report_us();
+void joystick_print_metrics(Print &out);
+
+// --- Frame-synchronous playback ---
+// With a frame rate set, every press and release lands on a 1/hz grid anchored at the start
+// of the run, each press is held for at least FRAME_MIN_HELD frames and every gap lasts at
+// least one frame. 0 restores millisecond timing. The rate is persisted and applies from the
+// next start of the macro.
+bool joystick_set_frame_rate(int hz);
+uint8_t joystick_get_frame_rate();
+// How long the player holds a step, and the gap it leaves after every step, at a frame rate
+// (0 = millisecond timing). The optimizer's cost model is built on these.
+uint32_t joystick_hold_us(const MacroStep &step, uint8_t frameRateHz);
+uint32_t joystick_gap_us(uint8_t frameRateHz);
+// --- Player position, for checkpoints ---
+int joystick_step_index();
+// True while the button of the current step is held (false in the gap and when idle).
+bool joystick_is_pressing();
+// Makes the next start of the macro begin at the given step instead of step 0.
+void joystick_resume_at(int stepIndex);
+
+// Direct button control, used for live injection from the serial link.
+void joystick_press(int button);
+void joystick_release(int button);
+// Copies the newest output report written by the host, if one arrived since the last call.
+bool joystick_take_output_report(uint8_t *buffer, size_t len);
\ No newline at end of file
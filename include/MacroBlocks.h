@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include <Arduino.h>
+#include "MacroStore.h"
+
+// Content-addressed storage of macros in NVS.
+//
+// A macro is cut into blocks of MACRO_BLOCK_MIN_STEPS..MACRO_BLOCK_MAX_STEPS steps where a
+// hash of the last two steps hits MACRO_BLOCK_BOUNDARY_MASK. The cuts depend on the steps
+// only, so a run shared by several macros (the same menu-navigation prefix, say) is cut the
+// same way wherever it appears. Each block is stored once in PREFERENCES_NAMESPACE_BLOCKS,
+// under the FNV-1a hash of its text; a slot only holds the list of its block ids,
+// "@1a2b3c4d,5e6f7a8b,...". Loaded blocks stay cached in RAM, so switching between macros
+// that share blocks reads nothing but the list. A block is deleted once no slot refers
+// to it any more.
+//
+// Slots saved by older firmware hold the macro text itself. They still load, and are
+// converted the next time they are stored.
+
+struct MacroBlockMetrics
+{
+    uint32_t cacheHits;
+    uint32_t cacheMisses;     // Blocks read from NVS
+    uint32_t blocksWritten;   // New blocks queued for NVS
+    uint32_t blocksShared;    // Blocks of a stored macro that were already in NVS
+    uint32_t blocksCollected; // Blocks deleted once unreferenced
+    size_t cachedBlocks;
+    size_t cachedSteps;
+};
+
+// Queues the blocks of a macro that are not in NVS yet and returns the reference list to
+// store in its slot.
+String blocks_put(const std::vector<MacroStep> &sequence);
+// NVS bytes a macro takes as blocks_put() stores it: the reference list and each distinct
+// block, terminators included, whether or not another slot already shares the block.
+size_t blocks_storage_bytes(const std::vector<MacroStep> &sequence);
+// Resolves a slot value (reference list or legacy text) into steps. Returns false when a
+// referenced block is missing from NVS.
+bool blocks_get(const String &slotValue, std::vector<MacroStep> &sequence);
+// Deletes the blocks of a slot's previous value that none of the current slot values
+// refers to.
+void blocks_release(const String &previousValue, const std::vector<String> &slotValues);
+// Deletes every stored block that none of the slot values refers to: those left behind by
+// a power cut between a slot's write and the erase of its old blocks. Run once at boot.
+void blocks_collect(const std::vector<String> &slotValues);
+
+MacroBlockMetrics blocks_get_metrics();
+// Empties the RAM cache, as after a reboot.
+void blocks_drop_cache();
@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <Arduino.h>
+#include "MacroStore.h"
+
+// Save-time optimizer and cost model for macros.
+//
+// Costs follow the player's timing at the frame rate the macro will play at
+// (joystick_hold_us, joystick_gap_us): with frame sync every hold is rounded to whole frames
+// and lasts at least FRAME_MIN_HELD of them, every gap at least one. Steps on
+// MACRO_PAUSE_BUTTON send no report, so they only hold the player for that time. The
+// optimizer rewrites a macro into the shortest sequence the host sees identically:
+//   - steps that send nothing (no valid button, or no hold time) become pauses
+//   - adjacent pauses are folded into one, keeping the gap between them
+// Steps that, as played, still hold a button for less than HID_REPORT_INTERVAL_MS are
+// flagged; a macro without a single press held that long is rejected, as the host might
+// see none of it. The gap the player leaves between steps is always longer than a report
+// interval, so every release reaches the host and no macro goes over HID_MAX_REPORTS_PER_S;
+// neither needs checking per macro.
+
+struct MacroAnalysis
+{
+    size_t stepsIn;
+    size_t stepsOut;
+    size_t mergedSteps;                   // Steps folded into their neighbour
+    size_t noOpSteps;                     // Steps that could not send a report, turned into pauses
+    std::vector<size_t> belowResolution;  // Optimized step indices held shorter than one report interval
+    uint8_t frameRateHz;                  // Player timing the figures are for (0 = milliseconds)
+    uint32_t cycleMs;                     // One pass over the optimized macro, as played
+    uint32_t reportsPerCycle;             // HID reports sent per pass (press + release per step)
+    float reportsPerSecond;
+    size_t storageBytesIn;                // NVS bytes as stored in blocks, before and after optimizing
+    size_t storageBytesOut;
+    const char *rejection;                // Why the macro must not be stored, nullptr if it may
+};
+
+// Returns the optimized macro and fills in its analysis for playback at frameRateHz.
+std::vector<MacroStep> macro_optimize(const std::vector<MacroStep> &sequence, MacroAnalysis &analysis, uint8_t frameRateHz);
+// JSON object served by /analyze; includes the optimized macro in the text format.
+String macro_analysis_to_json(const MacroAnalysis &analysis, const std::vector<MacroStep> &optimized);
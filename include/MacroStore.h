@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <Arduino.h>
+
+struct MacroAnalysis;
+
+struct MacroStep
+{
+    int button;
+    int duration;
+};
+
+// Loads the active slot index and its macro from NVS.
+void macro_load();
+// The macro currently selected for playback.
+const std::vector<MacroStep> &macro_get_sequence();
+// Index of the active macro slot (0 .. MACRO_SLOT_COUNT - 1).
+int macro_get_slot();
+// Optimizes a macro for the current frame rate (see MacroOptimizer.h) and persists it into a slot. If the slot is the
+// active one, playback picks it up immediately. Returns false for an invalid slot or when
+// the analysis rejects the macro; the analysis is copied out when requested.
+bool macro_store(int slot, const std::vector<MacroStep> &sequence, MacroAnalysis *analysis = nullptr);
+// Increments whenever the active macro is replaced (load, store into the active slot, select).
+uint32_t macro_get_revision();
+// Makes a slot and its macro active without reading or writing NVS (checkpoint fast boot).
+void macro_restore(int slot, const std::vector<MacroStep> &sequence);
+// Makes another slot the active one and loads its macro. Without persist the choice only
+// lasts until the next boot (used by trigger branches, which would otherwise wear NVS).
+bool macro_select_slot(int slot, bool persist = true);
+
+// --- Text format helpers ("button,duration;button,duration;...") ---
+String macro_to_string(const std::vector<MacroStep> &sequence);
+std::vector<MacroStep> macro_parse(const String &seqString);
@@ -0,0 +1,57 @@
+#pragma once
+#include <Arduino.h>
+
+// Macro triggers driven by HID output reports from the host (rumble, player LEDs, ...).
+//
+// A watcher task picks up every output report, matches it against OUTPUT_TRIGGER_RULES
+// (OutputTrigger.cpp) and pushes the resulting actions into a single-producer /
+// single-consumer lock-free queue. It then wakes the loop task, which drains the queue
+// before running the player, so the first HID edge goes out in the same pass.
+//
+// Off unless built with PATRO_FEATURE_OUTPUT_TRIGGERS=1 (see config.h), which makes setup()
+// start the watcher; trigger_wait_us() is the loop's wait either way.
+
+enum class TriggerAction : uint8_t
+{
+    NONE,
+    START,  // Start playback of the active macro
+    STOP,   // Stop playback and release every button
+    BRANCH  // Switch to the macro of another slot, from its first step, and play it
+};
+
+struct TriggerEvent
+{
+    uint32_t receivedUs; // micros() when the watcher saw the output report
+    TriggerAction action;
+    uint8_t slot;        // BRANCH target
+};
+
+// Output report -> first reaction, as measured on the device (microseconds).
+struct TriggerMetrics
+{
+    uint32_t reports;       // Output reports seen
+    uint32_t events;        // Actions queued
+    uint32_t dropped;       // Actions lost to a full queue
+    uint32_t reactions;     // Loop passes that acted on at least one action
+    uint32_t lastLatencyUs;
+    uint32_t maxLatencyUs;
+    uint64_t latencySumUs;
+};
+
+// Remembers the loop task for wake-ups and starts the watcher task.
+void trigger_init();
+// One watcher pass: takes a pending output report from the gamepad, if any. Called by the
+// watcher task every OUTPUT_TRIGGER_POLL_MS, or directly by host simulations.
+void trigger_poll();
+// Producer side: matches one output report against the rules and queues the actions.
+void trigger_on_output_report(const uint8_t *report, size_t len);
+// Consumer side (loop task only): pops the oldest queued action.
+bool trigger_take(TriggerEvent &event);
+// Records the latency of a reaction that has just been sent to the host.
+void trigger_record_reaction(uint32_t receivedUs);
+// Sleeps for waitUs rounded up to whole RTOS ticks, so at most one tick more, and returns as
+// soon as the watcher queues an action or a button interrupt wakes the loop.
+void trigger_wait_us(unsigned long waitUs);
+
+TriggerMetrics trigger_get_metrics();
+void trigger_print_metrics(Print &out);
@@ -0,0 +1,59 @@
+#pragma once
+#include <Arduino.h>
+
+// Binary control protocol on the USB serial port.
+//
+// Every frame is COBS-encoded and delimited by 0x00 on both sides, so text written
+// by Serial.printf() between frames is simply discarded by the host as a bad frame.
+// Decoded layout: [type u8][seq u8][payload ...][crc16-ccitt LE over type..payload]
+//
+// The host may keep up to SERIAL_WINDOW frames in flight. Frames are only executed
+// in sequence order; the device answers with a cumulative ACK carrying the seq of the
+// last frame it accepted (go-back-N), or a NAK when a command was rejected.
+
+enum SerialFrameType : uint8_t
+{
+    // Host -> device
+    FRAME_SYNC = 0x01,         // Resets the expected sequence number to seq + 1
+    FRAME_PING = 0x02,         // No-op, used for round-trip measurements
+    FRAME_UPLOAD_BEGIN = 0x03, // slot u8, step count u16
+    FRAME_UPLOAD_DATA = 0x04,  // first step index u16, then [button u8, duration u16] per step
+    FRAME_UPLOAD_COMMIT = 0x05,
+    FRAME_SELECT_SLOT = 0x06, // slot u8
+    FRAME_START = 0x07,
+    FRAME_STOP = 0x08,
+    FRAME_BUTTON = 0x09,     // button u8, pressed u8
+    FRAME_FRAME_RATE = 0x0A, // hz u8 (0 = millisecond timing), applies from the next start
+    FRAME_FLEET_KEY = 0x0B,  // key u8[FLEET_KEY_BYTES] for signed fleet bundles (portal builds only)
+
+    // Device -> host
+    FRAME_ACK = 0x80, // status u8 (always OK)
+    FRAME_NAK = 0x81, // status u8
+};
+
+enum SerialStatus : uint8_t
+{
+    STATUS_OK = 0,
+    STATUS_BAD_LENGTH,
+    STATUS_BAD_SLOT,
+    STATUS_BAD_STATE,
+    STATUS_BAD_OFFSET,
+    STATUS_EMPTY,
+    STATUS_UNKNOWN_TYPE,
+    STATUS_REJECTED, // Upload refused by the macro analysis (e.g. no press the host could see)
+};
+
+// Playback requests that main.cpp turns into mode transitions.
+enum class SerialCommand
+{
+    NONE,
+    START,
+    STOP
+};
+
+constexpr uint8_t SERIAL_WINDOW = 8;
+
+// Configures the UART buffers and opens the port at SERIAL_BAUD.
+void serial_init();
+// Drains the UART, executes complete frames and sends the acknowledgement.
+SerialCommand serial_loop();
@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <Arduino.h>
+
+// Write-behind persistence for NVS.
+//
+// Writes are queued in RAM and return immediately; repeated writes to the same key are
+// coalesced into one, which is flushed in the place of the last of them: keys reach flash in
+// the order they were last written, and the erases of a batch after all of its values. A
+// background task flushes the queue once writes have been idle for
+// STORAGE_IDLE_FLUSH_MS (or at the latest STORAGE_MAX_DELAY_MS after the first one), and
+// a shutdown handler flushes it before any ESP.restart(). Reads see queued values.
+
+// Starts the flush task and registers the shutdown handler.
+void storage_init();
+
+String storage_get_string(const char *ns, const char *key, const String &defaultValue);
+uint8_t storage_get_uchar(const char *ns, const char *key, uint8_t defaultValue);
+void storage_put_string(const char *ns, const char *key, const String &value);
+void storage_put_uchar(const char *ns, const char *key, uint8_t value);
+// Queues the erase of a key; coalesces with queued writes like a put.
+void storage_remove(const char *ns, const char *key);
+// Keys of a namespace as reads see them: those in flash and those queued, less queued erases.
+std::vector<String> storage_list_keys(const char *ns);
+
+// Blocks until everything queued so far is in flash.
+void storage_flush();
+
+// --- Wear accounting ---
+// Flash writes of a key over the lifetime of the device. Macro blocks are written once
+// each and not counted. Counters are kept in RAM and saved at most every
+// STORAGE_WEAR_SAVE_MS and at shutdown, so a crash or power cut loses the writes counted
+// since the last save.
+uint32_t storage_write_count(const char *key);
+// Prints lifetime writes, writes this boot and writes saved by coalescing, per key.
+void storage_print_wear(Print &out);
@@ -1,18 +1,9 @@
 #pragma once
-#include <vector>
 #include <Arduino.h>
 
-struct MacroStep
-{
-    int button;
-    int duration;
-};
-
 void web_init();
 void web_stop();
 void web_loop();
-std::vector<MacroStep> web_get_sequence();
-void web_load_default_sequence();
 
 // --- Wi-Fi Management Functions ---
 // Attempts to load saved credentials and connect to a station Wi-Fi network.
@@ -23,6 +14,8 @@ void web_stop_sta_mode();
 bool web_is_in_ap_mode();
 // Helper to check if the ESP32 is currently connected to an external Wi-Fi station.
 bool web_is_in_sta_mode();
+// IP address obtained in station mode, for logging.
+String web_local_ip();
 
 // --- Generic Server Functions ---
 // Starts the web server (registers routes, calls begin())
@@ -1,4 +1,18 @@
 #pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Feature Switches ---
+// Set per environment in platformio.ini (e.g. -DPATRO_FEATURE_WEB_PORTAL=0).
+#ifndef PATRO_FEATURE_WEB_PORTAL
+#define PATRO_FEATURE_WEB_PORTAL 1
+#endif
+constexpr bool FEATURE_WEB_PORTAL = PATRO_FEATURE_WEB_PORTAL; // Wi-Fi AP/STA, captive portal and HTTP server
+// Off by default: with the rules in OutputTrigger.cpp, any game that rumbles would start the macro.
+#ifndef PATRO_FEATURE_OUTPUT_TRIGGERS
+#define PATRO_FEATURE_OUTPUT_TRIGGERS 0
+#endif
+constexpr bool FEATURE_OUTPUT_TRIGGERS = PATRO_FEATURE_OUTPUT_TRIGGERS; // Host output reports (rumble, player LEDs) start, stop and switch macros
 
 // --- Hardware Definitions ---
 constexpr int BTN_MODE_PIN = 18;   // Button 1: Toggles Modes
@@ -9,12 +23,99 @@ constexpr int LED_PIN = 2;         // Onboard LED
 constexpr char AP_SSID[] = "PatroSmart_Config";
 constexpr char AP_PASS[] = ""; // Open network
 
+// --- Portal HTTP Server ---
+constexpr uint16_t HTTP_PORT = 80;
+constexpr size_t HTTP_MAX_CLIENTS = 4;                // Open sockets; the oldest idle one makes room for a new client
+constexpr unsigned long HTTP_IDLE_TIMEOUT_MS = 5000;  // A kept-alive connection with no traffic for this long is closed
+constexpr uint16_t HTTP_MAX_REQUESTS_PER_CONN = 100;  // Then the connection is closed and the client reconnects
+constexpr size_t HTTP_MAX_REQUEST_BYTES = 4096;       // Request line, headers and body of one request
+constexpr uint8_t HTTP_PIPELINE_BUDGET = 4;           // Requests answered per connection per web_loop() pass
+
+// --- Fleet Distribution ---
+// Devices in MODE_STA_CONNECTED_BLE announce _patro._udp over mDNS and accept signed macro
+// bundles multicast by tools/fleet_push.py. Bundles are only accepted once a fleet key is set.
+constexpr char FLEET_MDNS_SERVICE[] = "_patro";
+constexpr uint8_t FLEET_MULTICAST_GROUP[4] = {239, 80, 84, 67};
+constexpr uint16_t FLEET_PORT = 47800;
+constexpr size_t FLEET_KEY_BYTES = 32;                      // HMAC-SHA256 key shared by the fleet
+constexpr size_t FLEET_CHUNK_BYTES = 1024;                  // Bundle bytes per datagram, under the Wi-Fi MTU
+constexpr size_t FLEET_MAX_CHUNKS = 32;                     // One bit each in a NACK
+constexpr unsigned long FLEET_NACK_JITTER_MS = 40;          // NACKs are spread over this window so a fleet does not answer at once
+constexpr unsigned long FLEET_NACK_TIMEOUT_MS = 250;        // Chunks still missing after this much silence are NACKed unprompted
+constexpr unsigned long FLEET_TRANSFER_TIMEOUT_MS = 30000;  // An incomplete transfer is dropped
+
+// --- Inputs ---
+// Direct buttons: active low with internal pull-ups. GPIO34-39 are input-only and have no
+// pull-ups: a button there needs an external pull-up resistor.
+constexpr int INPUT_PINS[] = {BTN_MODE_PIN, BTN_ACTION_PIN};
+// Optional diode button matrix (-1 = not fitted). Rows are driven low one at a time and
+// must be output-capable GPIOs below 32; columns are read with pull-ups (external ones on
+// GPIO34-39). Key n, counted row by row, selects macro slot n while no macro plays.
+constexpr int MATRIX_ROW_PINS[] = {-1};
+constexpr int MATRIX_COL_PINS[] = {-1};
+
 // --- Constants ---
-constexpr int DEBOUNCE_DELAY = 50; // ms
+constexpr int MATRIX_SETTLE_US = 5;                // Row settle time before sampling the matrix columns
+constexpr unsigned long INPUT_SCAN_PERIOD_MS = 10; // Debounce sample period, independent of how often loop() runs
+constexpr unsigned long INPUT_EDGE_QUIET_MS = 20;  // A direct button's falling edge is a press if the line was quiet this long before
+// Upper bounds of the button-to-first-report latency histogram; slower presses land in a last, open bucket
+constexpr uint32_t INPUT_LATENCY_BUCKETS_US[] = {250, 500, 1000, 2000, 5000, 10000, 20000, 50000};
+
+// --- Macro Playback ---
+constexpr unsigned long LOOP_PERIOD_MS = 10;         // loop() pass period when nothing is due sooner
+constexpr int DELAY_BETWEEN_STEPS_MS = 50;           // Gap between releasing one step and pressing the next
+constexpr uint32_t HID_SEND_LEAD_INITIAL_US = 0;     // Send-latency estimate before the first report
+constexpr int HID_SEND_LEAD_SMOOTHING_SHIFT = 3;     // Moving average weight 1/2^N per new sample
+constexpr uint32_t HID_TIMING_TOLERANCE_US = 1000;   // Edges further than this from their deadline are counted
+constexpr unsigned long METRICS_INTERVAL_MS = 10000; // How often the running player logs its timing metrics
+
+// --- Frame-Synchronous Playback ---
+constexpr uint8_t FRAME_RATE_DEFAULT_HZ = 0; // Game tick rate to quantize edges to (30, 60, 120...); 0 = off
+constexpr uint8_t FRAME_RATE_MAX_HZ = 240;   // Highest rate accepted from the serial link or portal
+constexpr uint32_t FRAME_MIN_HELD = 2;       // Minimum frames per press; the spare frame absorbs jitter against the game clock
+
+// --- HID Link Budget ---
+constexpr int HID_BUTTON_COUNT = 16;                                 // Buttons in the HID descriptor (BleGamepadConfiguration default)
+constexpr int MACRO_PAUSE_BUTTON = 0;                                // Step button that sends nothing and only waits
+constexpr int HID_REPORT_INTERVAL_MS = 15;                           // Typical BLE connection interval: shorter holds may never reach the host
+constexpr int HID_MAX_REPORTS_PER_S = 1000 / HID_REPORT_INTERVAL_MS; // Link budget; the gap between steps keeps every macro under it
+
+// --- Output Report Triggers ---
+constexpr uint16_t OUTPUT_REPORT_LENGTH = 8;     // Bytes the host may write (rumble, player LEDs, ...)
+constexpr size_t OUTPUT_TRIGGER_QUEUE_SIZE = 16; // Queued trigger actions, power of two
+constexpr uint32_t OUTPUT_TRIGGER_POLL_MS = 1;   // How often the watcher task checks for a new output report
+
+// --- Macro Storage ---
+constexpr int MACRO_SLOT_COUNT = 4;     // Number of macros kept in NVS
+constexpr size_t MACRO_MAX_STEPS = 256; // Upper bound for a single macro
+// Macros are stored as content-addressed blocks of steps (see MacroBlocks.h)
+// Tuned on the bench corpus: smaller blocks share more but lose it to NVS entry headers
+constexpr size_t MACRO_BLOCK_MIN_STEPS = 12;
+constexpr size_t MACRO_BLOCK_MAX_STEPS = 64;       // Cut here even without a content boundary
+constexpr uint32_t MACRO_BLOCK_BOUNDARY_MASK = 15; // Past the minimum, a step ends a block when its hash & mask == 0 (1 in 16)
+constexpr size_t MACRO_BLOCK_CACHE_STEPS = MACRO_SLOT_COUNT * MACRO_MAX_STEPS; // RAM cache bound, least recently used evicted
+
+// --- Serial Control Link ---
+constexpr unsigned long SERIAL_BAUD = 115200; // Up to 921600 with a good USB-UART bridge
+constexpr size_t SERIAL_RX_BUFFER = 1024;     // UART RX ring, sized for ~10 ms of 921600 baud traffic
+constexpr size_t SERIAL_MAX_FRAME = 256;      // Largest decoded frame (type + seq + payload + CRC)
+
+// --- Persistence ---
+constexpr unsigned long STORAGE_IDLE_FLUSH_MS = 500; // Flush once no write has been queued for this long
+constexpr unsigned long STORAGE_MAX_DELAY_MS = 3000; // Upper bound on how long a write may stay queued
+constexpr unsigned long STORAGE_WEAR_SAVE_MS = 600000; // Wear counters are written at most this often, and at shutdown
+constexpr uint8_t CHECKPOINT_MAX_RESUMES = 3;          // Resumes in a row before a crashing macro is given up on
+constexpr unsigned long CHECKPOINT_STABLE_MS = 60000;  // Playback this long after a resume clears the count
 
 // --- NVS Keys for Preferences ---
 constexpr const char* PREFERENCES_NAMESPACE_GENERAL = "patro_config"; // Namespace for macro
 constexpr const char* PREFERENCES_NAMESPACE_WIFI = "patro_wifi";      // New namespace for Wi-Fi credentials
-constexpr const char* MACRO_KEY = "macro_seq";                        // Key for macro
+constexpr const char* PREFERENCES_NAMESPACE_WEAR = "patro_wear";      // Lifetime write counters, one per key
+constexpr const char* PREFERENCES_NAMESPACE_BLOCKS = "patro_blocks";  // Macro step blocks, keyed by content hash
+constexpr const char* MACRO_KEY = "macro_seq";                        // Key for macro block list (slot N > 0 appends N)
+constexpr const char* ACTIVE_SLOT_KEY = "macro_slot";                 // Key for the active macro slot
+constexpr const char* FRAME_RATE_KEY = "frame_hz";                    // Key for the frame-synchronous playback rate
+constexpr const char* FLEET_KEY_KEY = "fleet_key";                    // Key for the fleet HMAC key (hex)
+constexpr const char* FLEET_BUNDLE_KEY = "fleet_bundle";              // Key for the id of the last bundle applied
 constexpr const char* WIFI_SSID_KEY = "wifi_ssid";                    // Key for STA SSID
 constexpr const char* WIFI_PASS_KEY = "wifi_pass";                    // Key for STA Password
\ No newline at end of file
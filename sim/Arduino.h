@@ -0,0 +1,202 @@
+#pragma once
+// Host stand-in for the Arduino core, just large enough for the firmware modules that
+// are built in the native environment. Time comes from the virtual clock in SimClock.h.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "SimClock.h"
+#include "freertos_sim.h"
+
+#define PROGMEM
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define digitalPinToInterrupt(p) (p)
+
+typedef uint8_t byte;
+
+class String
+{
+public:
+    String(const char *s = "") : str(s ? s : "") {}
+    String(const std::string &s) : str(s) {}
+    explicit String(char c) : str(1, c) {}
+    explicit String(int v) : str(std::to_string(v)) {}
+    explicit String(unsigned int v) : str(std::to_string(v)) {}
+    explicit String(long v) : str(std::to_string(v)) {}
+    explicit String(unsigned long v) : str(std::to_string(v)) {}
+    explicit String(float v, unsigned decimals = 2);
+
+    unsigned int length() const { return str.size(); }
+    bool isEmpty() const { return str.empty(); }
+    const char *c_str() const { return str.c_str(); }
+    char charAt(unsigned int i) const { return i < str.size() ? str[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    void reserve(unsigned int n) { str.reserve(n); }
+
+    String substring(unsigned int from) const { return from < str.size() ? String(str.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        if (from > to)
+            std::swap(from, to);
+        if (from >= str.size())
+            return String();
+        return String(str.substr(from, to - from));
+    }
+    int indexOf(char c, unsigned int from = 0) const
+    {
+        size_t p = str.find(c, from);
+        return p == std::string::npos ? -1 : (int)p;
+    }
+    int indexOf(const char *s, unsigned int from = 0) const
+    {
+        size_t p = str.find(s, from);
+        return p == std::string::npos ? -1 : (int)p;
+    }
+    bool startsWith(const String &prefix) const { return str.compare(0, prefix.str.size(), prefix.str) == 0; }
+    bool endsWith(const String &suffix) const
+    {
+        return str.size() >= suffix.str.size() && str.compare(str.size() - suffix.str.size(), suffix.str.size(), suffix.str) == 0;
+    }
+    long toInt() const { return atol(str.c_str()); }
+    void toLowerCase()
+    {
+        for (auto &c : str)
+            c = tolower((unsigned char)c);
+    }
+    void trim();
+    void remove(unsigned int index) { str.erase(std::min<size_t>(index, str.size())); }
+    void remove(unsigned int index, unsigned int count) { str.erase(std::min<size_t>(index, str.size()), count); }
+    bool concat(const char *s, unsigned int n)
+    {
+        str.append(s, n);
+        return true;
+    }
+
+    String &operator+=(const String &o)
+    {
+        str += o.str;
+        return *this;
+    }
+    String &operator+=(const char *o)
+    {
+        str += o;
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        str += c;
+        return *this;
+    }
+    bool operator==(const String &o) const { return str == o.str; }
+    bool operator==(const char *o) const { return str == o; }
+    bool operator!=(const String &o) const { return str != o.str; }
+    bool operator!=(const char *o) const { return str != o; }
+    bool operator<(const String &o) const { return str < o.str; }
+    bool equals(const String &o) const { return str == o.str; }
+    bool equalsIgnoreCase(const String &o) const;
+
+private:
+    std::string str;
+};
+
+inline String operator+(const String &a, const String &b)
+{
+    String r(a);
+    r += b;
+    return r;
+}
+inline String operator+(const String &a, const char *b)
+{
+    String r(a);
+    r += b;
+    return r;
+}
+inline String operator+(const char *a, const String &b)
+{
+    String r(a);
+    r += b;
+    return r;
+}
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+            write(buffer[i]);
+        return size;
+    }
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(int v) { return print(String(v)); }
+    size_t println(const char *s = "") { return print(s) + write("\n"); }
+    size_t println(const String &s) { return println(s.c_str()); }
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int availableForWrite() { return 1 << 16; }
+};
+
+// Serial writes go to stderr so that benchmark results on stdout stay machine readable.
+// Bytes queued with sim_serial_inject() are returned by read(). After sim_serial_attach()
+// the port is a file descriptor instead, paced at the baud rate given to begin().
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baud);
+    void end() {}
+    void setRxBufferSize(size_t size);
+    void setTxBufferSize(size_t) {}
+    void flush() {}
+    operator bool() const { return true; }
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+};
+extern HardwareSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+
+class EspClass
+{
+public:
+    void restart(); // Runs the shutdown handlers, then resets the virtual device
+    uint32_t getFreeHeap() { return 200 * 1024; }
+};
+extern EspClass ESP;
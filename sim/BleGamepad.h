@@ -0,0 +1,74 @@
+#pragma once
+// Fake BLE gamepad: every report that would be notified to the host is recorded with its
+// virtual timestamp. sendLatencyUs models the time sendReport() blocks in the BLE stack,
+// sendJitterUs how much that varies.
+#include <Arduino.h>
+#include <vector>
+#include "BleGamepadConfiguration.h"
+
+struct SimReport
+{
+    uint64_t timeUs;  // When the report reached the host
+    uint32_t buttons; // Bit n-1 = button n
+};
+
+class BleGamepad
+{
+public:
+    BleGamepad(const char *name = "", const char *manufacturer = "", uint8_t battery = 100) {}
+
+    void begin(BleGamepadConfiguration *config = nullptr)
+    {
+        if (config)
+            configuration = *config;
+    }
+    bool isConnected() { return connected; }
+
+    void press(uint8_t button = 1)
+    {
+        if (button == 0 || button > 32)
+            return;
+        buttons |= 1UL << (button - 1);
+        if (configuration.autoReport)
+            sendReport();
+    }
+    void release(uint8_t button = 1)
+    {
+        if (button == 0 || button > 32)
+            return;
+        buttons &= ~(1UL << (button - 1));
+        if (configuration.autoReport)
+            sendReport();
+    }
+    void sendReport()
+    {
+        sim_advance_us(sendLatencyUs + (sendJitterUs ? rand() % (sendJitterUs + 1) : 0));
+        reports.push_back({sim_now_us(), buttons});
+    }
+
+    // Output reports written by the host (rumble, player LEDs, ...)
+    bool isOutputReceived()
+    {
+        bool received = outputReceived;
+        outputReceived = false;
+        return received;
+    }
+    uint8_t *getOutputBuffer() { return outputBuffer; }
+    void simulateOutputReport(const uint8_t *data, size_t len)
+    {
+        memcpy(outputBuffer, data, std::min(len, sizeof(outputBuffer)));
+        outputReceived = true;
+    }
+
+    // --- Simulation state ---
+    BleGamepadConfiguration configuration;
+    bool connected = true;
+    uint32_t buttons = 0;
+    uint32_t sendLatencyUs = 0;
+    uint32_t sendJitterUs = 0; // Each report blocks up to this much longer, uniformly
+    std::vector<SimReport> reports;
+
+private:
+    bool outputReceived = false;
+    uint8_t outputBuffer[64] = {};
+};
@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+
+class BleGamepadConfiguration
+{
+public:
+    void setAutoReport(bool value) { autoReport = value; }
+    void setButtonCount(uint16_t value) { buttonCount = value; }
+    void setEnableOutputReport(bool value) { enableOutputReport = value; }
+    void setOutputReportLength(uint16_t value) { outputReportLength = value; }
+
+    bool autoReport = true;
+    uint16_t buttonCount = 16;
+    bool enableOutputReport = false;
+    uint16_t outputReportLength = 64;
+};
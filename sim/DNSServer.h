@@ -0,0 +1,11 @@
+#pragma once
+// Host stand-in for the captive-portal DNS server: nothing is resolved on the host.
+#include <WiFi.h>
+
+class DNSServer
+{
+public:
+    bool start(uint16_t, const String &, const IPAddress &) { return true; }
+    void processNextRequest() {}
+    void stop() {}
+};
@@ -0,0 +1,33 @@
+#pragma once
+// Host stand-in for the ESP32 mDNS responder: records the host name and services instead
+// of answering queries, so a simulation can check what a device would announce.
+#include <Arduino.h>
+
+class MDNSResponder
+{
+public:
+    struct Service
+    {
+        String name;
+        String proto;
+        uint16_t port;
+    };
+
+    bool begin(const char *name)
+    {
+        hostName = name;
+        services.clear();
+        return true;
+    }
+    void end()
+    {
+        hostName = "";
+        services.clear();
+    }
+    void addService(const char *name, const char *proto, uint16_t port) { services.push_back({name, proto, port}); }
+    bool addServiceTxt(const char *, const char *, const char *, const char *) { return true; }
+
+    String hostName;
+    std::vector<Service> services;
+};
+inline MDNSResponder MDNS;
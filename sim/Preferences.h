@@ -0,0 +1,52 @@
+#pragma once
+// Fake NVS: namespaces and keys live in a process-wide map, so values survive a simulated
+// ESP.restart(). Each put counts as one flash write in sim_nvs_write_count(), each get as
+// one read in sim_nvs_read_count().
+#include <Arduino.h>
+#include <map>
+#include <string>
+
+uint32_t sim_nvs_write_count();
+uint32_t sim_nvs_read_count();
+void sim_nvs_clear();
+// Power cut: the next `writes` flash writes land, every later put, remove or clear is lost.
+// A negative count restores power; sim_nvs_clear() does too.
+void sim_nvs_cut_power_after(int writes);
+// Copy of the keys and values in a namespace.
+std::map<std::string, std::string> sim_nvs_namespace(const char *ns);
+
+class Preferences
+{
+public:
+    bool begin(const char *name, bool readOnly = false);
+    void end();
+    bool clear();
+    bool remove(const char *key);
+    bool isKey(const char *key);
+
+    size_t putUChar(const char *key, uint8_t value) { return putBytes(key, &value, sizeof(value)); }
+    size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+    size_t putString(const char *key, const String &value) { return putBytes(key, value.c_str(), value.length()); }
+    size_t putString(const char *key, const char *value) { return putBytes(key, value, strlen(value)); }
+    size_t putBytes(const char *key, const void *value, size_t len);
+
+    uint8_t getUChar(const char *key, uint8_t defaultValue = 0) { return getValue(key, defaultValue); }
+    uint32_t getUInt(const char *key, uint32_t defaultValue = 0) { return getValue(key, defaultValue); }
+    String getString(const char *key, const String &defaultValue = String());
+    size_t getBytesLength(const char *key);
+    size_t getBytes(const char *key, void *buffer, size_t maxLen);
+
+private:
+    template <typename T>
+    T getValue(const char *key, T defaultValue)
+    {
+        T value = defaultValue;
+        if (getBytesLength(key) == sizeof(T))
+            getBytes(key, &value, sizeof(T));
+        return value;
+    }
+
+    std::string ns;
+    bool opened = false;
+    bool readOnly = true;
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Virtual clock shared by millis()/micros()/delay() and the fakes. It only moves when the
+// simulation advances it, so runs are deterministic and independent of host speed.
+uint64_t sim_now_us();
+void sim_advance_us(uint64_t us);
+void sim_reset_clock();
+
+// Number of operator new calls since start, for allocation accounting.
+uint64_t sim_allocation_count();
+
+// Fake GPIO input level (true = high). Buttons are active low.
+void sim_set_pin(int pin, bool high);
+// Closes or opens the matrix key between a row and a column pin: the column reads low while
+// the firmware drives that row low. Columns have no interrupt.
+void sim_set_matrix_key(int rowPin, int colPin, bool pressed);
+// While deferred, pin interrupts queue up instead of running; ending the deferral runs them
+// against the levels of that moment, like an ISR entered after the line has moved on.
+void sim_defer_interrupts(bool defer);
+// Queues bytes for Serial.read().
+void sim_serial_inject(const uint8_t *data, size_t len);
+// Suppresses firmware log output on stderr (default on).
+void sim_serial_mute(bool mute);
+// Connects Serial to a file descriptor (e.g. a pty) as a UART would be: bytes take 10 bit
+// times each way, and received bytes that do not fit the RX buffer are lost.
+void sim_serial_attach(int fd);
+// Moves bytes between the descriptor and the UART buffers up to the current time.
+void sim_serial_poll();
+// Received bytes lost to a full RX buffer.
+uint32_t sim_serial_rx_dropped();
+// Counts ESP.restart() calls since start.
+uint32_t sim_restart_count();
+// Seeds esp_random(), e.g. differently per simulated node.
+void sim_seed_random(uint32_t seed);
+// Fraction of received UDP datagrams that WiFiUDP drops (default 0).
+void sim_udp_set_loss(float fraction);
+float sim_udp_loss();
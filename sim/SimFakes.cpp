@@ -0,0 +1,439 @@
+// Definitions behind the host fakes in sim/: virtual clock, GPIO, Serial, NVS and heap
+// accounting.
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_system.h>
+#include <nvs.h>
+#include <soc/gpio_reg.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <new>
+
+// --- Virtual clock ---
+static uint64_t simTimeUs = 0;
+
+uint64_t sim_now_us() { return simTimeUs; }
+void sim_advance_us(uint64_t us) { simTimeUs += us; }
+void sim_reset_clock() { simTimeUs = 0; }
+
+unsigned long millis() { return (unsigned long)(simTimeUs / 1000); }
+unsigned long micros() { return (unsigned long)simTimeUs; }
+void delay(unsigned long ms) { simTimeUs += (uint64_t)ms * 1000; }
+void delayMicroseconds(unsigned int us) { simTimeUs += us; }
+void yield() {}
+
+// --- Heap accounting ---
+static uint64_t simAllocations = 0;
+
+uint64_t sim_allocation_count() { return simAllocations; }
+
+void *operator new(size_t size)
+{
+    simAllocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// --- String helpers ---
+String::String(float v, unsigned decimals)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+    str = buf;
+}
+
+void String::trim()
+{
+    size_t start = str.find_first_not_of(" \t\r\n");
+    size_t end = str.find_last_not_of(" \t\r\n");
+    str = start == std::string::npos ? std::string() : str.substr(start, end - start + 1);
+}
+
+bool String::equalsIgnoreCase(const String &o) const
+{
+    return str.size() == o.str.size() &&
+           std::equal(str.begin(), str.end(), o.str.begin(), [](char a, char b)
+                      { return tolower((unsigned char)a) == tolower((unsigned char)b); });
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0)
+        return 0;
+    return write((const uint8_t *)buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
+
+// --- Serial ---
+struct WireByte
+{
+    uint64_t atUs; // When its last bit is on the wire
+    uint8_t value;
+};
+
+HardwareSerial Serial;
+static bool serialMuted = true;
+static std::deque<uint8_t> serialRx;
+static int serialFd = -1;
+static uint32_t serialByteUs = 87; // 10 bits at 115200 baud
+static size_t serialRxSize = 256;  // The core's default RX ring
+static uint32_t serialRxDropped = 0;
+static std::deque<WireByte> serialRxWire, serialTxWire;
+
+void sim_serial_mute(bool mute) { serialMuted = mute; }
+void sim_serial_inject(const uint8_t *data, size_t len) { serialRx.insert(serialRx.end(), data, data + len); }
+void sim_serial_attach(int fd) { serialFd = fd; }
+uint32_t sim_serial_rx_dropped() { return serialRxDropped; }
+
+// Bytes queue up behind each other on the wire, one byte time apart
+static void wire_push(std::deque<WireByte> &wire, uint8_t value)
+{
+    uint64_t start = wire.empty() ? simTimeUs : std::max(simTimeUs, wire.back().atUs);
+    wire.push_back({start + serialByteUs, value});
+}
+
+void sim_serial_poll()
+{
+    if (serialFd < 0)
+        return;
+    uint8_t buf[256];
+    ssize_t n;
+    while ((n = ::read(serialFd, buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t i = 0; i < n; i++)
+            wire_push(serialRxWire, buf[i]);
+    }
+    while (!serialRxWire.empty() && serialRxWire.front().atUs <= simTimeUs)
+    {
+        if (serialRx.size() < serialRxSize)
+            serialRx.push_back(serialRxWire.front().value);
+        else
+            serialRxDropped++;
+        serialRxWire.pop_front();
+    }
+    while (!serialTxWire.empty() && serialTxWire.front().atUs <= simTimeUs)
+    {
+        size_t count = 0;
+        while (count < serialTxWire.size() && count < sizeof(buf) && serialTxWire[count].atUs <= simTimeUs)
+        {
+            buf[count] = serialTxWire[count].value;
+            count++;
+        }
+        ssize_t written = ::write(serialFd, buf, count);
+        if (written <= 0)
+            break; // The other end is not reading: try again on the next poll
+        serialTxWire.erase(serialTxWire.begin(), serialTxWire.begin() + written);
+    }
+}
+
+void HardwareSerial::begin(unsigned long baud) { serialByteUs = (10000000UL + baud - 1) / baud; }
+void HardwareSerial::setRxBufferSize(size_t size) { serialRxSize = size; }
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    if (serialFd >= 0)
+    {
+        for (size_t i = 0; i < size; i++)
+            wire_push(serialTxWire, buffer[i]);
+        sim_serial_poll();
+    }
+    else if (!serialMuted)
+    {
+        fwrite(buffer, 1, size, stderr);
+    }
+    return size;
+}
+int HardwareSerial::available()
+{
+    sim_serial_poll();
+    return (int)serialRx.size();
+}
+int HardwareSerial::read()
+{
+    if (serialRx.empty())
+        return -1;
+    uint8_t c = serialRx.front();
+    serialRx.pop_front();
+    return c;
+}
+
+// --- GPIO ---
+static uint64_t pinLevels = ~0ULL; // Pull-ups: everything idles high
+static uint32_t outputLevels = 0xFFFFFFFF;
+
+struct PinInterrupt
+{
+    void (*handler)(void *);
+    void *arg;
+    int mode;
+};
+static PinInterrupt pinInterrupts[64];
+static bool interruptsDeferred = false;
+static std::deque<int> deferredInterrupts;
+static std::vector<std::pair<int, int>> closedMatrixKeys; // (row pin, column pin)
+
+// A level change runs the pin's interrupt handler straight away, as the GPIO ISR would
+void sim_set_pin(int pin, bool high)
+{
+    bool wasHigh = (pinLevels >> pin) & 1;
+    if (high)
+        pinLevels |= 1ULL << pin;
+    else
+        pinLevels &= ~(1ULL << pin);
+
+    const PinInterrupt &irq = pinInterrupts[pin];
+    bool fires = irq.mode == CHANGE || (irq.mode == RISING && high) || (irq.mode == FALLING && !high);
+    if (!irq.handler || high == wasHigh || !fires)
+        return;
+    if (interruptsDeferred)
+        deferredInterrupts.push_back(pin);
+    else
+        irq.handler(irq.arg);
+}
+
+void sim_defer_interrupts(bool defer)
+{
+    interruptsDeferred = defer;
+    while (!defer && !deferredInterrupts.empty())
+    {
+        const PinInterrupt &irq = pinInterrupts[deferredInterrupts.front()];
+        deferredInterrupts.pop_front();
+        if (irq.handler)
+            irq.handler(irq.arg);
+    }
+}
+
+void sim_set_matrix_key(int rowPin, int colPin, bool pressed)
+{
+    auto key = std::make_pair(rowPin, colPin);
+    auto it = std::find(closedMatrixKeys.begin(), closedMatrixKeys.end(), key);
+    if (pressed && it == closedMatrixKeys.end())
+        closedMatrixKeys.push_back(key);
+    else if (!pressed && it != closedMatrixKeys.end())
+        closedMatrixKeys.erase(it);
+}
+
+// A closed key pulls its column low while its row is driven low
+static uint64_t input_levels()
+{
+    uint64_t levels = pinLevels;
+    for (const auto &key : closedMatrixKeys)
+    {
+        if (!((outputLevels >> key.first) & 1))
+            levels &= ~(1ULL << key.second);
+    }
+    return levels;
+}
+
+uint32_t sim_reg_read(int reg)
+{
+    switch (reg)
+    {
+    case GPIO_IN_REG:
+        return (uint32_t)input_levels();
+    case GPIO_IN1_REG:
+        return (uint32_t)(input_levels() >> 32);
+    case GPIO_OUT_REG:
+        return outputLevels;
+    default:
+        return 0;
+    }
+}
+
+void sim_reg_write(int reg, uint32_t value)
+{
+    if (reg == GPIO_OUT_W1TS_REG)
+        outputLevels |= value;
+    else if (reg == GPIO_OUT_W1TC_REG)
+        outputLevels &= ~value;
+    else if (reg == GPIO_OUT_REG)
+        outputLevels = value;
+}
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    if (pin < 32)
+        sim_reg_write(value ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG, 1UL << pin);
+}
+int digitalRead(uint8_t pin) { return (pinLevels >> pin) & 1; }
+void attachInterrupt(uint8_t, void (*)(void), int) {}
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode) { pinInterrupts[pin] = {handler, arg, mode}; }
+void detachInterrupt(uint8_t pin) { pinInterrupts[pin] = {}; }
+
+// --- Restart and reset reason ---
+EspClass ESP;
+static std::vector<shutdown_handler_t> shutdownHandlers;
+static esp_reset_reason_t resetReason = ESP_RST_POWERON;
+static uint32_t restartCount = 0;
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    shutdownHandlers.push_back(handler);
+    return ESP_OK;
+}
+
+void EspClass::restart()
+{
+    for (auto handler : shutdownHandlers)
+        handler();
+    restartCount++;
+    resetReason = ESP_RST_SW;
+}
+
+uint32_t sim_restart_count() { return restartCount; }
+esp_reset_reason_t esp_reset_reason(void) { return resetReason; }
+void sim_set_reset_reason(esp_reset_reason_t reason) { resetReason = reason; }
+
+// --- Random numbers and datagram loss ---
+static uint32_t randomState = 0x9E3779B9;
+static float udpLoss = 0.0f;
+
+uint32_t esp_random(void)
+{
+    // xorshift32
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+void sim_seed_random(uint32_t seed) { randomState = seed ? seed : 0x9E3779B9; }
+void sim_udp_set_loss(float fraction) { udpLoss = fraction; }
+float sim_udp_loss() { return udpLoss; }
+
+// --- NVS ---
+static std::map<std::string, std::map<std::string, std::string>> nvs;
+static uint32_t nvsWrites = 0;
+static uint32_t nvsReads = 0;
+static int nvsWritesLeft = -1; // Until the power cut (-1 = powered)
+
+// Counts one flash write; false once the power is gone
+static bool nvs_write()
+{
+    if (nvsWritesLeft == 0)
+        return false;
+    if (nvsWritesLeft > 0)
+        nvsWritesLeft--;
+    nvsWrites++;
+    return true;
+}
+
+uint32_t sim_nvs_write_count() { return nvsWrites; }
+uint32_t sim_nvs_read_count() { return nvsReads; }
+void sim_nvs_clear()
+{
+    nvs.clear();
+    nvsWrites = 0;
+    nvsReads = 0;
+    nvsWritesLeft = -1;
+}
+
+std::map<std::string, std::string> sim_nvs_namespace(const char *ns) { return nvs[ns]; }
+void sim_nvs_cut_power_after(int writes) { nvsWritesLeft = writes < 0 ? -1 : writes; }
+
+// The values carry no type, so every entry matches whatever type is asked for
+struct nvs_opaque_iterator_t
+{
+    std::string ns;
+    std::vector<std::string> keys;
+    size_t index;
+};
+
+nvs_iterator_t nvs_entry_find(const char *, const char *namespace_name, nvs_type_t)
+{
+    auto found = nvs.find(namespace_name);
+    if (found == nvs.end() || found->second.empty())
+        return nullptr;
+    nvs_iterator_t iterator = new nvs_opaque_iterator_t{namespace_name, {}, 0};
+    for (const auto &entry : found->second)
+        iterator->keys.push_back(entry.first);
+    return iterator;
+}
+
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator)
+{
+    if (++iterator->index < iterator->keys.size())
+        return iterator;
+    delete iterator;
+    return nullptr;
+}
+
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t *info)
+{
+    snprintf(info->namespace_name, sizeof(info->namespace_name), "%s", iterator->ns.c_str());
+    snprintf(info->key, sizeof(info->key), "%s", iterator->keys[iterator->index].c_str());
+    info->type = NVS_TYPE_ANY;
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator) { delete iterator; }
+
+bool Preferences::begin(const char *name, bool ro)
+{
+    ns = name;
+    readOnly = ro;
+    opened = true;
+    return true;
+}
+
+void Preferences::end() { opened = false; }
+
+bool Preferences::clear()
+{
+    if (!opened || readOnly || !nvs_write())
+        return false;
+    nvs[ns].clear();
+    return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+    if (!opened || readOnly || nvs[ns].count(key) == 0)
+        return false; // Like nvs_erase_key(), a missing key costs no flash write
+    if (!nvs_write())
+        return false;
+    nvs[ns].erase(key);
+    return true;
+}
+
+bool Preferences::isKey(const char *key) { return opened && nvs[ns].count(key) > 0; }
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len)
+{
+    if (!opened || readOnly || !nvs_write())
+        return 0;
+    nvs[ns][key] = std::string((const char *)value, len);
+    return len;
+}
+
+String Preferences::getString(const char *key, const String &defaultValue)
+{
+    nvsReads++;
+    if (!isKey(key))
+        return defaultValue;
+    return String(nvs[ns][key]);
+}
+
+size_t Preferences::getBytesLength(const char *key) { return isKey(key) ? nvs[ns][key].size() : 0; }
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t maxLen)
+{
+    nvsReads++;
+    if (!isKey(key))
+        return 0;
+    const std::string &value = nvs[ns][key];
+    size_t n = std::min(maxLen, value.size());
+    memcpy(buffer, value.data(), n);
+    return n;
+}
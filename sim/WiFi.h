@@ -0,0 +1,204 @@
+#pragma once
+// Host stand-in for the ESP32 WiFi library, just large enough for WebPortal,
+// HttpServer and FleetSync. WiFiServer and WiFiClient are real sockets on loopback so that the portal
+// can be driven by ordinary HTTP clients; the radio calls only record state.
+//
+// Like the ESP32 core, copies of a WiFiClient share one socket, which is closed when the
+// last copy is stopped or destroyed.
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+
+enum wifi_mode_t
+{
+    WIFI_OFF,
+    WIFI_STA,
+    WIFI_AP,
+    WIFI_AP_STA
+};
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+// Privileged ports are served 8000 higher (the portal's 80 on 8080)
+inline uint16_t sim_listen_port(uint16_t port) { return port < 1024 ? port + 8000 : port; }
+
+class IPAddress
+{
+public:
+    IPAddress(uint32_t address = 0) : address(address) {} // Network byte order, as on the ESP32
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address(htonl((uint32_t)a << 24 | b << 16 | c << 8 | d)) {}
+    operator uint32_t() const { return address; }
+    String toString() const
+    {
+        char text[INET_ADDRSTRLEN];
+        in_addr in = {address};
+        return String(inet_ntop(AF_INET, &in, text, sizeof(text)));
+    }
+
+private:
+    uint32_t address;
+};
+
+class WiFiClient : public Stream
+{
+public:
+    WiFiClient() {}
+    explicit WiFiClient(int fd) : socket(std::make_shared<Socket>(fd)) {}
+
+    operator bool() const { return socket != nullptr; }
+    bool connected()
+    {
+        if (!socket)
+            return false;
+        char c;
+        ssize_t n = recv(socket->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+    int available() override
+    {
+        int n = 0;
+        return socket && ioctl(socket->fd, FIONREAD, &n) == 0 ? n : 0;
+    }
+    int read(uint8_t *buffer, size_t size)
+    {
+        if (!socket)
+            return -1;
+        ssize_t n = recv(socket->fd, buffer, size, MSG_DONTWAIT);
+        return n < 0 ? -1 : (int)n;
+    }
+    int read() override
+    {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        size_t sent = 0;
+        while (socket && sent < size)
+        {
+            ssize_t n = ::send(socket->fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+        return sent;
+    }
+    using Print::write;
+    void setNoDelay(bool noDelay)
+    {
+        int flag = noDelay;
+        if (socket)
+            setsockopt(socket->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+    IPAddress remoteIP()
+    {
+        sockaddr_in peer = {};
+        socklen_t length = sizeof(peer);
+        if (!socket || getpeername(socket->fd, (sockaddr *)&peer, &length) != 0)
+            return IPAddress();
+        return IPAddress(peer.sin_addr.s_addr);
+    }
+    void flush() {}
+    void stop() { socket.reset(); }
+
+private:
+    struct Socket
+    {
+        explicit Socket(int fd) : fd(fd) {}
+        ~Socket() { close(fd); }
+        int fd;
+    };
+    std::shared_ptr<Socket> socket;
+};
+
+class WiFiServer
+{
+public:
+    WiFiServer(uint16_t port = 80, uint8_t maxClients = 4) : port(port), maxClients(maxClients) {}
+    ~WiFiServer() { stop(); }
+
+    void begin()
+    {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(sim_listen_port(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listenFd, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, maxClients) != 0)
+        {
+            perror("WiFiServer::begin");
+            stop();
+            return;
+        }
+        fcntl(listenFd, F_SETFL, O_NONBLOCK);
+    }
+    void stop()
+    {
+        if (listenFd >= 0)
+            close(listenFd);
+        listenFd = -1;
+    }
+    bool hasClient()
+    {
+        pollfd pending = {listenFd, POLLIN, 0};
+        return listenFd >= 0 && poll(&pending, 1, 0) > 0;
+    }
+    WiFiClient accept()
+    {
+        int fd = listenFd < 0 ? -1 : ::accept(listenFd, nullptr, nullptr);
+        return fd < 0 ? WiFiClient() : WiFiClient(fd);
+    }
+    WiFiClient available() { return accept(); }
+    void setNoDelay(bool) {}
+
+private:
+    uint16_t port;
+    uint8_t maxClients;
+    int listenFd = -1;
+};
+
+// Radio state only; the scan returns a fixed list
+class WiFiClass
+{
+public:
+    void mode(wifi_mode_t m) { wifiMode = m; }
+    wifi_mode_t getMode() { return wifiMode; }
+    bool softAP(const char *, const char * = nullptr) { return true; }
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    void begin(const char *, const char *) { wifiStatus = WL_CONNECTED; }
+    bool disconnect(bool = false, bool = false)
+    {
+        wifiStatus = WL_DISCONNECTED;
+        return true;
+    }
+    int status() { return wifiStatus; }
+    int scanNetworks() { return 3; }
+    String SSID(int i) { return i == 0 ? "HomeNetwork" : i == 1 ? "Office" : ""; }
+    int RSSI(int i) { return -40 - 15 * i; }
+    void scanDelete() {}
+    String macAddress()
+    {
+        char text[18];
+        snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        return text;
+    }
+
+    uint8_t mac[6] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01}; // Set per simulated node
+
+private:
+    wifi_mode_t wifiMode = WIFI_OFF;
+    int wifiStatus = WL_DISCONNECTED;
+};
+inline WiFiClass WiFi;
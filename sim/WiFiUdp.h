@@ -0,0 +1,95 @@
+#pragma once
+// Host stand-in for the ESP32 WiFiUDP class on a real UDP socket. beginMulticast() joins
+// the group on the loopback interface, so several simulated devices on one host receive
+// the same datagrams. sim_udp_set_loss() drops that fraction of received datagrams at
+// random, standing in for multicast loss on Wi-Fi.
+#include <WiFi.h>
+#include <esp_system.h>
+
+class WiFiUDP
+{
+public:
+    ~WiFiUDP() { stop(); }
+
+    uint8_t beginMulticast(IPAddress group, uint16_t port)
+    {
+        stop();
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        ip_mreq membership = {};
+        membership.imr_multiaddr.s_addr = (uint32_t)group;
+        membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (sockaddr *)&address, sizeof(address)) != 0 ||
+            setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0)
+        {
+            perror("WiFiUDP::beginMulticast");
+            stop();
+            return 0;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        return 1;
+    }
+    void stop()
+    {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+
+    int parsePacket()
+    {
+        for (;;)
+        {
+            sockaddr_in from = {};
+            socklen_t fromLength = sizeof(from);
+            ssize_t n = fd < 0 ? -1 : recvfrom(fd, rx, sizeof(rx), 0, (sockaddr *)&from, &fromLength);
+            if (n <= 0)
+                return 0;
+            if (esp_random() < sim_udp_loss() * 4294967296.0)
+                continue; // Lost on the air
+            rxLength = n;
+            rxPos = 0;
+            peer = from;
+            return (int)n;
+        }
+    }
+    int read(uint8_t *buffer, size_t length)
+    {
+        size_t n = std::min(length, rxLength - rxPos);
+        memcpy(buffer, rx + rxPos, n);
+        rxPos += n;
+        return (int)n;
+    }
+    IPAddress remoteIP() { return IPAddress(peer.sin_addr.s_addr); }
+    uint16_t remotePort() { return ntohs(peer.sin_port); }
+
+    int beginPacket(IPAddress ip, uint16_t port)
+    {
+        tx.clear();
+        txTo = {};
+        txTo.sin_family = AF_INET;
+        txTo.sin_port = htons(port);
+        txTo.sin_addr.s_addr = (uint32_t)ip;
+        return 1;
+    }
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        tx.insert(tx.end(), buffer, buffer + size);
+        return size;
+    }
+    int endPacket() { return fd >= 0 && sendto(fd, tx.data(), tx.size(), 0, (sockaddr *)&txTo, sizeof(txTo)) == (ssize_t)tx.size(); }
+
+private:
+    int fd = -1;
+    uint8_t rx[1500];
+    size_t rxLength = 0;
+    size_t rxPos = 0;
+    sockaddr_in peer = {};
+    std::vector<uint8_t> tx;
+    sockaddr_in txTo = {};
+};
@@ -0,0 +1,1082 @@
+// Host benchmark suite for the playback hot path. Build and run with
+//     pio run -e native -t exec
+// Every scenario runs on the virtual clock, so timing numbers are exact and repeatable;
+// only the "*_ns" / "*_per_s" throughput figures depend on the host CPU.
+//
+// Output is one "metric value unit" line per result, suitable for diffing between commits.
+// The exit status is non-zero when a timing check (frame_sync.*, stall.*, trigger.*,
+// input.*) or blocks.* fails. Behavior checks live in test/ and run with
+//     pio test -e native
+//
+// The native env builds this file with the firmware sources, and so does `pio test -e
+// native` for the tests in test/, which bring their own main().
+#ifndef PIO_UNIT_TESTING
+#include <Arduino.h>
+#include <BleGamepad.h>
+#include <Preferences.h>
+#include <esp_system.h>
+#include <stdio.h>
+#include <chrono>
+#include <cmath>
+#include "config.h"
+#include "Checkpoint.h"
+#include "InputManager.h"
+#include "JoystickController.h"
+#include "MacroBlocks.h"
+#include "MacroOptimizer.h"
+#include "OutputTrigger.h"
+#include "MacroStore.h"
+#include "Storage.h"
+
+extern BleGamepad bleGamepad;
+
+struct BenchOptions
+{
+    uint32_t tickUs = LOOP_PERIOD_MS * 1000; // loop() period when nothing is due sooner
+    uint32_t seconds = 600;                  // Virtual time per replay scenario
+    uint32_t sendLatencyUs = 0;              // Time each fake report blocks in sendReport()
+};
+
+static void report(const String &name, double value, const char *unit)
+{
+    printf("%-44s %14.2f %s\n", name.c_str(), value, unit);
+}
+
+static double percentile(std::vector<double> values, double pct)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t idx = std::min(values.size() - 1, (size_t)(values.size() * pct / 100.0));
+    return values[idx];
+}
+
+static double mean_abs(const std::vector<double> &values)
+{
+    double sum = 0;
+    for (double v : values)
+        sum += std::fabs(v);
+    return values.empty() ? 0 : sum / values.size();
+}
+
+static double wall_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Replays a macro on the virtual clock and compares every HID edge seen by the host
+// with the edge the macro asks for, measured from the previous observed edge.
+static void bench_replay(const char *name, const String &macroText, const BenchOptions &options, uint32_t sendLatencyUs)
+{
+    std::vector<MacroStep> sequence = macro_parse(macroText);
+    String prefix = String("replay.") + name + ".";
+
+    joystick_run_macro(sequence, false);
+    bleGamepad.reports.clear();
+    bleGamepad.sendLatencyUs = sendLatencyUs;
+    sim_reset_clock();
+
+    uint64_t endUs = (uint64_t)options.seconds * 1000000;
+    uint64_t ticks = 0;
+    uint64_t allocationsBefore = sim_allocation_count();
+    auto start = std::chrono::steady_clock::now();
+    for (; sim_now_us() < endUs; ticks++)
+    {
+        // Same wait as the end of loop() in main.cpp
+        joystick_run_macro(sequence, true);
+        sim_advance_us(std::min<uint64_t>(options.tickUs, joystick_us_until_next_edge()));
+    }
+    double cpuNs = wall_ns(start);
+    uint64_t allocations = sim_allocation_count() - allocationsBefore;
+    JoystickMetrics metrics = joystick_get_metrics();
+    joystick_run_macro(sequence, false);
+
+    // Walk the report log: a press edge starts step k, the release ends it
+    std::vector<double> holdError, gapError;
+    std::vector<uint64_t> cycleStarts; // Press edge of step 0 in every cycle
+    uint32_t previous = 0;
+    uint64_t pressAt = 0, releaseAt = 0;
+    size_t step = 0;
+    bool started = false;
+    for (const auto &r : bleGamepad.reports)
+    {
+        uint32_t pressed = r.buttons & ~previous;
+        uint32_t released = previous & ~r.buttons;
+        previous = r.buttons;
+        if (pressed)
+        {
+            if (started)
+                gapError.push_back((double)(r.timeUs - releaseAt) - DELAY_BETWEEN_STEPS_MS * 1000.0);
+            pressAt = r.timeUs;
+            started = true;
+            if (step == 0)
+                cycleStarts.push_back(r.timeUs);
+        }
+        if (released && started)
+        {
+            holdError.push_back((double)(r.timeUs - pressAt) - sequence[step].duration * 1000.0);
+            releaseAt = r.timeUs;
+            step = (step + 1) % sequence.size();
+        }
+    }
+
+    // Drift: how far the observed cycle period is from the one the macro describes
+    double idealCycleUs = 0;
+    for (const auto &s : sequence)
+        idealCycleUs += (s.duration + DELAY_BETWEEN_STEPS_MS) * 1000.0;
+    double driftUs = 0;
+    if (cycleStarts.size() >= 2)
+        driftUs = (double)(cycleStarts.back() - cycleStarts.front()) / (cycleStarts.size() - 1) - idealCycleUs;
+
+    report(prefix + "hold_error_mean_abs", mean_abs(holdError) / 1000.0, "ms");
+    report(prefix + "hold_error_p99", percentile(holdError, 99) / 1000.0, "ms");
+    report(prefix + "gap_error_mean_abs", mean_abs(gapError) / 1000.0, "ms");
+    report(prefix + "gap_error_p99", percentile(gapError, 99) / 1000.0, "ms");
+    report(prefix + "cycle_drift", driftUs / 1000.0, "ms/cycle");
+    report(prefix + "hid_reports_per_s", bleGamepad.reports.size() / (double)options.seconds, "reports/s");
+    report(prefix + "send_lead_estimate", metrics.leadUs / 1000.0, "ms");
+    report(prefix + "edge_residual_mean_abs", metrics.edges ? metrics.residualSumUs / (double)metrics.edges / 1000.0 : 0, "ms");
+    report(prefix + "edge_residual_max", metrics.maxResidualUs / 1000.0, "ms");
+    report(prefix + "edges_out_of_tolerance", metrics.edgesOutOfTolerance, "edges");
+    report(prefix + "allocations_per_tick", allocations / (double)ticks, "allocs");
+    report(prefix + "tick_cost", cpuNs / ticks, "ns");
+}
+
+// Frame-synchronous playback over many macro cycles. With a constant send latency every edge
+// must sit exactly on the 1/hz grid of the run (integer-microsecond floor) and step 0 of the
+// last cycle exactly where the grid puts it; with jitter, both within HID_TIMING_TOLERANCE_US.
+// Every press must span at least FRAME_MIN_HELD frames. Returns false when any of that does
+// not hold.
+static bool bench_frame_sync(uint8_t hz, const String &macroText, uint64_t cycles, uint32_t sendLatencyUs = 0,
+                             uint32_t sendJitterUs = 0)
+{
+    std::vector<MacroStep> sequence = macro_parse(macroText);
+    String prefix = String("frame_sync.") + String((unsigned)hz) + "hz.";
+    if (sendLatencyUs || sendJitterUs)
+        prefix += String((unsigned)sendLatencyUs) + "us" + (sendJitterUs ? "+" + String((unsigned)sendJitterUs) + "us" : "") + ".";
+
+    auto frames = [hz](int ms, uint32_t minFrames) {
+        uint32_t n = ((uint64_t)ms * hz + 500) / 1000;
+        return n < minFrames ? minFrames : n;
+    };
+    uint64_t framesPerCycle = 0;
+    for (const auto &s : sequence)
+        framesPerCycle += frames(s.duration, FRAME_MIN_HELD) + frames(DELAY_BETWEEN_STEPS_MS, 1);
+    auto grid_us = [hz](uint64_t frame) { return frame * 1000000ULL / hz; };
+
+    joystick_run_macro(sequence, false);
+    joystick_set_frame_rate(hz);
+    bleGamepad.sendLatencyUs = sendLatencyUs;
+    bleGamepad.sendJitterUs = sendJitterUs;
+    srand(hz);
+    sim_reset_clock();
+
+    // Let the send-lead estimate left over from earlier scenarios settle, then start over
+    // so that the first press, which anchors the grid, is sent with the settled lead
+    bleGamepad.reports.clear();
+    while (bleGamepad.reports.size() < 1000)
+    {
+        joystick_run_macro(sequence, true);
+        sim_advance_us(joystick_us_until_next_edge());
+    }
+    joystick_run_macro(sequence, false);
+    bleGamepad.reports.clear();
+
+    uint64_t anchor = 0, pressFrame = 0, cycle = 0, lastCycleStart = 0, edges = 0;
+    uint64_t maxGridOffset = 0, minHeld = ~0ULL;
+    uint32_t previous = 0;
+    size_t step = 0;
+    bool started = false;
+    auto start = std::chrono::steady_clock::now();
+    while (cycle < cycles)
+    {
+        joystick_run_macro(sequence, true);
+        sim_advance_us(joystick_us_until_next_edge());
+
+        for (const auto &r : bleGamepad.reports)
+        {
+            if (!started)
+                anchor = r.timeUs;
+            started = true;
+            uint64_t t = r.timeUs - anchor;
+            uint64_t frame = (t * hz + 500000) / 1000000; // Nearest frame
+            uint64_t offset = t > grid_us(frame) ? t - grid_us(frame) : grid_us(frame) - t;
+            maxGridOffset = std::max(maxGridOffset, offset);
+            edges++;
+
+            uint32_t pressed = r.buttons & ~previous;
+            previous = r.buttons;
+            if (pressed)
+            {
+                pressFrame = frame;
+                if (step == 0)
+                    lastCycleStart = t;
+            }
+            else
+            {
+                minHeld = std::min(minHeld, frame - pressFrame);
+                step = (step + 1) % sequence.size();
+                if (step == 0)
+                    cycle++;
+            }
+        }
+        bleGamepad.reports.clear();
+    }
+    double ns = wall_ns(start);
+    JoystickMetrics metrics = joystick_get_metrics();
+    joystick_run_macro(sequence, false);
+    joystick_set_frame_rate(0);
+    bleGamepad.sendLatencyUs = 0;
+    bleGamepad.sendJitterUs = 0;
+
+    // Step 0 of the last completed cycle, against the ideal grid position
+    int64_t driftUs = (int64_t)lastCycleStart - (int64_t)grid_us((cycles - 1) * framesPerCycle);
+    report(prefix + "cycles", cycles, "cycles");
+    report(prefix + "virtual_time", (double)sim_now_us() / 3600e6, "h");
+    report(prefix + "drift_after_cycles", driftUs, "us");
+    report(prefix + "max_edge_offset_from_grid", maxGridOffset, "us");
+    report(prefix + "min_frames_held", minHeld, "frames");
+    report(prefix + "reanchors", metrics.reanchors, "edges");
+    report(prefix + "cost_per_edge", ns / edges, "ns");
+
+    uint64_t allowedUs = sendJitterUs ? HID_TIMING_TOLERANCE_US : 0;
+    bool ok = (uint64_t)std::llabs(driftUs) <= allowedUs && maxGridOffset <= allowedUs && minHeld >= FRAME_MIN_HELD;
+    if (!ok)
+        printf("FAIL: frame-synchronous playback at %u Hz drifted or left the grid\n", (unsigned)hz);
+    return ok;
+}
+
+// Playback through loop stalls: every STALL_EVERY_US the loop is held up for STALL_US, as
+// by a flash erase or a Wi-Fi scan. The edges that fell due meanwhile go out late, but every
+// hold and gap after that must still last as long as the step asks for (hz = 0) or the
+// frames it was given (hz > 0), within HID_TIMING_TOLERANCE_US.
+static bool bench_stall(uint8_t hz, const String &macroText, const BenchOptions &options)
+{
+    constexpr uint64_t STALL_EVERY_US = 1700000;
+    constexpr uint64_t STALL_US = 250000;
+    std::vector<MacroStep> sequence = macro_parse(macroText);
+    String prefix = String("stall.") + (hz ? String((unsigned)hz) + "hz." : String("ms."));
+
+    // Shortest hold and gap the player may produce, per step
+    auto shortest_us = [hz](int ms, uint32_t minFrames) -> double {
+        if (hz == 0)
+            return ms * 1000.0;
+        uint32_t n = ((uint64_t)ms * hz + 500) / 1000;
+        return (n < minFrames ? minFrames : n) * 1e6 / hz;
+    };
+
+    joystick_run_macro(sequence, false);
+    joystick_set_frame_rate(hz);
+    bleGamepad.reports.clear();
+    sim_reset_clock();
+    uint64_t endUs = (uint64_t)options.seconds * 1000000;
+    uint64_t nextStallUs = STALL_EVERY_US;
+    uint32_t stalls = 0;
+    while (sim_now_us() < endUs)
+    {
+        joystick_run_macro(sequence, true);
+        sim_advance_us(std::min<uint64_t>(options.tickUs, joystick_us_until_next_edge()));
+        if (sim_now_us() >= nextStallUs)
+        {
+            sim_advance_us(STALL_US);
+            nextStallUs += STALL_EVERY_US;
+            stalls++;
+        }
+    }
+    JoystickMetrics metrics = joystick_get_metrics();
+    size_t played = bleGamepad.reports.size(); // The stop below cuts the last hold short
+    joystick_run_macro(sequence, false);
+    joystick_set_frame_rate(0);
+    bleGamepad.reports.resize(played);
+
+    // Shortfall of every hold and gap against what the step asks for
+    std::vector<double> holdShort, gapShort;
+    uint32_t previous = 0;
+    uint64_t pressAt = 0, releaseAt = 0;
+    size_t step = 0;
+    bool started = false;
+    for (const auto &r : bleGamepad.reports)
+    {
+        uint32_t pressed = r.buttons & ~previous;
+        uint32_t released = previous & ~r.buttons;
+        previous = r.buttons;
+        if (pressed)
+        {
+            if (started)
+                gapShort.push_back(shortest_us(DELAY_BETWEEN_STEPS_MS, 1) - (double)(r.timeUs - releaseAt));
+            pressAt = r.timeUs;
+            started = true;
+        }
+        if (released && started)
+        {
+            holdShort.push_back(shortest_us(sequence[step].duration, FRAME_MIN_HELD) - (double)(r.timeUs - pressAt));
+            releaseAt = r.timeUs;
+            step = (step + 1) % sequence.size();
+        }
+    }
+    auto collapsed = [](const std::vector<double> &shortfalls) {
+        return std::count_if(shortfalls.begin(), shortfalls.end(), [](double s) { return s > HID_TIMING_TOLERANCE_US; });
+    };
+    double worstHold = holdShort.empty() ? 0 : *std::max_element(holdShort.begin(), holdShort.end());
+    double worstGap = gapShort.empty() ? 0 : *std::max_element(gapShort.begin(), gapShort.end());
+    size_t collapsedHolds = collapsed(holdShort), collapsedGaps = collapsed(gapShort);
+
+    report(prefix + "stalls", stalls, "stalls");
+    report(prefix + "reanchors", metrics.reanchors, "edges");
+    report(prefix + "worst_hold_shortfall", worstHold / 1000.0, "ms");
+    report(prefix + "worst_gap_shortfall", worstGap / 1000.0, "ms");
+    report(prefix + "collapsed_holds", collapsedHolds, "holds");
+    report(prefix + "collapsed_gaps", collapsedGaps, "gaps");
+    bool ok = collapsedHolds == 0 && collapsedGaps == 0 && stalls > 0;
+    if (!ok)
+        printf("FAIL: after loop stalls, %u holds and %u gaps came out shorter than their step\n", (unsigned)collapsedHolds,
+               (unsigned)collapsedGaps);
+    return ok;
+}
+
+static std::vector<TriggerEvent> feed_output_report(uint8_t rumble, uint8_t leds)
+{
+    uint8_t report[2] = {rumble, leds};
+    bleGamepad.simulateOutputReport(report, sizeof(report));
+    trigger_poll();
+    std::vector<TriggerEvent> events;
+    TriggerEvent event;
+    while (trigger_take(event))
+        events.push_back(event);
+    return events;
+}
+
+// Output-report triggers against the fake gamepad. Checks that a scripted series of host
+// reports yields exactly the expected actions and that a full queue drops instead of
+// overwriting, then measures host report -> first HID edge with reports arriving at random
+// points of the loop period. As on the device, the watcher polls every
+// OUTPUT_TRIGGER_POLL_MS and wakes the loop, which reacts in the same pass.
+static bool bench_triggers(const BenchOptions &options)
+{
+    bool ok = true;
+
+    // Rumble on, still on, player 2, rumble off, repeat, rumble on together with player 1
+    struct Step
+    {
+        uint8_t rumble, leds;
+        std::vector<TriggerAction> expected;
+    };
+    const std::vector<Step> script = {
+        {0x80, 0x00, {TriggerAction::START}},
+        {0xFF, 0x00, {}},
+        {0xFF, 0x02, {TriggerAction::BRANCH}},
+        {0x00, 0x02, {TriggerAction::STOP}},
+        {0x00, 0x02, {}},
+        {0x10, 0x01, {TriggerAction::START, TriggerAction::BRANCH}},
+        {0x00, 0x00, {TriggerAction::STOP}},
+    };
+    for (const auto &step : script)
+    {
+        std::vector<TriggerEvent> events = feed_output_report(step.rumble, step.leds);
+        bool match = events.size() == step.expected.size();
+        for (size_t i = 0; match && i < events.size(); i++)
+            match = events[i].action == step.expected[i];
+        if (!match)
+        {
+            printf("FAIL: output report %02x %02x gave %u actions, expected %u\n", step.rumble, step.leds,
+                   (unsigned)events.size(), (unsigned)step.expected.size());
+            ok = false;
+        }
+    }
+
+    // Nobody drains the queue: only OUTPUT_TRIGGER_QUEUE_SIZE actions may be kept
+    uint32_t droppedBefore = trigger_get_metrics().dropped;
+    const int floods = OUTPUT_TRIGGER_QUEUE_SIZE + 4;
+    for (int i = 0; i < floods; i++)
+    {
+        uint8_t report[2] = {(uint8_t)(i % 2 ? 0x00 : 0x80), 0};
+        bleGamepad.simulateOutputReport(report, sizeof(report));
+        trigger_poll();
+    }
+    size_t kept = feed_output_report(0x00, 0x00).size();
+    uint32_t dropped = trigger_get_metrics().dropped - droppedBefore;
+    report("trigger.queue_kept", kept, "actions");
+    report("trigger.queue_dropped", dropped, "actions");
+    if (kept != OUTPUT_TRIGGER_QUEUE_SIZE || dropped != floods - OUTPUT_TRIGGER_QUEUE_SIZE)
+    {
+        printf("FAIL: trigger queue kept %u and dropped %u of %d actions\n", (unsigned)kept, (unsigned)dropped, floods);
+        ok = false;
+    }
+
+    std::vector<MacroStep> sequence = macro_parse("1,100;2,100;");
+    joystick_run_macro(sequence, false);
+    bleGamepad.sendLatencyUs = options.sendLatencyUs;
+    sim_reset_clock();
+    TriggerMetrics before = trigger_get_metrics();
+    std::vector<double> latency;
+    srand(1);
+    for (int i = 0; i < 20000; i++)
+    {
+        sim_advance_us(rand() % (LOOP_PERIOD_MS * 1000));
+        uint64_t arrival = sim_now_us();
+        uint8_t report[2] = {(uint8_t)(i % 2 ? 0x00 : 0x80), 0}; // Alternating start / stop
+        bleGamepad.simulateOutputReport(report, sizeof(report));
+
+        uint64_t pollUs = OUTPUT_TRIGGER_POLL_MS * 1000;
+        sim_advance_us(pollUs - arrival % pollUs);
+        trigger_poll();
+        size_t first = bleGamepad.reports.size();
+        TriggerEvent event;
+        while (trigger_take(event))
+        {
+            joystick_run_macro(sequence, event.action == TriggerAction::START);
+            trigger_record_reaction(event.receivedUs);
+        }
+        if (bleGamepad.reports.size() > first)
+            latency.push_back(bleGamepad.reports[first].timeUs - arrival);
+    }
+    joystick_run_macro(sequence, false);
+    TriggerMetrics after = trigger_get_metrics();
+    uint32_t reactions = after.reactions - before.reactions;
+
+    report("trigger.reactions", latency.size(), "reactions");
+    report("trigger.report_to_edge_p50", percentile(latency, 50) / 1000.0, "ms");
+    report("trigger.report_to_edge_p99", percentile(latency, 99) / 1000.0, "ms");
+    report("trigger.report_to_edge_max", percentile(latency, 100) / 1000.0, "ms");
+    report("trigger.device_measured_mean", reactions ? (after.latencySumUs - before.latencySumUs) / (double)reactions / 1000.0 : 0, "ms");
+    if (latency.size() != 20000)
+    {
+        printf("FAIL: %u of 20000 output reports got no reaction\n", (unsigned)(20000 - latency.size()));
+        ok = false;
+    }
+    return ok;
+}
+
+// RTC checkpoint: per-pass update cost while a macro plays, then the cost of restoring it
+// after a simulated watchdog reset mid-step. What the restore brings back is checked by
+// test/test_checkpoint.
+static void bench_checkpoint(const BenchOptions &options)
+{
+    constexpr uint8_t MODE_RUNNING = 1; // MODE_BLUETOOTH_RUNNING in main.cpp
+    std::vector<MacroStep> sequence = macro_parse("1,100;2,150;3,200;4,250;");
+    macro_restore(0, sequence);
+
+    // Same calls per pass as loop(): play, checkpoint, wait
+    joystick_run_macro(sequence, false);
+    bleGamepad.sendLatencyUs = 0;
+    sim_reset_clock();
+    uint32_t savesBefore = checkpoint_get_metrics().saves;
+    uint64_t passes = 0;
+    double playNs = 0, checkpointNs = 0;
+    while (sim_now_us() < 59600000) // 66 cycles of 900 ms, then 200 ms into the next: step 1 is held
+    {
+        auto start = std::chrono::steady_clock::now();
+        joystick_run_macro(macro_get_sequence(), true);
+        playNs += wall_ns(start);
+        start = std::chrono::steady_clock::now();
+        checkpoint_update(MODE_RUNNING);
+        checkpointNs += wall_ns(start);
+        sim_advance_us(std::min<uint64_t>(options.tickUs, joystick_us_until_next_edge()));
+        passes++;
+    }
+    uint32_t saves = checkpoint_get_metrics().saves - savesBefore;
+    int interruptedStep = joystick_step_index();
+    report("checkpoint.update_cost", checkpointNs / passes, "ns/pass");
+    report("checkpoint.player_cost", playNs / passes, "ns/pass");
+    report("checkpoint.writes_per_pass", saves / (double)passes, "writes");
+
+    // Watchdog reset: RAM is gone, RTC memory is not
+    joystick_run_macro(sequence, false);
+    macro_restore(0, {});
+    sim_set_reset_reason(ESP_RST_TASK_WDT);
+    auto start = std::chrono::steady_clock::now();
+    checkpoint_restore(MODE_RUNNING);
+    report("checkpoint.restore_cost", wall_ns(start), "ns");
+    report("checkpoint.interrupted_step", interruptedStep, "step");
+    report("checkpoint.resumed_step", checkpoint_get_metrics().resumedStep, "step");
+
+    sim_set_reset_reason(ESP_RST_POWERON);
+    macro_load();
+}
+
+static void bench_parse()
+{
+    String text;
+    for (size_t i = 0; i < MACRO_MAX_STEPS; i++)
+        text += String((int)(i % 8) + 1) + "," + String((int)(20 + (i * 37) % 1980)) + ";";
+
+    const int rounds = 2000;
+    uint64_t allocationsBefore = sim_allocation_count();
+    auto start = std::chrono::steady_clock::now();
+    size_t steps = 0;
+    for (int i = 0; i < rounds; i++)
+        steps += macro_parse(text).size();
+    double ns = wall_ns(start);
+    report("parse.steps_per_s", steps / (ns / 1e9), "steps/s");
+    report("parse.bytes_per_s", (double)text.length() * rounds / (ns / 1e9) / (1024 * 1024), "MiB/s");
+    report("parse.allocations_per_step", (sim_allocation_count() - allocationsBefore) / (double)steps, "allocs");
+
+    std::vector<MacroStep> sequence = macro_parse(text);
+    start = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (int i = 0; i < rounds; i++)
+        bytes += macro_to_string(sequence).length();
+    ns = wall_ns(start);
+    report("serialize.bytes_per_s", bytes / (ns / 1e9) / (1024 * 1024), "MiB/s");
+}
+
+// Cost model of a few macros, including one with every kind of redundant step
+static void bench_optimizer(const char *name, const String &macroText)
+{
+    String prefix = String("optimize.") + name + ".";
+    std::vector<MacroStep> sequence = macro_parse(macroText);
+    MacroAnalysis analysis;
+
+    const int rounds = 20000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        macro_optimize(sequence, analysis, 0);
+    double ns = wall_ns(start);
+
+    report(prefix + "steps_in", analysis.stepsIn, "steps");
+    report(prefix + "steps_out", analysis.stepsOut, "steps");
+    report(prefix + "merged_steps", analysis.mergedSteps, "steps");
+    report(prefix + "no_op_steps", analysis.noOpSteps, "steps");
+    report(prefix + "below_resolution", analysis.belowResolution.size(), "steps");
+    report(prefix + "cycle_time", analysis.cycleMs, "ms");
+    report(prefix + "hid_reports_per_s", analysis.reportsPerSecond, "reports/s");
+    report(prefix + "storage_bytes_in", analysis.storageBytesIn, "bytes");
+    report(prefix + "storage_bytes_out", analysis.storageBytesOut, "bytes");
+    report(prefix + "rejected", analysis.rejection ? 1 : 0, "bool");
+    report(prefix + "cost", ns / rounds, "ns");
+}
+
+static void bench_input_scan()
+{
+    const int rounds = 1000000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+    {
+        sim_set_pin(BTN_ACTION_PIN, (i / 8) % 2);
+        sim_advance_us(INPUT_SCAN_PERIOD_MS * 1000);
+        input_scan();
+        input_is_action_btn_pressed();
+    }
+    report("input.scan_cost", wall_ns(start) / rounds, "ns");
+    report("input.pins_configured", sizeof(INPUT_PINS) / sizeof(INPUT_PINS[0]), "pins");
+
+    // Same scan with 2 to 32 direct buttons. Every 8 scans half of them are pressed and the
+    // other half released, so the interrupts take presses and the scan settles releases; the
+    // pins change between timed runs. The fakes take any ESP32 GPIO as a button, including
+    // the flash, UART and input-only pins a board could not spare.
+    constexpr int SWEEP_PINS[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                  16, 17, 18, 19, 21, 22, 23, 25, 26, 27, 32, 33, 34, 35, 36, 37};
+    const int blocks = 20000;
+    double costTwo = 0;
+    for (size_t buttons : {2, 4, 8, 16, 32})
+    {
+        input_init(SWEEP_PINS, buttons);
+        double ns = 0;
+        for (int b = 0; b < blocks; b++)
+        {
+            for (size_t k = 0; k < buttons; k++)
+                sim_set_pin(SWEEP_PINS[k], (b + k) % 2);
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < 8; i++)
+            {
+                sim_advance_us(INPUT_SCAN_PERIOD_MS * 1000);
+                input_scan();
+            }
+            ns += wall_ns(start);
+        }
+        for (size_t k = 0; k < buttons; k++)
+            sim_set_pin(SWEEP_PINS[k], true);
+        double cost = ns / (blocks * 8);
+        if (buttons == 2)
+            costTwo = cost;
+        report("input.scan_cost_" + String((unsigned)buttons) + "_buttons", cost, "ns");
+        if (buttons == 32)
+            report("input.scan_cost_32_vs_2_buttons", cost / costTwo, "x");
+    }
+
+    // The matrix lane from 2x2 to 4x8 keys, half of them pressed every 8 scans as above.
+    // Each row costs a W1TC write, the settle time and a read of both input registers; the
+    // last four columns are on GPIO32-39, read from the high register.
+    constexpr int SWEEP_ROWS[] = {16, 17, 18, 19};
+    constexpr int SWEEP_COLS[] = {21, 22, 23, 25, 26, 27, 32, 33};
+    for (auto size : {std::make_pair(2, 2), std::make_pair(2, 4), std::make_pair(4, 4), std::make_pair(4, 8)})
+    {
+        int rows = size.first, cols = size.second;
+        input_init(SWEEP_PINS, 0, SWEEP_ROWS, rows, SWEEP_COLS, cols);
+        double ns = 0;
+        uint32_t presses = 0;
+        for (int b = 0; b < blocks; b++)
+        {
+            for (int key = 0; key < rows * cols; key++)
+                sim_set_matrix_key(SWEEP_ROWS[key / cols], SWEEP_COLS[key % cols], (b + key) % 2);
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < 8; i++)
+            {
+                sim_advance_us(INPUT_SCAN_PERIOD_MS * 1000);
+                input_scan();
+            }
+            ns += wall_ns(start);
+            for (int key = 0; key < rows * cols; key++)
+                presses += input_matrix_was_pressed(key);
+        }
+        for (int key = 0; key < rows * cols; key++)
+            sim_set_matrix_key(SWEEP_ROWS[key / cols], SWEEP_COLS[key % cols], false);
+        String keys = String(rows * cols);
+        report("input.scan_cost_matrix_" + keys + "_keys", ns / (blocks * 8), "ns");
+        report("input.matrix_presses_" + keys + "_keys", presses, "presses");
+    }
+    input_init();
+}
+
+// Action button presses with contact bounce, each landing at a random point of the loop's
+// 10 ms cycle. The interrupt wakes the loop, which runs the same calls as loop() and must send
+// the first report within 2 ms at p99. Every tenth press bounces back high before the
+// interrupt samples the line, so only the scan can catch it. The scan debouncer's view of the
+// other presses is shown for comparison; which presses count is checked by test/test_debounce.
+static bool bench_button(const BenchOptions &options)
+{
+    // Timing the virtual clock does not produce by itself
+    constexpr uint32_t ISR_WAKE_US = 20;    // Interrupt entry and switch to the woken loop task
+    constexpr uint32_t PASS_MIN_US = 100;   // Busy part of an idle loop() pass, shortest...
+    constexpr uint32_t PASS_MAX_US = 400;   // ...and longest; a press landing in it waits for the end
+    constexpr uint32_t PASS_LEAD_US = 50;   // From the top of a pass to the macro player
+    constexpr int MISSED_EDGE_EVERY = 10;
+
+    bool ok = true;
+    std::vector<MacroStep> sequence = macro_parse("1,100;2,100;");
+    joystick_run_macro(sequence, false);
+    bleGamepad.sendLatencyUs = options.sendLatencyUs ? options.sendLatencyUs : 200;
+    bleGamepad.sendJitterUs = 600;
+    InputLatencyMetrics before = input_get_latency();
+    bool running = false;
+    // One loop() pass, recording the reaction as loop() does: returns true when it saw a press
+    auto pass = [&]()
+    {
+        input_scan();
+        bool pressed = input_is_action_btn_pressed();
+        bool started = pressed && !running;
+        running |= pressed;
+        joystick_run_macro(sequence, running);
+        uint32_t pressUs = input_press_time_us(BTN_ACTION_PIN);
+        if (started && (int32_t)((uint32_t)joystick_last_report_us() - pressUs) >= 0)
+            input_record_reaction(pressUs, joystick_last_report_us());
+        return pressed;
+    };
+    // Flips the line a few times, 50-800 us apart, and leaves it at `high`
+    auto bounce = [&](bool high)
+    {
+        int flips = 2 * (1 + rand() % 3);
+        int seen = 0;
+        for (int i = 0; i < flips; i++)
+        {
+            sim_advance_us(50 + rand() % 750);
+            sim_set_pin(BTN_ACTION_PIN, i % 2 ? high : !high);
+            seen += pass();
+        }
+        return seen;
+    };
+    // One press held for 200 ms and released; returns the presses seen
+    auto press = [&](bool missEdge, uint64_t &firstReportUs, uint64_t &heldUs)
+    {
+        uint32_t phase = rand() % (LOOP_PERIOD_MS * 1000);
+        uint32_t busy = PASS_MIN_US + rand() % (PASS_MAX_US - PASS_MIN_US);
+        size_t first = bleGamepad.reports.size();
+        int seen = 0;
+        if (missEdge)
+        {
+            sim_defer_interrupts(true);
+            sim_set_pin(BTN_ACTION_PIN, false);
+            sim_advance_us(2);
+            sim_set_pin(BTN_ACTION_PIN, true);
+            sim_advance_us(ISR_WAKE_US);
+            sim_defer_interrupts(false); // Both interrupts read the line high
+        }
+        else
+        {
+            sim_set_pin(BTN_ACTION_PIN, false);
+            sim_advance_us((phase < busy ? busy - phase : ISR_WAKE_US) + PASS_LEAD_US);
+            seen += pass(); // Woken by the interrupt
+        }
+        seen += bounce(false);
+        heldUs = 0;
+        for (int t = 0; t < 20; t++)
+        {
+            sim_advance_us(LOOP_PERIOD_MS * 1000);
+            seen += pass();
+            if (!heldUs && input_is_held(BTN_ACTION_PIN))
+                heldUs = sim_now_us();
+        }
+        firstReportUs = bleGamepad.reports.size() > first ? bleGamepad.reports[first].timeUs : 0;
+        sim_set_pin(BTN_ACTION_PIN, true);
+        seen += pass();
+        seen += bounce(true);
+        for (int t = 0; t < 10; t++)
+        {
+            sim_advance_us(LOOP_PERIOD_MS * 1000);
+            seen += pass();
+        }
+        running = false; // Stopped from the serial link, so the next press starts again
+        joystick_run_macro(sequence, false);
+        return seen;
+    };
+
+    const int presses = 2000;
+    int detected = 0, spurious = 0, missedEdges = 0, missedDetected = 0;
+    std::vector<double> latency, missedLatency, scanLatency;
+    srand(7);
+    for (int i = 0; i < presses; i++)
+    {
+        sim_advance_us(100000 + rand() % (LOOP_PERIOD_MS * 1000)); // Idle, loop() waiting
+        uint64_t arrival = sim_now_us();
+        bool missEdge = i % MISSED_EDGE_EVERY == MISSED_EDGE_EVERY - 1;
+        uint64_t firstReportUs, heldUs;
+        int seen = press(missEdge, firstReportUs, heldUs);
+        detected += seen > 0;
+        spurious += seen > 1 ? seen - 1 : 0;
+        missedEdges += missEdge;
+        missedDetected += missEdge && seen > 0;
+        if (firstReportUs)
+            (missEdge ? missedLatency : latency).push_back(firstReportUs - arrival);
+        if (heldUs && !missEdge)
+            scanLatency.push_back(heldUs - arrival);
+    }
+    InputLatencyMetrics after = input_get_latency();
+    uint32_t recorded = after.presses - before.presses;
+    bleGamepad.sendLatencyUs = 0;
+    bleGamepad.sendJitterUs = 0;
+
+    report("input.button_presses", presses, "presses");
+    report("input.presses_detected", detected, "presses");
+    report("input.bounces_taken_as_presses", spurious, "presses");
+    report("input.press_to_report_p50", percentile(latency, 50) / 1000.0, "ms");
+    report("input.press_to_report_p99", percentile(latency, 99) / 1000.0, "ms");
+    report("input.press_to_report_max", percentile(latency, 100) / 1000.0, "ms");
+    for (size_t b = 0; b + 1 < INPUT_LATENCY_BUCKET_COUNT; b++)
+        report("input.histogram_le_" + String(INPUT_LATENCY_BUCKETS_US[b]) + "us", after.buckets[b] - before.buckets[b], "presses");
+    report("input.histogram_over", after.buckets[INPUT_LATENCY_BUCKET_COUNT - 1] - before.buckets[INPUT_LATENCY_BUCKET_COUNT - 1], "presses");
+    report("input.missed_edges", missedEdges, "presses");
+    report("input.missed_edges_caught_by_scan", missedDetected, "presses");
+    report("input.missed_edge_press_to_report_max", percentile(missedLatency, 100) / 1000.0, "ms");
+    report("input.scan_debounce_p50", percentile(scanLatency, 50) / 1000.0, "ms");
+    report("input.reactions_recorded", recorded, "presses");
+    if (percentile(latency, 99) >= 2000)
+    {
+        printf("FAIL: button-to-report p99 %.2f ms is over 2 ms\n", percentile(latency, 99) / 1000.0);
+        ok = false;
+    }
+    return ok;
+}
+
+static void bench_storage()
+{
+    storage_flush(); // Settings queued by earlier scenarios
+    sim_nvs_clear();
+    std::vector<MacroStep> sequence = macro_parse("1,200;2,200;");
+    const int saves = 100;
+    for (int i = 0; i < saves; i++)
+    {
+        sequence[0].duration = 100 + i;
+        macro_store(0, sequence);
+    }
+    uint32_t before = sim_nvs_write_count();
+    storage_flush();
+    report("storage.saves_queued", saves, "saves");
+    report("storage.flash_writes_after_flush", sim_nvs_write_count() - before, "writes");
+}
+
+// Flash taken by a string in NVS: one 32-byte header entry, then 32-byte data entries
+static size_t nvs_string_bytes(size_t length) { return 32 * (1 + (length + 1 + 31) / 32); }
+
+static size_t nvs_namespace_bytes(const char *ns, bool entries)
+{
+    size_t bytes = 0;
+    for (const auto &item : sim_nvs_namespace(ns))
+        bytes += entries ? nvs_string_bytes(item.second.size()) : item.second.size();
+    return bytes;
+}
+
+// Steps a player would record: presses of 60-250 ms with a pause every few steps. The
+// step at changedStep, if any, is held longer.
+static String recorded_steps(uint32_t seed, int count, int changedStep = -1)
+{
+    String text;
+    for (int i = 0; i < count; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        int button = i % 4 == 3 ? MACRO_PAUSE_BUTTON : (int)(seed >> 28) + 1;
+        int duration = 60 + (int)((seed >> 8) % 191) + (i == changedStep ? 500 : 0);
+        text += String(button) + "," + String(duration) + ";";
+    }
+    return text;
+}
+
+// Two libraries of MACRO_SLOT_COUNT macros as players build them. Crafting macros open the
+// same menu and walk to the same screen before their recipe, and close it the same way;
+// some are a recipe with one step changed or repeated. Combat and farming macros extend one
+// another.
+static std::vector<String> macro_corpus()
+{
+    String openInventory = "9,80;0,150;" + recorded_steps(11, 14);
+    String craftScreen = openInventory + recorded_steps(12, 16);
+    String closeMenu = recorded_steps(13, 10) + "10,80;0,300;";
+    String recipe = recorded_steps(1, 40);
+
+    std::vector<String> corpus;
+    corpus.push_back(craftScreen + recipe + closeMenu);
+    corpus.push_back(craftScreen + recipe + recipe + recipe + closeMenu);     // Craft three
+    corpus.push_back(craftScreen + recorded_steps(1, 40, 20) + closeMenu);   // A recipe variant
+    corpus.push_back(openInventory + recorded_steps(2, 30) + closeMenu);     // Equip a set
+    String combo = recorded_steps(4, 60);
+    String route = recorded_steps(6, 80);
+    corpus.push_back(combo);
+    corpus.push_back(combo + recorded_steps(5, 24));                          // Combo with finisher
+    corpus.push_back(openInventory + recorded_steps(3, 12) + closeMenu + route);
+    corpus.push_back(route + recorded_steps(7, 30));                          // Route and way back
+    return corpus;
+}
+
+static bool same_macro(const std::vector<MacroStep> &a, const std::vector<MacroStep> &b)
+{
+    return macro_to_string(a) == macro_to_string(b);
+}
+
+// Loads every slot in turn; returns the host time per load and counts the NVS reads
+static double time_slot_loads(int rounds, bool coldCache, double &readsPerLoad)
+{
+    uint32_t readsBefore = sim_nvs_read_count();
+    double ns = 0;
+    for (int i = 0; i < rounds; i++)
+    {
+        if (coldCache)
+            blocks_drop_cache();
+        auto start = std::chrono::steady_clock::now();
+        macro_select_slot(i % MACRO_SLOT_COUNT, false);
+        ns += wall_ns(start);
+    }
+    readsPerLoad = (sim_nvs_read_count() - readsBefore) / (double)rounds;
+    return ns / rounds;
+}
+
+// Content-addressed macro storage: flash taken by a macro library with and without block
+// sharing, cost of loading a slot, and garbage collection when macros are replaced
+static std::vector<String> stored_slot_values()
+{
+    std::vector<String> values;
+    for (int slot = 0; slot < MACRO_SLOT_COUNT; slot++)
+        values.push_back(storage_get_string(PREFERENCES_NAMESPACE_GENERAL, (String(MACRO_KEY) + (slot ? String(slot) : String())).c_str(), ""));
+    return values;
+}
+
+// Blocks in flash that no slot refers to
+static size_t orphan_blocks()
+{
+    std::vector<String> refs = stored_slot_values();
+    size_t orphans = 0;
+    for (const auto &block : sim_nvs_namespace(PREFERENCES_NAMESPACE_BLOCKS))
+    {
+        bool referenced = false;
+        for (const auto &list : refs)
+            referenced |= list.indexOf(block.first.c_str() + 1) >= 0;
+        orphans += !referenced;
+    }
+    return orphans;
+}
+
+static bool bench_blocks()
+{
+    bool ok = true;
+    storage_flush();
+    sim_nvs_clear();
+    blocks_drop_cache();
+    MacroBlockMetrics before = blocks_get_metrics();
+
+    std::vector<String> corpus = macro_corpus();
+    std::vector<std::vector<MacroStep>> optimized;
+    for (const auto &text : corpus)
+    {
+        MacroAnalysis analysis;
+        optimized.push_back(macro_optimize(macro_parse(text), analysis, 0));
+        if (analysis.rejection)
+        {
+            printf("FAIL: blocks corpus macro rejected (%s)\n", analysis.rejection);
+            ok = false;
+        }
+    }
+
+    // Baseline: every macro stored in full as its text, as before
+    size_t logicalBytes = 0, logicalEntryBytes = 0, logicalSteps = 0;
+    for (const auto &sequence : optimized)
+    {
+        size_t length = macro_to_string(sequence).length();
+        logicalBytes += length;
+        logicalEntryBytes += nvs_string_bytes(length);
+        logicalSteps += sequence.size();
+    }
+
+    // Load cost of legacy text slots (the first MACRO_SLOT_COUNT macros)
+    for (int slot = 0; slot < MACRO_SLOT_COUNT; slot++)
+        storage_put_string(PREFERENCES_NAMESPACE_GENERAL, (String(MACRO_KEY) + (slot ? String(slot) : String())).c_str(), macro_to_string(optimized[slot]));
+    storage_flush();
+    const int rounds = 2000;
+    double legacyReads, coldReads, warmReads;
+    double legacyNs = time_slot_loads(rounds, false, legacyReads);
+
+    // The whole library goes through the slots, MACRO_SLOT_COUNT at a time. What stays in
+    // flash are the block lists of the slots and every block still referenced.
+    size_t storedBytes = 0, storedEntryBytes = 0, blockCount = 0, slotListBytes = 0;
+    std::vector<size_t> liveBlocksPerRound;
+    for (size_t first = 0; first < optimized.size(); first += MACRO_SLOT_COUNT)
+    {
+        for (int slot = 0; slot < MACRO_SLOT_COUNT && first + slot < optimized.size(); slot++)
+            macro_store(slot, optimized[first + slot]);
+        storage_flush();
+
+        // Every block in flash must be referenced by a slot, and every slot must load back
+        std::vector<String> refs = stored_slot_values();
+        std::map<std::string, std::string> blocks = sim_nvs_namespace(PREFERENCES_NAMESPACE_BLOCKS);
+        size_t orphans = orphan_blocks();
+        for (int pass = 0; pass < 2; pass++) // Through the cache, then from flash
+        {
+            if (pass == 1)
+                blocks_drop_cache();
+            for (int slot = 0; slot < MACRO_SLOT_COUNT && first + slot < optimized.size(); slot++)
+            {
+                macro_select_slot(slot, false);
+                macro_select_slot((slot + 1) % MACRO_SLOT_COUNT, false);
+                macro_select_slot(slot, false);
+                if (!same_macro(macro_get_sequence(), optimized[first + slot]))
+                {
+                    printf("FAIL: blocks slot %d does not load back macro %u\n", slot, (unsigned)(first + slot));
+                    ok = false;
+                }
+            }
+        }
+        if (orphans > 0)
+        {
+            printf("FAIL: %u unreferenced blocks left in flash\n", (unsigned)orphans);
+            ok = false;
+        }
+        liveBlocksPerRound.push_back(blocks.size());
+
+        for (const auto &list : refs)
+            slotListBytes += list.length();
+        for (const auto &list : refs)
+            storedEntryBytes += nvs_string_bytes(list.length());
+        storedBytes += nvs_namespace_bytes(PREFERENCES_NAMESPACE_BLOCKS, false);
+        storedEntryBytes += nvs_namespace_bytes(PREFERENCES_NAMESPACE_BLOCKS, true);
+        blockCount += blocks.size();
+    }
+    storedBytes += slotListBytes;
+    MacroBlockMetrics metrics = blocks_get_metrics();
+
+    // The last MACRO_SLOT_COUNT macros are in the slots now
+    double coldNs = time_slot_loads(rounds, true, coldReads);
+    double warmNs = time_slot_loads(rounds, false, warmReads);
+
+    // A slot saved by older firmware still loads
+    storage_put_string(PREFERENCES_NAMESPACE_GENERAL, MACRO_KEY, "1,200;2,200;");
+    macro_select_slot(1, false);
+    macro_select_slot(0, false);
+    if (macro_to_string(macro_get_sequence()) != "1,200;2,200;")
+    {
+        printf("FAIL: legacy macro text no longer loads\n");
+        ok = false;
+    }
+
+    report("blocks.corpus_macros", corpus.size(), "macros");
+    report("blocks.corpus_steps", logicalSteps, "steps");
+    report("blocks.blocks_in_flash", blockCount / (double)liveBlocksPerRound.size(), "blocks");
+    uint32_t blockUses = metrics.blocksWritten - before.blocksWritten + metrics.blocksShared - before.blocksShared;
+    report("blocks.mean_block_steps", blockUses ? logicalSteps / (double)blockUses : 0, "steps");
+    report("blocks.shared_block_uses", metrics.blocksShared - before.blocksShared, "blocks");
+    report("blocks.collected", metrics.blocksCollected - before.blocksCollected, "blocks");
+    report("blocks.dedup_ratio_bytes", storedBytes ? logicalBytes / (double)storedBytes : 0, "x");
+    report("blocks.dedup_ratio_nvs_entries", storedEntryBytes ? logicalEntryBytes / (double)storedEntryBytes : 0, "x");
+    report("blocks.load_text", legacyNs, "ns");
+    report("blocks.load_blocks_cold", coldNs, "ns");
+    report("blocks.load_blocks_warm", warmNs, "ns");
+    report("blocks.nvs_reads_per_load_text", legacyReads, "reads");
+    report("blocks.nvs_reads_per_load_cold", coldReads, "reads");
+    report("blocks.nvs_reads_per_load_warm", warmReads, "reads");
+    report("blocks.cache_steps", blocks_get_metrics().cachedSteps, "steps");
+
+    // The legacy text replaced slot 0's block list without releasing its blocks, as a power
+    // cut between the slot write and the erases would. The boot sweep deletes them and
+    // nothing else.
+    storage_flush();
+    size_t orphansBefore = orphan_blocks();
+    macro_load();
+    storage_flush();
+    size_t orphansAfter = orphan_blocks();
+    bool slotsLoad = true;
+    for (int slot = 1; slot < MACRO_SLOT_COUNT; slot++)
+    {
+        size_t macro = (optimized.size() - 1) / MACRO_SLOT_COUNT * MACRO_SLOT_COUNT + slot;
+        macro_select_slot(slot, false);
+        slotsLoad &= macro >= optimized.size() || same_macro(macro_get_sequence(), optimized[macro]);
+    }
+    macro_select_slot(0, false);
+    report("blocks.orphans_before_boot", orphansBefore, "blocks");
+    report("blocks.orphans_after_boot", orphansAfter, "blocks");
+    if (orphansBefore == 0 || orphansAfter != 0 || !slotsLoad)
+    {
+        printf("FAIL: boot sweep left %u of %u orphaned blocks (slots load: %d)\n", (unsigned)orphansAfter, (unsigned)orphansBefore, slotsLoad);
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        String arg = argv[i];
+        if (arg == "--tick-us")
+            options.tickUs = atoi(argv[i + 1]);
+        else if (arg == "--seconds")
+            options.seconds = atoi(argv[i + 1]);
+        else if (arg == "--send-latency-us")
+            options.sendLatencyUs = atoi(argv[i + 1]);
+    }
+
+    storage_init();
+    input_init();
+    joystick_init();
+    trigger_init();
+    macro_load();
+
+    bench_replay("default", "1,200;2,200;", options, options.sendLatencyUs);
+    bench_replay("fast", "1,30;2,30;3,30;4,30;", options, options.sendLatencyUs);
+    bench_replay("mixed", "1,500;2,45;3,120;1,15;4,1000;2,75;", options, options.sendLatencyUs);
+    // BLE notification blocking for a few ms, as seen with long connection intervals
+    bench_replay("slow_link", "1,200;2,45;3,120;", options, 7500);
+    // 16 ms is below one frame at 60 Hz and must still be held FRAME_MIN_HELD frames
+    bool frameSyncOk = true;
+    for (uint8_t hz : {30, 60, 120})
+        frameSyncOk &= bench_frame_sync(hz, "1,30;2,45;3,16;", 1000000);
+    // The grid is anchored with the send lead of the run's first press: a constant latency
+    // must still land exactly on it, a jittery one within tolerance
+    frameSyncOk &= bench_frame_sync(60, "1,30;2,45;3,16;", 100000, 2500);
+    frameSyncOk &= bench_frame_sync(60, "1,30;2,45;3,16;", 100000, 2000, 800);
+    frameSyncOk &= bench_frame_sync(120, "1,30;2,45;3,16;", 100000, 300, 600);
+    bool stallOk = bench_stall(0, "1,200;2,45;3,120;", options);
+    stallOk &= bench_stall(60, "1,30;2,45;3,16;", options);
+    bool triggersOk = bench_triggers(options);
+    bench_checkpoint(options);
+    bench_parse();
+    bench_optimizer("default", "1,200;2,200;");
+    bench_optimizer("mixed", "1,500;2,45;3,120;1,15;4,1000;2,75;");
+    // Invalid button, zero hold, back-to-back pauses and a hold shorter than one report interval
+    bench_optimizer("redundant", "1,200;0,100;0,100;40,50;2,0;3,10;1,200;");
+    bench_optimizer("pauses_only", "0,100;0,200;");
+    // Every press shorter than one report interval: rejected with millisecond timing
+    bench_optimizer("short_holds", "1,5;2,5;");
+    bench_input_scan();
+    bool buttonOk = bench_button(options);
+    bench_storage();
+    bool blocksOk = bench_blocks();
+    return frameSyncOk && stallOk && triggersOk && buttonOk && blocksOk ? 0 : 1;
+}
+
+#endif // PIO_UNIT_TESTING
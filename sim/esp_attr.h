@@ -0,0 +1,6 @@
+#pragma once
+// Section attributes are meaningless on the host: RTC variables are plain globals, which
+// keep their contents across a simulated reset just like RTC memory does on the chip.
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
@@ -0,0 +1,89 @@
+// Host stand-in for one fleet device: the real FleetSync on a loopback multicast socket, so
+// that tools/fleet_push.py can push bundles to many of them on one machine. Build and run with
+//     pio run -e native_fleet
+//     .pio/build/native_fleet/program --node 3 --key <64 hex digits> [--loss 0.05]
+// Each node gets its own MAC address (and so its own device name) and random seed.
+// The virtual clock follows the wall clock here, so NACK timing is real.
+#include <Arduino.h>
+#include <WiFi.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include "config.h"
+#include "FleetSync.h"
+#include "JoystickController.h"
+#include "MacroStore.h"
+#include "Storage.h"
+
+static bool parse_key(const char *hex, uint8_t key[FLEET_KEY_BYTES])
+{
+    if (strlen(hex) != FLEET_KEY_BYTES * 2)
+        return false;
+    for (size_t i = 0; i < FLEET_KEY_BYTES; i++)
+    {
+        char byteText[3] = {hex[2 * i], hex[2 * i + 1], 0};
+        char *end;
+        key[i] = strtoul(byteText, &end, 16);
+        if (*end != 0)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned node = 1;
+    const char *keyHex = nullptr;
+    float loss = 0.0f;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--node") == 0)
+            node = strtoul(argv[i + 1], nullptr, 10);
+        else if (strcmp(argv[i], "--key") == 0)
+            keyHex = argv[i + 1];
+        else if (strcmp(argv[i], "--loss") == 0)
+            loss = strtof(argv[i + 1], nullptr);
+    }
+
+    WiFi.mac[3] = 0x10;
+    WiFi.mac[4] = node >> 8;
+    WiFi.mac[5] = node;
+    sim_seed_random(0x5EED0000 + node);
+    sim_udp_set_loss(loss);
+
+    storage_init();
+    macro_load();
+    joystick_init();
+    uint8_t key[FLEET_KEY_BYTES];
+    if (keyHex)
+    {
+        if (!parse_key(keyHex, key))
+        {
+            fprintf(stderr, "--key takes %u hex digits\n", (unsigned)(FLEET_KEY_BYTES * 2));
+            return 2;
+        }
+        fleet_set_key(key);
+    }
+
+    fleet_loop(); // Joins the group before the sender is told we are ready
+    printf("node %u ready as %s\n", node, fleet_device_name().c_str());
+    fflush(stdout);
+
+    auto start = std::chrono::steady_clock::now();
+    for (;;)
+    {
+        uint64_t wallUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        if (wallUs > sim_now_us())
+            sim_advance_us(wallUs - sim_now_us());
+
+        if (fleet_loop())
+        {
+            FleetMetrics metrics = fleet_get_metrics();
+            printf("node %u applied bundle %u in %u ms: slot %d, %u steps, %u duplicate chunks, %u NACKs\n", node,
+                   (unsigned)metrics.lastBundleId, (unsigned)metrics.lastTransferMs, macro_get_slot(),
+                   (unsigned)macro_get_sequence().size(), (unsigned)metrics.duplicateChunks, (unsigned)metrics.nacksSent);
+            fflush(stdout);
+        }
+        usleep(200); // loop() runs on a timer on the device; this only keeps a core free
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+// Single-threaded stand-ins for the FreeRTOS calls used by the firmware. Tasks are not
+// started; the simulation drives background work (e.g. storage_flush()) explicitly.
+#include <stdint.h>
+
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef int portMUX_TYPE;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portTICK_PERIOD_MS ((TickType_t)1) // 1 kHz tick, as configured by Arduino-ESP32
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void *), const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *handle, BaseType_t)
+{
+    if (handle)
+        *handle = nullptr;
+    return pdPASS;
+}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return nullptr; }
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t *woken)
+{
+    if (woken)
+        *woken = pdFALSE;
+}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+inline void vTaskDelay(TickType_t) {}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t)1; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
@@ -0,0 +1,35 @@
+#pragma once
+// Host stand-in for the mbedtls message-digest API, HMAC-SHA256 only. Definitions in
+// sim/SimCrypto.cpp.
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    MBEDTLS_MD_NONE = 0,
+    MBEDTLS_MD_SHA256 = 6,
+} mbedtls_md_type_t;
+
+typedef struct mbedtls_md_info_t mbedtls_md_info_t;
+
+struct mbedtls_sha256_state
+{
+    uint32_t h[8];
+    uint64_t length; // Bytes hashed so far
+    uint8_t block[64];
+    size_t used;
+};
+
+typedef struct
+{
+    mbedtls_sha256_state inner;
+    mbedtls_sha256_state outer;
+} mbedtls_md_context_t;
+
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type);
+void mbedtls_md_init(mbedtls_md_context_t *ctx);
+int mbedtls_md_setup(mbedtls_md_context_t *ctx, const mbedtls_md_info_t *info, int hmac);
+int mbedtls_md_hmac_starts(mbedtls_md_context_t *ctx, const unsigned char *key, size_t keylen);
+int mbedtls_md_hmac_update(mbedtls_md_context_t *ctx, const unsigned char *input, size_t ilen);
+int mbedtls_md_hmac_finish(mbedtls_md_context_t *ctx, unsigned char *output);
+void mbedtls_md_free(mbedtls_md_context_t *ctx);
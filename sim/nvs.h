@@ -0,0 +1,32 @@
+#pragma once
+// Key enumeration of the fake NVS, with the ESP-IDF 4.4 iterator API that Arduino-ESP32 2.x
+// ships. Only the entries of the simulated default partition exist.
+#include <stdint.h>
+
+#define NVS_DEFAULT_PART_NAME "nvs"
+#define NVS_KEY_NAME_MAX_SIZE 16
+
+typedef enum
+{
+    NVS_TYPE_U8 = 0x01,
+    NVS_TYPE_U32 = 0x04,
+    NVS_TYPE_STR = 0x21,
+    NVS_TYPE_BLOB = 0x42,
+    NVS_TYPE_ANY = 0xff
+} nvs_type_t;
+
+typedef struct
+{
+    char namespace_name[16];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+} nvs_entry_info_t;
+
+typedef struct nvs_opaque_iterator_t *nvs_iterator_t;
+
+// NULL when the namespace holds no entries.
+nvs_iterator_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type);
+// NULL, and the iterator released, past the last entry.
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator);
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t *out_info);
+void nvs_release_iterator(nvs_iterator_t iterator);
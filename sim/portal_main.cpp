@@ -0,0 +1,44 @@
+// Host stand-in for the configuration portal: the real WebPortal routes on HttpServer,
+// served on loopback so that tools/portal_bench.py can measure them. Build and run with
+//     pio run -e native_portal -t exec            (AP mode, captive probes answered)
+//     .pio/build/native_portal/program --sta      (STA mode)
+// The virtual clock follows the wall clock here, so the idle timeouts are real ones.
+#include <Arduino.h>
+#include <WiFi.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include "config.h"
+#include "JoystickController.h"
+#include "MacroStore.h"
+#include "Storage.h"
+#include "WebPortal.h"
+
+int main(int argc, char **argv)
+{
+    bool sta = argc > 1 && strcmp(argv[1], "--sta") == 0;
+
+    storage_init();
+    macro_load();
+    joystick_init();
+    if (sta)
+        web_server_start();
+    else
+        web_init();
+    printf("portal listening on 127.0.0.1:%u (%s mode)\n", sim_listen_port(HTTP_PORT), sta ? "STA" : "AP");
+    fflush(stdout);
+
+    auto start = std::chrono::steady_clock::now();
+    for (;;)
+    {
+        uint64_t wallUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        if (wallUs > sim_now_us())
+            sim_advance_us(wallUs - sim_now_us());
+
+        if (sta)
+            web_server_loop();
+        else
+            web_loop();
+        usleep(50); // loop() runs on a timer on the device; this only keeps a core free
+    }
+}
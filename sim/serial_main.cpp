@@ -0,0 +1,68 @@
+// Host stand-in for the serial control link: the real SerialLink on a pseudo-terminal, with
+// the UART paced at SERIAL_BAUD, so that tools/patro_serial.py talks to the firmware code
+// rather than to a copy of it. Build and run with
+//     pio run -e native_serial
+//     tools/patro_serial.py --spawn .pio/build/native_serial/program selftest
+// The virtual clock follows the wall clock here; serial_loop() runs once per LOOP_PERIOD_MS,
+// as in loop() while no macro is playing.
+#include <Arduino.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include "config.h"
+#include "JoystickController.h"
+#include "MacroStore.h"
+#include "SerialLink.h"
+#include "Storage.h"
+
+int main()
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("posix_openpt");
+        return 1;
+    }
+    termios attrs;
+    tcgetattr(master, &attrs);
+    cfmakeraw(&attrs);
+    tcsetattr(master, TCSANOW, &attrs);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    sim_serial_attach(master);
+
+    storage_init();
+    macro_load();
+    joystick_init();
+    serial_init();
+    printf("serial link on %s at %lu baud\n", ptsname(master), SERIAL_BAUD);
+    fflush(stdout);
+
+    auto start = std::chrono::steady_clock::now();
+    auto sync_clock = [&]()
+    {
+        uint64_t wallUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        if (wallUs > sim_now_us())
+            sim_advance_us(wallUs - sim_now_us());
+    };
+    bool running = false;
+    for (;;)
+    {
+        sync_clock();
+        SerialCommand command = serial_loop();
+        if (command != SerialCommand::NONE)
+            running = command == SerialCommand::START;
+        joystick_run_macro(macro_get_sequence(), running);
+
+        // The UART keeps receiving and sending while loop() waits
+        uint64_t nextPassUs = sim_now_us() + LOOP_PERIOD_MS * 1000;
+        while (sim_now_us() < nextPassUs)
+        {
+            usleep(50);
+            sync_clock();
+            sim_serial_poll();
+        }
+    }
+}
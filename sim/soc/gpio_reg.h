@@ -0,0 +1,19 @@
+#pragma once
+// Fake GPIO register file. GPIO_IN_REG / GPIO_IN1_REG reflect sim_set_pin() and the
+// sim_set_matrix_key() columns of the rows driven low through the W1TS/W1TC registers.
+#include <stdint.h>
+
+enum SimGpioRegister
+{
+    GPIO_OUT_REG,
+    GPIO_OUT_W1TS_REG,
+    GPIO_OUT_W1TC_REG,
+    GPIO_IN_REG,
+    GPIO_IN1_REG,
+};
+
+uint32_t sim_reg_read(int reg);
+void sim_reg_write(int reg, uint32_t value);
+
+#define REG_READ(reg) sim_reg_read(reg)
+#define REG_WRITE(reg, value) sim_reg_write((reg), (value))
@@ -0,0 +1,138 @@
+#include <esp_attr.h>
+#include <esp_system.h>
+#include "Checkpoint.h"
+#include "JoystickController.h"
+#include "MacroStore.h"
+#include "config.h"
+
+constexpr uint32_t CHECKPOINT_MAGIC = 0x50415443; // "PATC"
+
+// Header and macro have separate checksums: the header changes on every edge, the macro only
+// when it is replaced, and hashing 2 KB on every edge would not be cheap.
+struct RtcCheckpoint
+{
+    uint32_t magic;
+    uint8_t mode;
+    uint8_t slot;
+    uint8_t pressing;     // Player was holding the button of stepIndex
+    uint16_t stepIndex;
+    uint16_t stepCount;   // 0 when the macro does not fit in steps
+    uint8_t resumes;      // Restores since playback last ran CHECKPOINT_STABLE_MS
+    uint32_t macroChecksum;
+    uint32_t headerChecksum;
+    MacroStep steps[MACRO_MAX_STEPS];
+};
+
+RTC_NOINIT_ATTR RtcCheckpoint rtcCheckpoint;
+
+uint32_t savedMacroRevision = 0; // macro_get_revision() of the copy in rtcCheckpoint.steps
+bool checkpointWritten = false;  // rtcCheckpoint describes this boot
+uint8_t resumeCount = 0;         // rtcCheckpoint.resumes for this boot
+bool resumePending = false;      // Restored, but the player has not pressed the resume step yet
+CheckpointMetrics checkpointMetrics = {};
+
+// FNV-1a
+static uint32_t checksum(const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t hash = 2166136261UL;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ p[i]) * 16777619UL;
+    return hash;
+}
+
+static uint32_t header_checksum(const RtcCheckpoint &c) { return checksum(&c, offsetof(RtcCheckpoint, headerChecksum)); }
+
+void checkpoint_update(uint8_t mode)
+{
+    RtcCheckpoint &c = rtcCheckpoint;
+    int slot = macro_get_slot();
+    int stepIndex = joystick_step_index();
+    bool pressing = joystick_is_pressing();
+    bool macroChanged = !checkpointWritten || macro_get_revision() != savedMacroRevision;
+    // Until playback restarts (BLE may take a while to reconnect) the player sits idle at the
+    // resume step. Keep the restored position: saving "not pressing" would make a second
+    // crash resume one step on and skip the step that was held.
+    if (resumePending && (pressing || macroChanged || c.mode != mode))
+        resumePending = false;
+    if (resumePending)
+    {
+        stepIndex = c.stepIndex;
+        pressing = c.pressing;
+    }
+    if (resumeCount > 0 && checkpointMetrics.resumedAtMs != 0 && millis() - checkpointMetrics.resumedAtMs >= CHECKPOINT_STABLE_MS)
+        resumeCount = 0; // The resumed macro has been playing long enough
+
+    if (!macroChanged && c.mode == mode && c.slot == slot && c.stepIndex == stepIndex && c.pressing == pressing && c.resumes == resumeCount)
+        return;
+
+    if (macroChanged)
+    {
+        // Slots saved before MACRO_MAX_STEPS was enforced can hold longer macros. They are
+        // not checkpointed: a stepCount of 0 never restores.
+        const std::vector<MacroStep> &sequence = macro_get_sequence();
+        c.stepCount = sequence.size() <= MACRO_MAX_STEPS ? sequence.size() : 0;
+        memcpy(c.steps, sequence.data(), c.stepCount * sizeof(MacroStep));
+        c.macroChecksum = checksum(c.steps, c.stepCount * sizeof(MacroStep));
+        savedMacroRevision = macro_get_revision();
+    }
+    c.magic = CHECKPOINT_MAGIC;
+    c.mode = mode;
+    c.slot = slot;
+    c.stepIndex = stepIndex;
+    c.pressing = pressing;
+    c.resumes = resumeCount;
+    c.headerChecksum = header_checksum(c);
+    checkpointWritten = true;
+    checkpointMetrics.saves++;
+
+    if (checkpointMetrics.restored && checkpointMetrics.resumedAtMs == 0 && joystick_is_pressing())
+    {
+        checkpointMetrics.resumedAtMs = millis();
+        Serial.printf("Playback resumed at step %d, %lu ms after boot (restore took %u us)\n",
+                      checkpointMetrics.resumedStep, (unsigned long)checkpointMetrics.resumedAtMs, (unsigned)checkpointMetrics.restoreUs);
+    }
+}
+
+bool checkpoint_restore(uint8_t resumableMode)
+{
+    unsigned long start = micros();
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool unexpected = reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+                      reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT;
+
+    RtcCheckpoint &c = rtcCheckpoint;
+    bool valid = c.magic == CHECKPOINT_MAGIC && c.headerChecksum == header_checksum(c) &&
+                 c.stepCount > 0 && c.stepCount <= MACRO_MAX_STEPS && c.stepIndex < c.stepCount &&
+                 c.macroChecksum == checksum(c.steps, c.stepCount * sizeof(MacroStep));
+    if (!unexpected || !valid || c.mode != resumableMode)
+        return false;
+    if (c.resumes >= CHECKPOINT_MAX_RESUMES)
+    {
+        Serial.printf("Playback crashed %u times in a row after resuming: not resuming it again\n", (unsigned)c.resumes);
+        c.magic = 0;
+        return false;
+    }
+    // Counted in RTC memory now, in case this boot crashes before its first update
+    resumeCount = c.resumes + 1;
+    c.resumes = resumeCount;
+    c.headerChecksum = header_checksum(c);
+
+    macro_restore(c.slot, std::vector<MacroStep>(c.steps, c.steps + c.stepCount));
+    savedMacroRevision = macro_get_revision(); // rtcCheckpoint.steps already holds it
+    checkpointWritten = true;
+    resumePending = true;
+    // A held button was released by the host when the link dropped: play that step again.
+    // A gap was already observed, so go on with the next step.
+    int resumeStep = c.pressing ? c.stepIndex : (c.stepIndex + 1) % c.stepCount;
+    joystick_resume_at(resumeStep);
+
+    checkpointMetrics.restored = true;
+    checkpointMetrics.resumedAtMs = 0;
+    checkpointMetrics.resumedStep = resumeStep;
+    checkpointMetrics.resumes = resumeCount;
+    checkpointMetrics.restoreUs = micros() - start;
+    return true;
+}
+
+CheckpointMetrics checkpoint_get_metrics() { return checkpointMetrics; }
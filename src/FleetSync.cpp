@@ -0,0 +1,431 @@
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <ESPmDNS.h>
+#include <esp_system.h>
+#include <mbedtls/md.h>
+#include "FleetSync.h"
+#include "JoystickController.h"
+#include "MacroOptimizer.h"
+#include "MacroStore.h"
+#include "Storage.h"
+
+enum FleetPacket : uint8_t
+{
+    PACKET_MANIFEST = 1,
+    PACKET_CHUNK,
+    PACKET_NACK,
+    PACKET_DONE
+};
+
+constexpr uint8_t FLEET_MAGIC[4] = {'P', 'F', 'B', '1'};
+constexpr size_t FLEET_HEADER_BYTES = 9; // Magic, type, bundle id
+constexpr size_t FLEET_MAC_BYTES = 32;
+constexpr size_t FLEET_MAX_BUNDLE = FLEET_MAX_CHUNKS * FLEET_CHUNK_BYTES;
+constexpr uint8_t FLEET_KEEP = 0xFF; // Bundle header: leave the active slot / frame rate alone
+static_assert(FLEET_MAX_CHUNKS <= 32, "Missing chunks are reported in one 32-bit bitmap");
+static_assert(FLEET_MAX_BUNDLE <= 0xFFFF, "Bundle lengths are sent as u16");
+
+struct FleetTransfer
+{
+    bool active;
+    uint32_t bundleId;
+    uint8_t chunkCount;
+    uint16_t totalLength;
+    uint8_t mac[FLEET_MAC_BYTES];
+    uint32_t received; // Bit n = chunk n is in
+    std::vector<uint8_t> bundle;
+    IPAddress sender;
+    uint16_t senderPort;
+    unsigned long startedMs;
+    unsigned long lastDatagramMs;
+    unsigned long nackDueMs;
+    bool nackScheduled;
+};
+
+// --- Global objects ---
+WiFiUDP fleetUdp;
+bool fleetStarted = false;
+FleetTransfer fleetTransfer = {};
+uint8_t fleetPacket[FLEET_HEADER_BYTES + 1 + FLEET_CHUNK_BYTES]; // Largest datagram: a full chunk
+
+uint8_t fleetKey[FLEET_KEY_BYTES];
+bool fleetSettingsLoaded = false;
+bool fleetKeySet = false;
+uint32_t lastAppliedId = 0;                  // Bundles must be newer than this
+uint32_t lastResultId = 0;                   // Last bundle finished, answered again on a repeated MANIFEST
+uint8_t lastResultMac[FLEET_MAC_BYTES];
+FleetStatus lastResultStatus = FLEET_APPLIED;
+FleetMetrics fleetMetrics = {};
+
+static uint16_t read_u16(const uint8_t *p) { return p[0] | p[1] << 8; }
+static uint32_t read_u32(const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; }
+
+static void load_settings()
+{
+    if (fleetSettingsLoaded)
+        return;
+    fleetSettingsLoaded = true;
+
+    String hex = storage_get_string(PREFERENCES_NAMESPACE_GENERAL, FLEET_KEY_KEY, "");
+    fleetKeySet = hex.length() == FLEET_KEY_BYTES * 2;
+    for (size_t i = 0; fleetKeySet && i < FLEET_KEY_BYTES; i++)
+    {
+        char byteText[3] = {hex[2 * i], hex[2 * i + 1], 0};
+        char *end;
+        fleetKey[i] = strtoul(byteText, &end, 16);
+        fleetKeySet = *end == 0;
+    }
+    lastAppliedId = strtoul(storage_get_string(PREFERENCES_NAMESPACE_GENERAL, FLEET_BUNDLE_KEY, "0").c_str(), nullptr, 10);
+}
+
+static void bundle_mac(uint32_t bundleId, uint16_t length, const uint8_t *bundle, uint8_t out[FLEET_MAC_BYTES])
+{
+    uint8_t head[10];
+    memcpy(head, FLEET_MAGIC, 4);
+    for (int i = 0; i < 4; i++)
+        head[4 + i] = bundleId >> (8 * i);
+    head[8] = length;
+    head[9] = length >> 8;
+
+    mbedtls_md_context_t ctx;
+    mbedtls_md_init(&ctx);
+    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    mbedtls_md_hmac_starts(&ctx, fleetKey, FLEET_KEY_BYTES);
+    mbedtls_md_hmac_update(&ctx, head, sizeof(head));
+    mbedtls_md_hmac_update(&ctx, bundle, length);
+    mbedtls_md_hmac_finish(&ctx, out);
+    mbedtls_md_free(&ctx);
+}
+
+// Constant time, so a forged MAC cannot be found byte by byte
+static bool mac_equal(const uint8_t *a, const uint8_t *b)
+{
+    uint8_t diff = 0;
+    for (size_t i = 0; i < FLEET_MAC_BYTES; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+static void send_packet(IPAddress to, uint16_t port, uint8_t type, uint32_t bundleId, const uint8_t *payload, size_t length)
+{
+    uint8_t packet[FLEET_HEADER_BYTES + 40];
+    memcpy(packet, FLEET_MAGIC, 4);
+    packet[4] = type;
+    for (int i = 0; i < 4; i++)
+        packet[5 + i] = bundleId >> (8 * i);
+    length = std::min(length, sizeof(packet) - FLEET_HEADER_BYTES);
+    memcpy(packet + FLEET_HEADER_BYTES, payload, length);
+
+    fleetUdp.beginPacket(to, port);
+    fleetUdp.write(packet, FLEET_HEADER_BYTES + length);
+    fleetUdp.endPacket();
+}
+
+static void send_done(IPAddress to, uint16_t port, uint32_t bundleId, FleetStatus status)
+{
+    String name = fleet_device_name();
+    uint8_t payload[1 + 32];
+    payload[0] = status;
+    size_t nameLength = std::min<size_t>(name.length(), sizeof(payload) - 1);
+    memcpy(payload + 1, name.c_str(), nameLength);
+    send_packet(to, port, PACKET_DONE, bundleId, payload, 1 + nameLength);
+}
+
+static uint32_t missing_chunks()
+{
+    uint32_t all = fleetTransfer.chunkCount == 32 ? 0xFFFFFFFFUL : (1UL << fleetTransfer.chunkCount) - 1;
+    return all & ~fleetTransfer.received;
+}
+
+static void send_nack()
+{
+    uint32_t missing = missing_chunks();
+    uint8_t payload[4] = {(uint8_t)missing, (uint8_t)(missing >> 8), (uint8_t)(missing >> 16), (uint8_t)(missing >> 24)};
+    send_packet(fleetTransfer.sender, fleetTransfer.senderPort, PACKET_NACK, fleetTransfer.bundleId, payload, sizeof(payload));
+    fleetTransfer.nackScheduled = false;
+    fleetTransfer.lastDatagramMs = millis();
+    fleetMetrics.nacksSent++;
+}
+
+static void handle_manifest(const uint8_t *packet, size_t length, uint32_t bundleId)
+{
+    IPAddress from = fleetUdp.remoteIP();
+    uint16_t port = fleetUdp.remotePort();
+    if (length != FLEET_HEADER_BYTES + 3 + FLEET_MAC_BYTES)
+        return;
+    const uint8_t *mac = packet + FLEET_HEADER_BYTES + 3;
+
+    // The sender repeats the MANIFEST until every device has answered
+    if (bundleId == lastResultId && lastResultId != 0 && mac_equal(mac, lastResultMac))
+    {
+        send_done(from, port, bundleId, lastResultStatus);
+        return;
+    }
+    if (!fleetKeySet)
+    {
+        send_done(from, port, bundleId, FLEET_NO_KEY);
+        return;
+    }
+    if (bundleId <= lastAppliedId)
+    {
+        send_done(from, port, bundleId, FLEET_STALE); // Replayed, or the sender's clock went back
+        return;
+    }
+
+    uint8_t chunkCount = packet[FLEET_HEADER_BYTES];
+    uint16_t totalLength = read_u16(packet + FLEET_HEADER_BYTES + 1);
+    bool sizesValid = chunkCount > 0 && chunkCount <= FLEET_MAX_CHUNKS &&
+                      totalLength > (chunkCount - 1) * FLEET_CHUNK_BYTES && totalLength <= chunkCount * FLEET_CHUNK_BYTES;
+    if (!sizesValid)
+        return;
+
+    // MANIFESTs are not authenticated, so none may hold the transfer against another: a
+    // different id or MAC replaces the transfer in progress, and a forged one lasts only
+    // until the real sender's next poll
+    unsigned long now = millis();
+    if (!fleetTransfer.active || fleetTransfer.bundleId != bundleId || !mac_equal(mac, fleetTransfer.mac))
+    {
+        fleetTransfer.active = true;
+        fleetTransfer.bundleId = bundleId;
+        fleetTransfer.chunkCount = chunkCount;
+        fleetTransfer.totalLength = totalLength;
+        memcpy(fleetTransfer.mac, mac, FLEET_MAC_BYTES);
+        fleetTransfer.received = 0;
+        fleetTransfer.bundle.assign(totalLength, 0);
+        fleetTransfer.sender = from;
+        fleetTransfer.senderPort = port;
+        fleetTransfer.startedMs = now;
+        fleetTransfer.lastDatagramMs = now;
+        fleetTransfer.nackScheduled = false;
+        return; // The chunks follow
+    }
+
+    // A repeated MANIFEST is the sender's poll. Answer after a random delay so that a
+    // whole fleet does not NACK in the same instant.
+    if (missing_chunks() && !fleetTransfer.nackScheduled)
+    {
+        fleetTransfer.nackDueMs = now + esp_random() % (FLEET_NACK_JITTER_MS + 1);
+        fleetTransfer.nackScheduled = true;
+    }
+}
+
+// Every chunk is in: authenticate, apply and report
+static bool finish_transfer()
+{
+    uint8_t mac[FLEET_MAC_BYTES];
+    bundle_mac(fleetTransfer.bundleId, fleetTransfer.totalLength, fleetTransfer.bundle.data(), mac);
+    FleetStatus status = mac_equal(mac, fleetTransfer.mac) ? fleet_apply_bundle(fleetTransfer.bundle.data(), fleetTransfer.totalLength)
+                                                           : FLEET_BAD_SIGNATURE;
+    if (status == FLEET_APPLIED)
+    {
+        lastAppliedId = fleetTransfer.bundleId;
+        storage_put_string(PREFERENCES_NAMESPACE_GENERAL, FLEET_BUNDLE_KEY, String((unsigned long)lastAppliedId));
+        fleetMetrics.bundlesApplied++;
+        fleetMetrics.lastBundleId = lastAppliedId;
+        fleetMetrics.lastTransferMs = millis() - fleetTransfer.startedMs;
+    }
+    else
+    {
+        fleetMetrics.bundlesRefused++;
+    }
+    Serial.printf("Fleet: bundle %u (%u bytes) %s\n", (unsigned)fleetTransfer.bundleId, (unsigned)fleetTransfer.totalLength,
+                  status == FLEET_APPLIED ? "applied" : status == FLEET_BAD_SIGNATURE ? "has a bad signature" : "rejected");
+
+    lastResultId = fleetTransfer.bundleId;
+    memcpy(lastResultMac, fleetTransfer.mac, FLEET_MAC_BYTES);
+    lastResultStatus = status;
+    send_done(fleetTransfer.sender, fleetTransfer.senderPort, fleetTransfer.bundleId, status);
+    fleetTransfer.active = false;
+    std::vector<uint8_t>().swap(fleetTransfer.bundle);
+    return status == FLEET_APPLIED;
+}
+
+static bool handle_chunk(const uint8_t *packet, size_t length, uint32_t bundleId)
+{
+    if (!fleetTransfer.active || bundleId != fleetTransfer.bundleId || length < FLEET_HEADER_BYTES + 1)
+        return false; // A device that missed the MANIFEST joins at the sender's next poll
+
+    uint8_t index = packet[FLEET_HEADER_BYTES];
+    size_t offset = index * FLEET_CHUNK_BYTES;
+    size_t expected = index + 1 < fleetTransfer.chunkCount ? FLEET_CHUNK_BYTES : fleetTransfer.totalLength - offset;
+    size_t dataLength = length - FLEET_HEADER_BYTES - 1;
+    if (index >= fleetTransfer.chunkCount || dataLength != expected)
+        return false;
+
+    fleetTransfer.lastDatagramMs = millis();
+    uint32_t bit = 1UL << index;
+    if (fleetTransfer.received & bit)
+    {
+        fleetMetrics.duplicateChunks++; // Retransmitted for another device
+        return false;
+    }
+    memcpy(fleetTransfer.bundle.data() + offset, packet + FLEET_HEADER_BYTES + 1, dataLength);
+    fleetTransfer.received |= bit;
+    fleetMetrics.chunksReceived++;
+    return missing_chunks() == 0 && finish_transfer();
+}
+
+static void fleet_start()
+{
+    load_settings();
+
+    String name = fleet_device_name();
+    if (MDNS.begin(name.c_str()))
+    {
+        MDNS.addService(FLEET_MDNS_SERVICE, "_udp", FLEET_PORT);
+        MDNS.addServiceTxt(FLEET_MDNS_SERVICE, "_udp", "bundle", String((unsigned long)lastAppliedId).c_str());
+        MDNS.addService("_http", "_tcp", HTTP_PORT);
+    }
+    IPAddress group(FLEET_MULTICAST_GROUP[0], FLEET_MULTICAST_GROUP[1], FLEET_MULTICAST_GROUP[2], FLEET_MULTICAST_GROUP[3]);
+    fleetUdp.beginMulticast(group, FLEET_PORT);
+    fleetStarted = true;
+    Serial.printf("Fleet: announced as %s.local, bundles on %s:%u%s\n", name.c_str(), group.toString().c_str(), FLEET_PORT,
+                  fleetKeySet ? "" : " (no fleet key set, bundles are refused)");
+}
+
+bool fleet_loop()
+{
+    if (!fleetStarted)
+        fleet_start();
+
+    bool applied = false;
+    // Bounded so that a flood cannot hold up the loop; the socket buffers the rest
+    for (size_t n = 0; n < 2 * FLEET_MAX_CHUNKS && fleetUdp.parsePacket() > 0; n++)
+    {
+        int length = fleetUdp.read(fleetPacket, sizeof(fleetPacket));
+        if (length < (int)FLEET_HEADER_BYTES || memcmp(fleetPacket, FLEET_MAGIC, 4) != 0)
+            continue;
+        uint32_t bundleId = read_u32(fleetPacket + 5);
+        if (fleetPacket[4] == PACKET_MANIFEST)
+            handle_manifest(fleetPacket, length, bundleId);
+        else if (fleetPacket[4] == PACKET_CHUNK)
+            applied |= handle_chunk(fleetPacket, length, bundleId);
+    }
+
+    if (fleetTransfer.active)
+    {
+        unsigned long now = millis();
+        if (now - fleetTransfer.startedMs >= FLEET_TRANSFER_TIMEOUT_MS)
+        {
+            Serial.printf("Fleet: bundle %u dropped with chunks missing (0x%08x)\n", (unsigned)fleetTransfer.bundleId, (unsigned)missing_chunks());
+            fleetTransfer.active = false;
+            std::vector<uint8_t>().swap(fleetTransfer.bundle);
+        }
+        else if ((fleetTransfer.nackScheduled && (long)(now - fleetTransfer.nackDueMs) >= 0) ||
+                 now - fleetTransfer.lastDatagramMs >= FLEET_NACK_TIMEOUT_MS)
+        {
+            send_nack();
+        }
+    }
+    return applied;
+}
+
+void fleet_stop()
+{
+    if (!fleetStarted)
+        return;
+    MDNS.end();
+    fleetUdp.stop();
+    fleetTransfer.active = false;
+    std::vector<uint8_t>().swap(fleetTransfer.bundle);
+    fleetStarted = false;
+}
+
+FleetStatus fleet_apply_bundle(const uint8_t *bundle, size_t length)
+{
+    struct Entry
+    {
+        int slot;
+        std::vector<MacroStep> sequence;
+    };
+
+    if (length < 2)
+        return FLEET_REJECTED;
+    uint8_t activeSlot = bundle[0];
+    uint8_t frameRate = bundle[1];
+    if ((activeSlot != FLEET_KEEP && activeSlot >= MACRO_SLOT_COUNT) || (frameRate != FLEET_KEEP && frameRate > FRAME_RATE_MAX_HZ))
+        return FLEET_REJECTED;
+
+    // Check everything before touching any slot
+    std::vector<Entry> entries;
+    for (size_t pos = 2; pos < length;)
+    {
+        if (length - pos < 3)
+            return FLEET_REJECTED;
+        int slot = bundle[pos];
+        size_t textLength = read_u16(bundle + pos + 1);
+        pos += 3;
+        if (slot >= MACRO_SLOT_COUNT || textLength > length - pos)
+            return FLEET_REJECTED;
+
+        String text;
+        text.concat((const char *)bundle + pos, textLength);
+        pos += textLength;
+        entries.push_back({slot, macro_parse(text)});
+    }
+
+    // Every macro is costed at the rate it will play at, which the bundle may change
+    uint8_t playHz = frameRate != FLEET_KEEP ? frameRate : joystick_get_frame_rate();
+    for (const auto &entry : entries)
+    {
+        MacroAnalysis analysis;
+        macro_optimize(entry.sequence, analysis, playHz);
+        if (analysis.rejection)
+        {
+            Serial.printf("Fleet: macro for slot %d rejected (%s)\n", entry.slot, analysis.rejection);
+            return FLEET_REJECTED;
+        }
+    }
+
+    if (frameRate != FLEET_KEEP)
+        joystick_set_frame_rate(frameRate);
+    for (const auto &entry : entries)
+    {
+        if (!macro_store(entry.slot, entry.sequence))
+        {
+            Serial.printf("Fleet: macro for slot %d could not be stored\n", entry.slot);
+            return FLEET_REJECTED;
+        }
+    }
+    if (activeSlot != FLEET_KEEP)
+        macro_select_slot(activeSlot);
+    return FLEET_APPLIED;
+}
+
+void fleet_set_key(const uint8_t key[FLEET_KEY_BYTES])
+{
+    load_settings();
+    memcpy(fleetKey, key, FLEET_KEY_BYTES);
+    fleetKeySet = true;
+
+    String hex;
+    hex.reserve(FLEET_KEY_BYTES * 2);
+    for (size_t i = 0; i < FLEET_KEY_BYTES; i++)
+    {
+        char byteText[3];
+        snprintf(byteText, sizeof(byteText), "%02x", key[i]);
+        hex += byteText;
+    }
+    storage_put_string(PREFERENCES_NAMESPACE_GENERAL, FLEET_KEY_KEY, hex);
+}
+
+bool fleet_has_key()
+{
+    load_settings();
+    return fleetKeySet;
+}
+
+String fleet_device_name()
+{
+    // "24:0A:C4:12:34:56" -> "patro-123456"
+    String mac = WiFi.macAddress();
+    String name = "patro-";
+    for (unsigned int i = 9; i < mac.length(); i++)
+    {
+        if (mac[i] != ':')
+            name += (char)tolower(mac[i]);
+    }
+    return name;
+}
+
+FleetMetrics fleet_get_metrics() { return fleetMetrics; }
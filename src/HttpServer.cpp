@@ -0,0 +1,421 @@
+#include "HttpServer.h"
+#include "config.h"
+
+// Responses up to one TCP segment (the lwIP MSS) go out in a single write
+constexpr size_t SINGLE_WRITE_BYTES = 1436;
+
+static const char *status_text(int code)
+{
+    switch (code)
+    {
+    case 200:
+        return "OK";
+    case 204:
+        return "No Content";
+    case 302:
+        return "Found";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 413:
+        return "Payload Too Large";
+    case 500:
+        return "Internal Server Error";
+    case 501:
+        return "Not Implemented";
+    default:
+        return "";
+    }
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static String url_decode(const char *text, size_t length)
+{
+    String decoded;
+    decoded.reserve(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = text[i];
+        if (c == '+')
+        {
+            c = ' ';
+        }
+        else if (c == '%' && i + 2 < length && hex_value(text[i + 1]) >= 0 && hex_value(text[i + 2]) >= 0)
+        {
+            c = (char)(hex_value(text[i + 1]) << 4 | hex_value(text[i + 2]));
+            i += 2;
+        }
+        decoded += c;
+    }
+    return decoded;
+}
+
+// Appends the name=value pairs of a query string or urlencoded body
+static void parse_args(const char *text, size_t length, std::vector<std::pair<String, String>> &args)
+{
+    size_t start = 0;
+    while (start < length)
+    {
+        const char *pair = text + start;
+        const char *amp = (const char *)memchr(pair, '&', length - start);
+        size_t pairLength = amp ? (size_t)(amp - pair) : length - start;
+        if (pairLength > 0)
+        {
+            const char *eq = (const char *)memchr(pair, '=', pairLength);
+            size_t nameLength = eq ? (size_t)(eq - pair) : pairLength;
+            String value = eq ? url_decode(eq + 1, pairLength - nameLength - 1) : String();
+            args.push_back({url_decode(pair, nameLength), value});
+        }
+        start += pairLength + 1;
+    }
+}
+
+// A Content-Length value: digits only, so a sign or an overflow makes the request invalid
+// instead of wrapping the size. Values past HTTP_MAX_REQUEST_BYTES stop accumulating.
+static bool parse_content_length(const char *value, size_t length, size_t &contentLength)
+{
+    while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t'))
+        length--;
+    if (length == 0)
+        return false;
+    size_t parsed = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (value[i] < '0' || value[i] > '9')
+            return false;
+        if (parsed <= HTTP_MAX_REQUEST_BYTES)
+            parsed = parsed * 10 + (value[i] - '0');
+    }
+    contentLength = parsed;
+    return true;
+}
+
+// Case-insensitive search for token in a header value of the given length
+static bool header_has_token(const char *value, size_t length, const char *token)
+{
+    size_t tokenLength = strlen(token);
+    for (size_t i = 0; i + tokenLength <= length; i++)
+    {
+        if (strncasecmp(value + i, token, tokenLength) == 0)
+            return true;
+    }
+    return false;
+}
+
+HttpServer::HttpServer(uint16_t port) : listener(port, HTTP_MAX_CLIENTS) {}
+
+void HttpServer::begin()
+{
+    listener.begin();
+}
+
+void HttpServer::stop()
+{
+    for (auto &conn : connections)
+        conn.client.stop();
+    connections.clear();
+    listener.stop();
+}
+
+void HttpServer::on(const char *uri, HttpMethod method, Handler handler)
+{
+    routes.push_back({uri, method, handler});
+}
+
+bool HttpServer::hasArg(const char *name) const
+{
+    for (const auto &arg : requestArgs)
+    {
+        if (arg.first == name)
+            return true;
+    }
+    return false;
+}
+
+String HttpServer::arg(const char *name) const
+{
+    for (const auto &arg : requestArgs)
+    {
+        if (arg.first == name)
+            return arg.second;
+    }
+    return String();
+}
+
+void HttpServer::sendHeader(const char *name, const String &value)
+{
+    responseHeaders += name;
+    responseHeaders += ": ";
+    responseHeaders += value;
+    responseHeaders += "\r\n";
+}
+
+void HttpServer::send(int code, const char *contentType, const String &content)
+{
+    write_response(code, contentType, content.c_str(), content.length());
+}
+
+void HttpServer::send(int code, const char *contentType, const char *content)
+{
+    write_response(code, contentType, content, strlen(content));
+}
+
+void HttpServer::write_response(int code, const char *contentType, const char *content, size_t length)
+{
+    if (!current || current->responded)
+        return;
+    current->responded = true;
+
+    char head[SINGLE_WRITE_BYTES];
+    int headLength = current->closeAfterResponse
+                         ? snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n%sConnection: close\r\n\r\n",
+                                    code, status_text(code), contentType, (unsigned)length, responseHeaders.c_str())
+                         : snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n%sKeep-Alive: timeout=%lu\r\n\r\n",
+                                    code, status_text(code), contentType, (unsigned)length, responseHeaders.c_str(), HTTP_IDLE_TIMEOUT_MS / 1000);
+    responseHeaders = String();
+    if (headLength < 0 || (size_t)headLength >= sizeof(head))
+        return;
+
+    // Small responses share one segment with their headers; the page itself is sent as is
+    if (headLength + length <= sizeof(head))
+    {
+        memcpy(head + headLength, content, length);
+        current->client.write((const uint8_t *)head, headLength + length);
+    }
+    else
+    {
+        current->client.write((const uint8_t *)head, headLength);
+        current->client.write((const uint8_t *)content, length);
+    }
+}
+
+void HttpServer::accept_clients()
+{
+    while (listener.hasClient())
+    {
+        if (connections.size() >= HTTP_MAX_CLIENTS)
+        {
+            // Make room by closing the connection that has been idle the longest. When every
+            // connection has a request in flight, the new client waits in the listen backlog.
+            unsigned long now = millis();
+            Connection *oldest = nullptr;
+            for (auto &conn : connections)
+            {
+                // Kept alive between requests; a fresh connection's first request may still be on its way
+                bool idle = conn.requests > 0 && conn.buffer.length() == 0 && conn.client.available() == 0;
+                if (idle && (!oldest || now - conn.lastActivityMs > now - oldest->lastActivityMs))
+                    oldest = &conn;
+            }
+            if (!oldest)
+            {
+                httpStats.backlogged++;
+                return;
+            }
+            oldest->client.stop();
+            connections.erase(connections.begin() + (oldest - connections.data()));
+            httpStats.evicted++;
+        }
+
+        WiFiClient client = listener.accept();
+        if (!client)
+            return;
+        client.setNoDelay(true);
+        connections.push_back({client, String(), millis(), 0, false, false});
+        httpStats.accepted++;
+    }
+}
+
+bool HttpServer::read_into(Connection &conn)
+{
+    // Pipelined requests beyond HTTP_MAX_REQUEST_BYTES stay in the socket until there is room
+    uint8_t chunk[512];
+    bool received = false;
+    while (conn.buffer.length() < HTTP_MAX_REQUEST_BYTES)
+    {
+        int available = conn.client.available();
+        if (available <= 0)
+            break;
+        size_t want = std::min<size_t>({sizeof(chunk), (size_t)available, HTTP_MAX_REQUEST_BYTES - conn.buffer.length()});
+        int n = conn.client.read(chunk, want);
+        if (n <= 0)
+            break;
+        conn.buffer.concat((const char *)chunk, n);
+        received = true;
+    }
+    if (received)
+        conn.lastActivityMs = millis();
+    return received;
+}
+
+bool HttpServer::serve_one(Connection &conn)
+{
+    // Tolerate the blank lines some clients put between pipelined requests
+    size_t skip = 0;
+    while (skip + 1 < conn.buffer.length() && conn.buffer[skip] == '\r' && conn.buffer[skip + 1] == '\n')
+        skip += 2;
+    if (skip > 0)
+        conn.buffer.remove(0, skip);
+
+    const char *data = conn.buffer.c_str();
+    const char *headEnd = strstr(data, "\r\n\r\n");
+    if (!headEnd)
+    {
+        if (conn.buffer.length() >= HTTP_MAX_REQUEST_BYTES)
+        {
+            httpStats.badRequests++;
+            conn.closeAfterResponse = true;
+            current = &conn;
+            write_response(413, "text/plain", "", 0);
+            current = nullptr;
+        }
+        return false;
+    }
+    size_t headLength = headEnd - data + 4;
+
+    // Request line: METHOD SP target SP HTTP/1.x
+    const char *lineEnd = strstr(data, "\r\n");
+    const char *sp1 = (const char *)memchr(data, ' ', lineEnd - data);
+    const char *sp2 = sp1 ? (const char *)memchr(sp1 + 1, ' ', lineEnd - sp1 - 1) : nullptr;
+    bool valid = sp2 && strncmp(sp2 + 1, "HTTP/1.", 7) == 0;
+    bool http10 = valid && sp2[8] == '0';
+
+    size_t contentLength = 0;
+    bool hasContentLength = false;
+    bool keepAlive = !http10;
+    bool formBody = false;
+    bool chunked = false;
+    for (const char *line = lineEnd + 2; valid && line < headEnd;)
+    {
+        const char *end = strstr(line, "\r\n");
+        const char *colon = (const char *)memchr(line, ':', end - line);
+        if (colon)
+        {
+            const char *value = colon + 1;
+            while (value < end && *value == ' ')
+                value++;
+            size_t nameLength = colon - line;
+            size_t valueLength = end - value;
+            if (nameLength == 14 && strncasecmp(line, "Content-Length", 14) == 0)
+            {
+                // A repeated header must agree with the first one
+                size_t length = 0;
+                valid = parse_content_length(value, valueLength, length) && (!hasContentLength || length == contentLength);
+                contentLength = length;
+                hasContentLength = true;
+            }
+            else if (nameLength == 10 && strncasecmp(line, "Connection", 10) == 0)
+                keepAlive = http10 ? header_has_token(value, valueLength, "keep-alive") : !header_has_token(value, valueLength, "close");
+            else if (nameLength == 12 && strncasecmp(line, "Content-Type", 12) == 0)
+                formBody = header_has_token(value, valueLength, "application/x-www-form-urlencoded");
+            else if (nameLength == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0)
+                chunked = true;
+        }
+        line = end + 2;
+    }
+
+    current = &conn;
+    // Written so that it cannot wrap, whatever the header said
+    if (!valid || chunked || headLength > HTTP_MAX_REQUEST_BYTES || contentLength > HTTP_MAX_REQUEST_BYTES - headLength)
+    {
+        httpStats.badRequests++;
+        conn.closeAfterResponse = true;
+        write_response(!valid ? 400 : chunked ? 501 : 413, "text/plain", "", 0);
+        current = nullptr;
+        return false;
+    }
+    if (conn.buffer.length() < headLength + contentLength)
+    {
+        current = nullptr;
+        return false; // Body still on its way
+    }
+    size_t requestLength = headLength + contentLength;
+
+    requestMethod = strncmp(data, "GET ", 4) == 0 ? HttpMethod::GET : strncmp(data, "POST ", 5) == 0 ? HttpMethod::POST : HttpMethod::OTHER;
+    const char *query = (const char *)memchr(sp1 + 1, '?', sp2 - sp1 - 1);
+    const char *pathEnd = query ? query : sp2;
+    requestUri = String();
+    requestUri.concat(sp1 + 1, pathEnd - sp1 - 1);
+    requestArgs.clear();
+    if (query)
+        parse_args(query + 1, sp2 - query - 1, requestArgs);
+    if (formBody)
+        parse_args(data + headLength, contentLength, requestArgs);
+
+    if (conn.requests > 0)
+        httpStats.reused++;
+    if (conn.buffer.length() > requestLength)
+        httpStats.pipelined++;
+    conn.requests++;
+    conn.closeAfterResponse = !keepAlive || conn.requests >= HTTP_MAX_REQUESTS_PER_CONN;
+    conn.responded = false;
+    responseHeaders = String();
+
+    dispatch();
+    if (!conn.responded && conn.client.connected())
+        write_response(500, "text/plain", "No response", 11);
+    httpStats.requests++;
+    current = nullptr;
+
+    conn.buffer.remove(0, requestLength);
+    conn.lastActivityMs = millis(); // The idle timeout runs from the response (a scan takes seconds)
+    if (!conn.client.connected())
+        conn.closeAfterResponse = true; // The client went away during the handler
+    return !conn.closeAfterResponse;
+}
+
+void HttpServer::dispatch()
+{
+    for (const auto &route : routes)
+    {
+        if (route.uri == requestUri && (route.method == HttpMethod::ANY || route.method == requestMethod))
+        {
+            route.handler();
+            return;
+        }
+    }
+    if (notFoundHandler)
+        notFoundHandler();
+    else
+        send(404, "text/plain", "Not found");
+}
+
+void HttpServer::handleClient()
+{
+    accept_clients();
+
+    for (size_t i = 0; i < connections.size();)
+    {
+        Connection &conn = connections[i];
+        read_into(conn);
+
+        // Pipelined requests are answered in arrival order, a few per pass so that one
+        // client cannot hold up the loop
+        uint8_t budget = HTTP_PIPELINE_BUDGET;
+        while (budget > 0 && serve_one(conn))
+            budget--;
+        bool drained = budget > 0; // Stopped for want of a complete request, not for the budget
+
+        bool expired = millis() - conn.lastActivityMs >= HTTP_IDLE_TIMEOUT_MS;
+        bool gone = drained && !conn.client.connected();
+        if (conn.closeAfterResponse || gone || expired)
+        {
+            if (expired && !conn.closeAfterResponse && !gone)
+                httpStats.closedIdle++;
+            conn.client.stop();
+            connections.erase(connections.begin() + i);
+            continue;
+        }
+        i++;
+    }
+}
@@ -1,52 +1,296 @@
+#include <atomic>
 #include <Arduino.h>
+#include <soc/gpio_reg.h>
 #include "InputManager.h"
 #include "config.h"
 
-void input_init()
+// Inputs are debounced 32 at a time. Each lane is one 32-bit word where bit n is one
+// input, and the per-input integrators are stored bit-sliced (vertical counters), so a
+// scan costs the same handful of word operations whether 2 or 32 buttons are fitted.
+//
+// Lane 0 holds GPIO0-31 and lane 1 GPIO32-39, both indexed by GPIO number and filled
+// straight from the input registers. Lane 2 holds the matrix, bit = key = row * cols + col.
+//
+// The scan still tracks the held level of the direct buttons, but their presses are taken
+// by the GPIO interrupt, which does not wait for four stable samples. When the interrupt
+// misses a press (the line had bounced back high by the time it sampled it), the scan's
+// debounced press is counted instead, a few tens of ms late.
+enum InputLane
+{
+    LANE_GPIO_LOW,
+    LANE_GPIO_HIGH,
+    LANE_MATRIX,
+    LANE_COUNT
+};
+
+struct DebounceLane
+{
+    uint32_t mask;     // Inputs that are configured in this lane
+    uint32_t state;    // Debounced level, 1 = pressed
+    uint32_t ct0;      // Vertical 2-bit counter, low bits
+    uint32_t ct1;      // Vertical 2-bit counter, high bits
+    uint32_t pressed;  // Press edges not yet consumed
+    uint32_t edgeMask; // Inputs whose presses come from the interrupt instead
+};
+
+DebounceLane inputLanes[LANE_COUNT];
+
+// --- Interrupt side, GPIO lanes only ---
+constexpr int GPIO_COUNT = 40;
+TaskHandle_t inputLoopTask = nullptr;
+std::atomic<uint32_t> edgePresses[2]; // Press edges not yet consumed, per GPIO lane
+uint32_t edgeTaken[2];                 // The interrupt took a press since the last settled release
+uint32_t lastEdgeUs[GPIO_COUNT];       // Any edge, for the quiet window
+uint32_t burstStartUs[GPIO_COUNT];     // First edge after a quiet window, whatever its level
+uint32_t pressEdgeUs[GPIO_COUNT];      // Last press edge
+portMUX_TYPE edgeLock = portMUX_INITIALIZER_UNLOCKED; // edgeTaken and lastEdgeUs
+InputLatencyMetrics latencyMetrics = {};
+
+constexpr size_t MATRIX_ROWS = MATRIX_ROW_PINS[0] < 0 ? 0 : sizeof(MATRIX_ROW_PINS) / sizeof(MATRIX_ROW_PINS[0]);
+constexpr size_t MATRIX_COLS = MATRIX_COL_PINS[0] < 0 ? 0 : sizeof(MATRIX_COL_PINS) / sizeof(MATRIX_COL_PINS[0]);
+static_assert(MATRIX_ROWS * MATRIX_COLS <= 32, "The button matrix must fit in one 32-bit lane");
+
+// Rows are driven through GPIO_OUT_W1TS/W1TC, which only reach GPIO0-31
+constexpr bool rows_below_32(size_t row = 0)
 {
-    pinMode(BTN_MODE_PIN, INPUT_PULLUP);
-    pinMode(BTN_ACTION_PIN, INPUT_PULLUP);
+    return row >= MATRIX_ROWS || (MATRIX_ROW_PINS[row] < 32 && rows_below_32(row + 1));
 }
+static_assert(rows_below_32(), "Matrix row pins must be GPIOs below 32");
 
-bool read_button(int pin)
+// The matrix in use, the config one unless input_init() was given another
+int matrixRowPins[32];
+int matrixColPins[32];
+size_t matrixRows = 0;
+size_t matrixCols = 0;
+uint32_t matrixRowMask = 0; // All row pins, for one-shot W1TS/W1TC writes
+
+// Advances every integrator in the lane by one sample. An input has to read the same
+// level on four consecutive scans before its debounced state flips. Returns the inputs
+// that became pressed.
+static uint32_t debounce_lane(DebounceLane &lane, uint32_t sample)
 {
-    if (digitalRead(pin) == LOW)
-    {
-        delay(DEBOUNCE_DELAY);
-        if (digitalRead(pin) == LOW)
-            return true;
-    }
-    return false;
+    uint32_t changed = (lane.state ^ sample) & lane.mask;
+    lane.ct0 = ~(lane.ct0 & changed);
+    lane.ct1 = lane.ct0 ^ (lane.ct1 & changed);
+    changed &= lane.ct0 & lane.ct1; // Counter rolled over
+    lane.state ^= changed;
+    lane.pressed |= lane.state & changed & ~lane.edgeMask;
+    return lane.state & changed;
+}
+
+// Leading-edge debounce: a falling edge after INPUT_EDGE_QUIET_MS without any edge is a
+// press, taken at once. Every edge restarts the window, so the bounces of the press and
+// of the release never count.
+static void IRAM_ATTR button_isr(void *arg)
+{
+    int pin = (int)(intptr_t)arg;
+    int lane = pin < 32 ? LANE_GPIO_LOW : LANE_GPIO_HIGH;
+    uint32_t now = micros();
+    uint32_t level = pin < 32 ? REG_READ(GPIO_IN_REG) >> pin : REG_READ(GPIO_IN1_REG) >> (pin - 32);
+
+    portENTER_CRITICAL_ISR(&edgeLock);
+    bool quiet = now - lastEdgeUs[pin] >= INPUT_EDGE_QUIET_MS * 1000;
+    lastEdgeUs[pin] = now;
+    if (quiet)
+        burstStartUs[pin] = now;
+    bool press = quiet && !(level & 1);
+    if (press)
+        edgeTaken[lane] |= 1UL << (pin & 31);
+    portEXIT_CRITICAL_ISR(&edgeLock);
+    if (!press)
+        return;
+
+    pressEdgeUs[pin] = now; // Published by the fetch_or below
+    edgePresses[lane].fetch_or(1UL << (pin & 31));
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(inputLoopTask, &woken);
+    portYIELD_FROM_ISR(woken);
 }
 
-bool input_is_mode_btn_pressed()
+// Scan-side fallback for the interrupt: a debounced press that no interrupt took counts
+// as a press of its own, timed from the edge that started the bounce. Once the button is
+// released, both sampled and debounced, and has been quiet long enough for the interrupt to take the next press, that
+// press is expected from the interrupt again.
+static void reconcile_edges(DebounceLane &lane, int laneIndex, uint32_t sample, uint32_t presses)
 {
-    static bool lastState = false;
-    bool currentState = read_button(BTN_MODE_PIN);
-    if (currentState && !lastState)
+    uint32_t now = micros();
+    int base = laneIndex == LANE_GPIO_LOW ? 0 : 32;
+    portENTER_CRITICAL(&edgeLock);
+    uint32_t missed = presses & lane.edgeMask & ~edgeTaken[laneIndex];
+    edgeTaken[laneIndex] |= missed;
+    uint32_t settled = lane.edgeMask & ~lane.state & ~sample & edgeTaken[laneIndex];
+    for (uint32_t bits = settled; bits; bits &= bits - 1)
     {
-        lastState = true;
-        return true;
+        int pin = base + __builtin_ctz(bits);
+        if (now - lastEdgeUs[pin] >= INPUT_EDGE_QUIET_MS * 1000)
+            edgeTaken[laneIndex] &= ~(1UL << (pin - base));
     }
-    else if (!currentState)
+    for (uint32_t bits = missed; bits; bits &= bits - 1)
+        pressEdgeUs[base + __builtin_ctz(bits)] = burstStartUs[base + __builtin_ctz(bits)];
+    portEXIT_CRITICAL(&edgeLock);
+    lane.pressed |= missed;
+}
+
+static uint32_t scan_matrix()
+{
+    uint32_t sample = 0;
+    for (size_t row = 0; row < matrixRows; row++)
     {
-        lastState = false;
+        REG_WRITE(GPIO_OUT_W1TC_REG, 1UL << matrixRowPins[row]);
+        delayMicroseconds(MATRIX_SETTLE_US);
+        uint32_t low = ~REG_READ(GPIO_IN_REG);
+        uint32_t high = ~REG_READ(GPIO_IN1_REG);
+        REG_WRITE(GPIO_OUT_W1TS_REG, matrixRowMask);
+
+        for (size_t col = 0; col < matrixCols; col++)
+        {
+            int pin = matrixColPins[col];
+            uint32_t bit = pin < 32 ? (low >> pin) & 1 : (high >> (pin - 32)) & 1;
+            sample |= bit << (row * matrixCols + col);
+        }
     }
-    return false;
+    return sample;
+}
+
+void input_init()
+{
+    input_init(INPUT_PINS, sizeof(INPUT_PINS) / sizeof(INPUT_PINS[0]), MATRIX_ROW_PINS, MATRIX_ROWS, MATRIX_COL_PINS, MATRIX_COLS);
 }
 
-bool input_is_action_btn_pressed()
+void input_init(const int *pins, size_t count, const int *rowPins, size_t rows, const int *colPins, size_t cols)
 {
-    static bool lastState = false;
-    bool currentState = read_button(BTN_ACTION_PIN);
-    if (currentState && !lastState)
+    // Starts over, so that the bench can swap one set of buttons for another
+    for (int pin = 0; pin < GPIO_COUNT; pin++)
+    {
+        if (inputLanes[pin < 32 ? LANE_GPIO_LOW : LANE_GPIO_HIGH].mask & (1UL << (pin & 31)))
+            detachInterrupt(digitalPinToInterrupt(pin));
+    }
+    for (auto &lane : inputLanes)
+        lane = {};
+    for (int lane = 0; lane < 2; lane++)
+    {
+        edgePresses[lane] = 0;
+        edgeTaken[lane] = 0;
+    }
+    matrixRowMask = 0;
+
+    inputLoopTask = xTaskGetCurrentTaskHandle();
+    for (size_t i = 0; i < count; i++)
+    {
+        int pin = pins[i];
+        pinMode(pin, INPUT_PULLUP);
+        DebounceLane &lane = inputLanes[pin < 32 ? LANE_GPIO_LOW : LANE_GPIO_HIGH];
+        lane.mask |= 1UL << (pin & 31);
+        lane.edgeMask |= 1UL << (pin & 31);
+        lastEdgeUs[pin] = micros() - INPUT_EDGE_QUIET_MS * 1000; // The first press counts
+        attachInterruptArg(digitalPinToInterrupt(pin), button_isr, (void *)(intptr_t)pin, CHANGE);
+    }
+
+    // A matrix the output registers cannot drive is left out rather than scanned wrong
+    bool fits = rows * cols <= 32;
+    for (size_t row = 0; row < rows; row++)
+        fits = fits && rowPins[row] >= 0 && rowPins[row] < 32;
+    if (!fits)
     {
-        lastState = true;
-        return true;
+        Serial.printf("Input: %ux%u matrix left out, rows must be GPIOs below 32 and keys at most 32\n", (unsigned)rows, (unsigned)cols);
+        rows = 0;
     }
-    else if (!currentState)
+    matrixRows = rows;
+    matrixCols = rows > 0 ? cols : 0;
+    for (size_t row = 0; row < matrixRows; row++)
     {
-        lastState = false;
+        matrixRowPins[row] = rowPins[row];
+        pinMode(rowPins[row], OUTPUT);
+        digitalWrite(rowPins[row], HIGH);
+        matrixRowMask |= 1UL << rowPins[row];
     }
-    return false;
-}
\ No newline at end of file
+    for (size_t col = 0; col < matrixCols; col++)
+    {
+        matrixColPins[col] = colPins[col];
+        pinMode(colPins[col], INPUT_PULLUP);
+    }
+    inputLanes[LANE_MATRIX].mask = matrixRows * matrixCols == 32 ? 0xFFFFFFFFUL : (1UL << (matrixRows * matrixCols)) - 1;
+
+    for (auto &lane : inputLanes)
+    {
+        lane.ct0 = lane.ct1 = 0xFFFFFFFFUL;
+    }
+}
+
+void input_scan()
+{
+    // The integrators assume a fixed sample rate; loop() may run faster while a macro plays
+    static unsigned long lastScan = 0;
+    unsigned long now = millis();
+    if (now - lastScan < INPUT_SCAN_PERIOD_MS)
+        return;
+    lastScan = now;
+
+    // Buttons are active low: invert so that 1 = pressed
+    uint32_t low = ~REG_READ(GPIO_IN_REG);
+    uint32_t high = ~REG_READ(GPIO_IN1_REG);
+    reconcile_edges(inputLanes[LANE_GPIO_LOW], LANE_GPIO_LOW, low, debounce_lane(inputLanes[LANE_GPIO_LOW], low));
+    reconcile_edges(inputLanes[LANE_GPIO_HIGH], LANE_GPIO_HIGH, high, debounce_lane(inputLanes[LANE_GPIO_HIGH], high));
+    if (matrixRows > 0)
+        debounce_lane(inputLanes[LANE_MATRIX], scan_matrix());
+}
+
+static bool take_press(DebounceLane &lane, int bit)
+{
+    uint32_t m = 1UL << bit;
+    bool pressed = lane.pressed & m;
+    lane.pressed &= ~m;
+    return pressed;
+}
+
+bool input_was_pressed(int pin)
+{
+    int lane = pin < 32 ? LANE_GPIO_LOW : LANE_GPIO_HIGH;
+    uint32_t m = 1UL << (pin & 31);
+    bool edge = edgePresses[lane].fetch_and(~m) & m;
+    return take_press(inputLanes[lane], pin & 31) || edge;
+}
+
+bool input_is_held(int pin)
+{
+    return pin < 32 ? (inputLanes[LANE_GPIO_LOW].state >> pin) & 1 : (inputLanes[LANE_GPIO_HIGH].state >> (pin - 32)) & 1;
+}
+
+bool input_matrix_was_pressed(int key)
+{
+    if (key < 0 || (size_t)key >= matrixRows * matrixCols)
+        return false;
+    return take_press(inputLanes[LANE_MATRIX], key);
+}
+
+uint32_t input_press_time_us(int pin) { return pressEdgeUs[pin]; }
+
+bool input_is_mode_btn_pressed() { return input_was_pressed(BTN_MODE_PIN); }
+bool input_is_action_btn_pressed() { return input_was_pressed(BTN_ACTION_PIN); }
+
+void input_record_reaction(uint32_t pressedUs, uint32_t reportUs)
+{
+    uint32_t latency = reportUs - pressedUs;
+    size_t bucket = 0;
+    while (bucket < INPUT_LATENCY_BUCKET_COUNT - 1 && latency > INPUT_LATENCY_BUCKETS_US[bucket])
+        bucket++;
+    latencyMetrics.buckets[bucket]++;
+    latencyMetrics.presses++;
+    latencyMetrics.lastLatencyUs = latency;
+    latencyMetrics.latencySumUs += latency;
+    if (latency > latencyMetrics.maxLatencyUs)
+        latencyMetrics.maxLatencyUs = latency;
+}
+
+InputLatencyMetrics input_get_latency() { return latencyMetrics; }
+
+void input_print_latency(Print &out)
+{
+    const InputLatencyMetrics &m = latencyMetrics;
+    out.printf("Button to report: %u presses, last %u us / mean %u us / max %u us\n", (unsigned)m.presses,
+               (unsigned)m.lastLatencyUs, (unsigned)(m.presses ? m.latencySumUs / m.presses : 0), (unsigned)m.maxLatencyUs);
+    out.print("  ");
+    for (size_t i = 0; i < INPUT_LATENCY_BUCKET_COUNT - 1; i++)
+        out.printf("<=%u us: %u  ", (unsigned)INPUT_LATENCY_BUCKETS_US[i], (unsigned)m.buckets[i]);
+    out.printf(">%u us: %u\n", (unsigned)INPUT_LATENCY_BUCKETS_US[INPUT_LATENCY_BUCKET_COUNT - 2], (unsigned)m.buckets[INPUT_LATENCY_BUCKET_COUNT - 1]);
+}
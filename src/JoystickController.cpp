@@ -1,80 +1,273 @@
 #include "JoystickController.h"
 #include <BleGamepad.h>
 #include <Arduino.h>
+#include "Storage.h"
+#include "config.h"
 
 BleGamepad bleGamepad("PatroSmartController", "LFP", 100);
 
-void joystick_init() { bleGamepad.begin(); }
-bool joystick_is_connected() { return bleGamepad.isConnected(); }
+// Macro machine states
+enum class MacroState
+{
+    IDLE,
+    PRESSING,
+    WAITING_BETWEEN_STEPS
+};
 
-void joystick_run_macro(const std::vector<MacroStep> &sequence, bool isRunning)
+MacroState macroState = MacroState::IDLE;
+int stepIndex = 0;
+unsigned long edgeDeadlineUs = 0; // When the host should observe the next edge (micros)
+
+// --- Send latency compensation ---
+// Every press()/release() blocks until the report has been handed to the BLE stack. That
+// time is tracked as a moving average and used as lead: an edge due at T is sent at T - lead.
+uint32_t sendLeadUs = HID_SEND_LEAD_INITIAL_US;
+JoystickMetrics joystickMetrics = {};
+unsigned long lastReportUs = 0; // When the player's last report went out (micros)
+
+// --- Frame-synchronous timebase ---
+// Edge times are computed from the frame number, never by adding a rounded period, so a
+// 60 Hz grid (16666.67 us) stays phase-locked to its anchor for any number of cycles.
+uint8_t frameRateHz = 0;         // Rate requested by the user (0 = millisecond timing)
+uint8_t runFrameRateHz = 0;      // Rate of the current run, latched when it starts
+unsigned long frameAnchorUs = 0; // Frame 0 of the current run (micros)
+uint64_t frameCursor = 0;        // Frame of edgeDeadlineUs
+
+// Sends one edge and updates the lead estimate and residual error. Returns when it went out.
+static unsigned long send_edge(int button, bool press, unsigned long deadlineUs)
 {
-    // Macro machine states
-    enum class MacroState
+    if (button == MACRO_PAUSE_BUTTON)
+        return micros(); // Pause step: only the deadlines advance
+    unsigned long before = micros();
+    if (press)
+        bleGamepad.press(button);
+    else
+        bleGamepad.release(button);
+    unsigned long sentAt = micros();
+    lastReportUs = sentAt;
+
+    uint32_t latency = sentAt - before;
+    // EWMA with weight 1/2^HID_SEND_LEAD_SMOOTHING_SHIFT
+    sendLeadUs = sendLeadUs - (sendLeadUs >> HID_SEND_LEAD_SMOOTHING_SHIFT) + (latency >> HID_SEND_LEAD_SMOOTHING_SHIFT);
+
+    int32_t residual = (int32_t)(sentAt - deadlineUs);
+    uint32_t magnitude = residual < 0 ? -residual : residual;
+    joystickMetrics.leadUs = sendLeadUs;
+    joystickMetrics.lastLatencyUs = latency;
+    joystickMetrics.lastResidualUs = residual;
+    joystickMetrics.residualSumUs += magnitude;
+    joystickMetrics.edges++;
+    if (magnitude > joystickMetrics.maxResidualUs)
+        joystickMetrics.maxResidualUs = magnitude;
+    if (magnitude > HID_TIMING_TOLERANCE_US)
+        joystickMetrics.edgesOutOfTolerance++;
+    return sentAt;
+}
+
+// True once the edge is close enough that sending it now makes it land on its deadline
+static bool edge_due(unsigned long now)
+{
+    return (long)(now + sendLeadUs - edgeDeadlineUs) >= 0;
+}
+
+// Start of a frame; wraps with micros() on the 32-bit target
+static unsigned long frame_start_us(uint64_t frame)
+{
+    return frameAnchorUs + (unsigned long)(frame * 1000000ULL / runFrameRateHz);
+}
+
+// A hold or gap of durationMs rounded to whole frames, at least minFrames
+static uint32_t frames_for(int durationMs, uint32_t minFrames, uint8_t hz)
+{
+    uint32_t frames = ((uint64_t)durationMs * hz + 500) / 1000;
+    return frames < minFrames ? minFrames : frames;
+}
+
+// Moves the deadline past a hold or gap of durationMs, rounded to whole frames
+static void advance_deadline(int durationMs, uint32_t minFrames)
+{
+    if (runFrameRateHz == 0)
+    {
+        edgeDeadlineUs += durationMs * 1000UL;
+        return;
+    }
+    frameCursor += frames_for(durationMs, minFrames, runFrameRateHz);
+    edgeDeadlineUs = frame_start_us(frameCursor);
+}
+
+// Chaining from the deadline only holds while edges go out on time. After a stall (flash
+// write, Wi-Fi scan) the overdue edges would fire back to back and the holds and gaps between
+// them would collapse, so an edge sent later than HID_TIMING_TOLERANCE_US becomes the new
+// reference: millisecond timing continues from its send time, frame timing from the first
+// frame boundary at or after it.
+static void reanchor_if_late(unsigned long sentAt)
+{
+    if ((long)(sentAt - edgeDeadlineUs) <= (long)HID_TIMING_TOLERANCE_US)
+        return;
+    joystickMetrics.reanchors++;
+    if (runFrameRateHz == 0)
     {
-        IDLE,
-        PRESSING,
-        WAITING_BETWEEN_STEPS
-    };
+        edgeDeadlineUs = sentAt;
+        return;
+    }
+    frameCursor = ((uint64_t)(sentAt - frameAnchorUs) * runFrameRateHz + 999999) / 1000000;
+    edgeDeadlineUs = frame_start_us(frameCursor);
+}
+
+static uint32_t min_hold_frames(const MacroStep &step) { return step.button == MACRO_PAUSE_BUTTON ? 0 : FRAME_MIN_HELD; }
+constexpr uint32_t GAP_MIN_FRAMES = 1; // The host must sample the release
 
-    static MacroState state = MacroState::IDLE;
-    static int stepIndex = 0;
-    static unsigned long stateStartTime = 0;
-    const int DELAY_BETWEEN_STEPS_MS = 50; // Tempo de espera entre os passos da macro
+uint32_t joystick_hold_us(const MacroStep &step, uint8_t frameRateHz)
+{
+    if (frameRateHz == 0)
+        return step.duration * 1000UL;
+    return frames_for(step.duration, min_hold_frames(step), frameRateHz) * 1000000ULL / frameRateHz;
+}
+
+uint32_t joystick_gap_us(uint8_t frameRateHz)
+{
+    if (frameRateHz == 0)
+        return DELAY_BETWEEN_STEPS_MS * 1000UL;
+    return frames_for(DELAY_BETWEEN_STEPS_MS, GAP_MIN_FRAMES, frameRateHz) * 1000000ULL / frameRateHz;
+}
+
+void joystick_init()
+{
+    frameRateHz = storage_get_uchar(PREFERENCES_NAMESPACE_GENERAL, FRAME_RATE_KEY, FRAME_RATE_DEFAULT_HZ);
+
+    // Output reports from the host (rumble, player LEDs) drive the macro triggers
+    BleGamepadConfiguration config;
+    config.setEnableOutputReport(FEATURE_OUTPUT_TRIGGERS);
+    config.setOutputReportLength(OUTPUT_REPORT_LENGTH);
+    bleGamepad.begin(&config);
+}
+bool joystick_is_connected() { return bleGamepad.isConnected(); }
+void joystick_press(int button) { bleGamepad.press(button); }
+void joystick_release(int button) { bleGamepad.release(button); }
+
+bool joystick_take_output_report(uint8_t *buffer, size_t len)
+{
+    if (!bleGamepad.isOutputReceived())
+        return false;
+    memcpy(buffer, bleGamepad.getOutputBuffer(), std::min(len, (size_t)OUTPUT_REPORT_LENGTH));
+    return true;
+}
+
+unsigned long joystick_us_until_next_edge()
+{
+    if (macroState == MacroState::IDLE)
+        return ~0UL; // Nothing scheduled
+    long remaining = (long)(edgeDeadlineUs - sendLeadUs - micros());
+    return remaining > 0 ? remaining : 0;
+}
+
+JoystickMetrics joystick_get_metrics() { return joystickMetrics; }
+unsigned long joystick_last_report_us() { return lastReportUs; }
+
+int joystick_step_index() { return stepIndex; }
+bool joystick_is_pressing() { return macroState == MacroState::PRESSING; }
 
+void joystick_resume_at(int step)
+{
+    // Only takes effect while idle; the start clamps it to the sequence it is given
+    if (macroState == MacroState::IDLE)
+        stepIndex = step;
+}
+
+bool joystick_set_frame_rate(int hz)
+{
+    if (hz < 0 || hz > FRAME_RATE_MAX_HZ)
+        return false;
+    if (hz != frameRateHz)
+        storage_put_uchar(PREFERENCES_NAMESPACE_GENERAL, FRAME_RATE_KEY, hz);
+    frameRateHz = hz;
+    return true;
+}
+
+uint8_t joystick_get_frame_rate() { return frameRateHz; }
+
+void joystick_print_metrics(Print &out)
+{
+    const JoystickMetrics &m = joystickMetrics;
+    out.printf("HID timing: lead %u us, last send %u us, residual last %d us / mean %u us / max %u us, %u of %u edges over %u us\n",
+               (unsigned)m.leadUs, (unsigned)m.lastLatencyUs, (int)m.lastResidualUs,
+               (unsigned)(m.edges ? m.residualSumUs / m.edges : 0), (unsigned)m.maxResidualUs,
+               (unsigned)m.edgesOutOfTolerance, (unsigned)m.edges, (unsigned)HID_TIMING_TOLERANCE_US);
+    if (m.reanchors)
+        out.printf("  %u late edges re-anchored the timeline\n", (unsigned)m.reanchors);
+}
+
+void joystick_run_macro(const std::vector<MacroStep> &sequence, bool isRunning)
+{
     // Condições de reset: macro pausada, desconectado, ou sequência vazia
     if (!isRunning || !bleGamepad.isConnected() || sequence.empty())
     {
-        if (state != MacroState::IDLE)
+        if (macroState != MacroState::IDLE)
         {
             // A biblioteca não tem releaseAll(), então liberamos os botões manualmente.
             // Para este projeto, apenas o botão atual estaria pressionado,
             // mas por segurança, podemos liberar todos os botões usados.
             for (const auto &step : sequence)
             {
-                bleGamepad.release(step.button);
+                if (step.button != MACRO_PAUSE_BUTTON)
+                    bleGamepad.release(step.button);
             }
-            state = MacroState::IDLE;
+            macroState = MacroState::IDLE;
             stepIndex = 0;
         }
         return;
     }
 
-    unsigned long now = millis();
-    MacroStep currentStep = sequence[stepIndex];
+    // The sequence may have been replaced (slot change or serial upload) while running
+    if (stepIndex >= (int)sequence.size())
+    {
+        stepIndex = 0;
+    }
+
+    unsigned long now = micros();
+    const MacroStep &currentStep = sequence[stepIndex];
 
-    switch (state)
+    // Deadlines are chained from the previous deadline, not from when the edge was
+    // actually sent, so loop jitter never accumulates over the cycle; only a late edge
+    // moves the timeline (reanchor_if_late).
+    switch (macroState)
     {
     case MacroState::IDLE:
-        // Inicia o primeiro passo
-        bleGamepad.press(currentStep.button);
-        state = MacroState::PRESSING;
-        stateStartTime = now;
+        // Inicia o primeiro passo; the metrics describe the current run only
+        joystickMetrics = {};
+        edgeDeadlineUs = now + sendLeadUs;
+        runFrameRateHz = frameRateHz;
+        frameAnchorUs = edgeDeadlineUs;
+        frameCursor = 0;
+        reanchor_if_late(send_edge(currentStep.button, true, edgeDeadlineUs));
+        macroState = MacroState::PRESSING;
+        advance_deadline(currentStep.duration, min_hold_frames(currentStep));
         break;
 
     case MacroState::PRESSING:
         // Verifica se o tempo de pressionamento já passou
-        if (now - stateStartTime >= currentStep.duration)
+        if (edge_due(now))
         {
-            bleGamepad.release(currentStep.button);
-            state = MacroState::WAITING_BETWEEN_STEPS;
-            stateStartTime = now;
+            reanchor_if_late(send_edge(currentStep.button, false, edgeDeadlineUs));
+            macroState = MacroState::WAITING_BETWEEN_STEPS;
+            advance_deadline(DELAY_BETWEEN_STEPS_MS, GAP_MIN_FRAMES);
         }
         break;
 
     case MacroState::WAITING_BETWEEN_STEPS:
         // Verifica se o tempo de espera entre os passos já passou
-        if (now - stateStartTime >= DELAY_BETWEEN_STEPS_MS)
+        if (edge_due(now))
         {
-            // Avança para o próximo passo
+            // Avança para o próximo passo e já o pressiona neste mesmo ciclo
             stepIndex++;
-            if (stepIndex >= sequence.size())
+            if (stepIndex >= (int)sequence.size())
             {
                 stepIndex = 0; // Reinicia a macro
             }
-            // Prepara para pressionar o próximo botão no próximo ciclo
-            state = MacroState::IDLE;
+            reanchor_if_late(send_edge(sequence[stepIndex].button, true, edgeDeadlineUs));
+            macroState = MacroState::PRESSING;
+            advance_deadline(sequence[stepIndex].duration, min_hold_frames(sequence[stepIndex]));
         }
         break;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,276 @@
+#include <functional>
+#include "MacroBlocks.h"
+#include "Storage.h"
+#include "config.h"
+
+constexpr char REF_LIST_MARK = '@'; // Legacy slot values start with a digit
+
+struct CachedBlock
+{
+    uint32_t id;
+    std::vector<MacroStep> steps;
+    uint32_t lastUse;
+};
+
+// --- Global objects ---
+std::vector<CachedBlock> blockCache;
+size_t cachedStepCount = 0;
+uint32_t blockUseClock = 0;
+MacroBlockMetrics blockMetrics = {};
+
+static String block_key(uint32_t id)
+{
+    char key[10];
+    snprintf(key, sizeof(key), "b%08x", (unsigned)id);
+    return key;
+}
+
+// FNV-1a over the stored text of a block
+static uint32_t text_hash(const String &text)
+{
+    uint32_t hash = 2166136261u;
+    for (unsigned int i = 0; i < text.length(); i++)
+    {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Decides the block boundaries, from the last two steps only
+static uint32_t boundary_hash(const MacroStep &previous, const MacroStep &step)
+{
+    uint32_t hash = (uint32_t)previous.button * 0x9E3779B1u ^ (uint32_t)previous.duration * 0x85EBCA77u;
+    hash ^= (uint32_t)step.button * 0xC2B2AE3Du ^ (uint32_t)step.duration * 0x27D4EB2Fu;
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+    return hash;
+}
+
+static bool same_steps(const std::vector<MacroStep> &a, const std::vector<MacroStep> &b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const MacroStep &x, const MacroStep &y)
+                                              { return x.button == y.button && x.duration == y.duration; });
+}
+
+static std::vector<uint32_t> parse_refs(const String &value)
+{
+    std::vector<uint32_t> ids;
+    if (value.length() == 0 || value[0] != REF_LIST_MARK)
+        return ids;
+    const char *p = value.c_str() + 1;
+    while (*p)
+    {
+        char *end;
+        uint32_t id = strtoul(p, &end, 16);
+        if (end == p)
+            break;
+        ids.push_back(id);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return ids;
+}
+
+static CachedBlock *cache_find(uint32_t id)
+{
+    for (auto &block : blockCache)
+    {
+        if (block.id == id)
+        {
+            block.lastUse = ++blockUseClock;
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+static void cache_insert(uint32_t id, const std::vector<MacroStep> &steps)
+{
+    while (!blockCache.empty() && cachedStepCount + steps.size() > MACRO_BLOCK_CACHE_STEPS)
+    {
+        auto oldest = std::min_element(blockCache.begin(), blockCache.end(), [](const CachedBlock &a, const CachedBlock &b)
+                                       { return a.lastUse < b.lastUse; });
+        cachedStepCount -= oldest->steps.size();
+        blockCache.erase(oldest);
+    }
+    blockCache.push_back({id, steps, ++blockUseClock});
+    cachedStepCount += steps.size();
+}
+
+static void cache_erase(uint32_t id)
+{
+    for (auto it = blockCache.begin(); it != blockCache.end(); ++it)
+    {
+        if (it->id == id)
+        {
+            cachedStepCount -= it->steps.size();
+            blockCache.erase(it);
+            return;
+        }
+    }
+}
+
+// Returns the id a block is stored under, queuing it for NVS if it is not there yet. The id
+// is the hash of its text, moved on by one past any other block that has the same hash.
+static uint32_t store_block(const std::vector<MacroStep> &steps)
+{
+    String text = macro_to_string(steps);
+    for (uint32_t id = text_hash(text);; id++)
+    {
+        CachedBlock *cached = cache_find(id);
+        if (cached)
+        {
+            if (!same_steps(cached->steps, steps))
+                continue;
+            blockMetrics.blocksShared++;
+            return id;
+        }
+
+        String stored = storage_get_string(PREFERENCES_NAMESPACE_BLOCKS, block_key(id).c_str(), "");
+        if (stored.length() > 0 && stored != text)
+            continue;
+        if (stored.length() == 0)
+        {
+            storage_put_string(PREFERENCES_NAMESPACE_BLOCKS, block_key(id).c_str(), text);
+            blockMetrics.blocksWritten++;
+        }
+        else
+        {
+            blockMetrics.blocksShared++;
+        }
+        cache_insert(id, steps);
+        return id;
+    }
+}
+
+// Calls cut(start, end) for each block of a macro, in order
+static void cut_blocks(const std::vector<MacroStep> &sequence, const std::function<void(size_t, size_t)> &cut)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < sequence.size(); i++)
+    {
+        size_t length = i + 1 - start;
+        bool boundary = length >= MACRO_BLOCK_MIN_STEPS && (boundary_hash(sequence[i - 1], sequence[i]) & MACRO_BLOCK_BOUNDARY_MASK) == 0;
+        if (boundary || length == MACRO_BLOCK_MAX_STEPS || i + 1 == sequence.size())
+        {
+            cut(start, i + 1);
+            start = i + 1;
+        }
+    }
+}
+
+String blocks_put(const std::vector<MacroStep> &sequence)
+{
+    String refs = String(REF_LIST_MARK);
+    cut_blocks(sequence, [&](size_t start, size_t end)
+               {
+                   std::vector<MacroStep> block(sequence.begin() + start, sequence.begin() + end);
+                   char id[10];
+                   snprintf(id, sizeof(id), start == 0 ? "%08x" : ",%08x", (unsigned)store_block(block));
+                   refs += id;
+               });
+    return refs;
+}
+
+size_t blocks_storage_bytes(const std::vector<MacroStep> &sequence)
+{
+    size_t bytes = 2; // REF_LIST_MARK and the terminator of the reference list
+    std::vector<String> texts;
+    cut_blocks(sequence, [&](size_t start, size_t end)
+               {
+                   bytes += start == 0 ? 8 : 9;
+                   String text = macro_to_string(std::vector<MacroStep>(sequence.begin() + start, sequence.begin() + end));
+                   if (std::find(texts.begin(), texts.end(), text) == texts.end())
+                   {
+                       bytes += text.length() + 1;
+                       texts.push_back(text);
+                   }
+               });
+    return bytes;
+}
+
+bool blocks_get(const String &slotValue, std::vector<MacroStep> &sequence)
+{
+    if (slotValue.length() == 0 || slotValue[0] != REF_LIST_MARK)
+    {
+        sequence = macro_parse(slotValue); // Saved by older firmware
+        return true;
+    }
+
+    sequence.clear();
+    for (uint32_t id : parse_refs(slotValue))
+    {
+        CachedBlock *cached = cache_find(id);
+        if (cached)
+        {
+            blockMetrics.cacheHits++;
+            sequence.insert(sequence.end(), cached->steps.begin(), cached->steps.end());
+            continue;
+        }
+
+        String text = storage_get_string(PREFERENCES_NAMESPACE_BLOCKS, block_key(id).c_str(), "");
+        if (text.length() == 0)
+            return false;
+        blockMetrics.cacheMisses++;
+        std::vector<MacroStep> steps = macro_parse(text);
+        sequence.insert(sequence.end(), steps.begin(), steps.end());
+        cache_insert(id, steps);
+    }
+    return true;
+}
+
+void blocks_release(const String &previousValue, const std::vector<String> &slotValues)
+{
+    std::vector<uint32_t> live;
+    for (const auto &value : slotValues)
+    {
+        std::vector<uint32_t> ids = parse_refs(value);
+        live.insert(live.end(), ids.begin(), ids.end());
+    }
+
+    for (uint32_t id : parse_refs(previousValue))
+    {
+        if (std::find(live.begin(), live.end(), id) != live.end())
+            continue;
+        live.push_back(id); // A block used twice by the old macro is deleted once
+        storage_remove(PREFERENCES_NAMESPACE_BLOCKS, block_key(id).c_str());
+        cache_erase(id);
+        blockMetrics.blocksCollected++;
+    }
+}
+
+void blocks_collect(const std::vector<String> &slotValues)
+{
+    std::vector<uint32_t> live;
+    for (const auto &value : slotValues)
+    {
+        std::vector<uint32_t> ids = parse_refs(value);
+        live.insert(live.end(), ids.begin(), ids.end());
+    }
+
+    for (const auto &key : storage_list_keys(PREFERENCES_NAMESPACE_BLOCKS))
+    {
+        char *end;
+        uint32_t id = strtoul(key.c_str() + 1, &end, 16);
+        if (key[0] == 'b' && *end == '\0' && std::find(live.begin(), live.end(), id) != live.end())
+            continue;
+        storage_remove(PREFERENCES_NAMESPACE_BLOCKS, key.c_str());
+        cache_erase(id);
+        blockMetrics.blocksCollected++;
+    }
+}
+
+MacroBlockMetrics blocks_get_metrics()
+{
+    MacroBlockMetrics metrics = blockMetrics;
+    metrics.cachedBlocks = blockCache.size();
+    metrics.cachedSteps = cachedStepCount;
+    return metrics;
+}
+
+void blocks_drop_cache()
+{
+    blockCache.clear();
+    cachedStepCount = 0;
+}
@@ -0,0 +1,105 @@
+#include "MacroOptimizer.h"
+#include "JoystickController.h"
+#include "MacroBlocks.h"
+#include "config.h"
+
+static bool is_pause(const MacroStep &step) { return step.button == MACRO_PAUSE_BUTTON; }
+
+// True when playing the step sends nothing the host can see
+static bool is_no_op(const MacroStep &step)
+{
+    return step.button < 1 || step.button > HID_BUTTON_COUNT || step.duration <= 0;
+}
+
+std::vector<MacroStep> macro_optimize(const std::vector<MacroStep> &sequence, MacroAnalysis &analysis, uint8_t frameRateHz)
+{
+    analysis = {};
+    analysis.frameRateHz = frameRateHz;
+    analysis.stepsIn = sequence.size();
+    uint32_t gapUs = joystick_gap_us(frameRateHz);
+    analysis.storageBytesIn = blocks_storage_bytes(sequence);
+
+    std::vector<MacroStep> optimized;
+    optimized.reserve(sequence.size());
+    for (MacroStep step : sequence)
+    {
+        if (step.duration < 0)
+            step.duration = 0;
+        if (!is_pause(step) && is_no_op(step))
+        {
+            // The gap after the step still elapses, so it stays as a pause of the same length
+            step.button = MACRO_PAUSE_BUTTON;
+            analysis.noOpSteps++;
+        }
+
+        if (!optimized.empty())
+        {
+            MacroStep &previous = optimized.back();
+            if (is_pause(previous) && is_pause(step))
+            {
+                // Keeps the cycle time: the gap between the two steps becomes part of the hold
+                previous.duration += DELAY_BETWEEN_STEPS_MS + step.duration;
+                analysis.mergedSteps++;
+                continue;
+            }
+        }
+        optimized.push_back(step);
+    }
+
+    uint64_t cycleUs = 0;
+    for (size_t i = 0; i < optimized.size(); i++)
+    {
+        const MacroStep &step = optimized[i];
+        uint32_t holdUs = joystick_hold_us(step, frameRateHz);
+        cycleUs += holdUs + gapUs;
+        if (is_pause(step))
+            continue;
+        analysis.reportsPerCycle += 2;
+        if (holdUs < HID_REPORT_INTERVAL_MS * 1000UL)
+            analysis.belowResolution.push_back(i);
+    }
+    analysis.cycleMs = (cycleUs + 500) / 1000;
+    bool anyPressSeen = analysis.belowResolution.size() < analysis.reportsPerCycle / 2;
+
+    analysis.stepsOut = optimized.size();
+    analysis.storageBytesOut = blocks_storage_bytes(optimized);
+    analysis.reportsPerSecond = cycleUs ? analysis.reportsPerCycle * 1000000.0f / cycleUs : 0;
+
+    if (optimized.empty())
+        analysis.rejection = "empty macro";
+    else if (optimized.size() > MACRO_MAX_STEPS)
+        analysis.rejection = "too many steps";
+    else if (analysis.reportsPerCycle == 0)
+        analysis.rejection = "macro never presses a button";
+    else if (!anyPressSeen)
+        analysis.rejection = "no press is held long enough for the host to see it";
+    return optimized;
+}
+
+String macro_analysis_to_json(const MacroAnalysis &analysis, const std::vector<MacroStep> &optimized)
+{
+    String json = "{";
+    json += "\"steps_in\":" + String((unsigned)analysis.stepsIn);
+    json += ",\"steps_out\":" + String((unsigned)analysis.stepsOut);
+    json += ",\"merged_steps\":" + String((unsigned)analysis.mergedSteps);
+    json += ",\"no_op_steps\":" + String((unsigned)analysis.noOpSteps);
+    json += ",\"below_resolution\":[";
+    for (size_t i = 0; i < analysis.belowResolution.size(); i++)
+    {
+        if (i > 0)
+            json += ",";
+        json += String((unsigned)analysis.belowResolution[i]);
+    }
+    json += "],\"resolution_ms\":" + String(HID_REPORT_INTERVAL_MS);
+    json += ",\"frame_hz\":" + String((unsigned)analysis.frameRateHz);
+    json += ",\"cycle_ms\":" + String((unsigned)analysis.cycleMs);
+    json += ",\"reports_per_cycle\":" + String((unsigned)analysis.reportsPerCycle);
+    json += ",\"reports_per_s\":" + String(analysis.reportsPerSecond, 2);
+    json += ",\"max_reports_per_s\":" + String(HID_MAX_REPORTS_PER_S);
+    json += ",\"storage_bytes_in\":" + String((unsigned)analysis.storageBytesIn);
+    json += ",\"storage_bytes_out\":" + String((unsigned)analysis.storageBytesOut);
+    json += ",\"rejection\":" + (analysis.rejection ? "\"" + String(analysis.rejection) + "\"" : String("null"));
+    json += ",\"optimized\":\"" + macro_to_string(optimized) + "\"";
+    json += "}";
+    return json;
+}
@@ -0,0 +1,148 @@
+#include "MacroStore.h"
+#include "JoystickController.h"
+#include "MacroBlocks.h"
+#include "MacroOptimizer.h"
+#include "Storage.h"
+#include "config.h"
+
+// --- Global objects ---
+std::vector<MacroStep> currentSequence; // Macro of the active slot (used by JoystickController)
+int currentSlot = 0;
+uint32_t sequenceRevision = 0; // Bumped on every change of currentSequence
+
+// Slot 0 keeps the original key so macros saved by older firmware are still found.
+static String slot_key(int slot)
+{
+    if (slot == 0)
+        return String(MACRO_KEY);
+    return String(MACRO_KEY) + String(slot);
+}
+
+static bool is_valid_slot(int slot) { return slot >= 0 && slot < MACRO_SLOT_COUNT; }
+
+// Stored value of every slot, queued writes included
+static std::vector<String> slot_values()
+{
+    std::vector<String> values;
+    for (int slot = 0; slot < MACRO_SLOT_COUNT; slot++)
+        values.push_back(storage_get_string(PREFERENCES_NAMESPACE_GENERAL, slot_key(slot).c_str(), ""));
+    return values;
+}
+
+// Loads the macro of a slot from NVS, through the block cache
+static std::vector<MacroStep> load_slot_from_flash(int slot)
+{
+    const char *defaultMacro = "1,200;2,200;"; // Default macro if none saved
+    String slotValue = storage_get_string(PREFERENCES_NAMESPACE_GENERAL, slot_key(slot).c_str(), defaultMacro);
+    std::vector<MacroStep> sequence;
+    if (!blocks_get(slotValue, sequence))
+    {
+        Serial.printf("Macro slot %d refers to a missing block, using the default macro\n", slot);
+        sequence = macro_parse(defaultMacro);
+    }
+    return sequence;
+}
+
+String macro_to_string(const std::vector<MacroStep> &sequence)
+{
+    String seqString = "";
+    for (const auto &step : sequence)
+    {
+        seqString += String(step.button) + "," + String(step.duration) + ";";
+    }
+    return seqString;
+}
+
+std::vector<MacroStep> macro_parse(const String &seqString)
+{
+    std::vector<MacroStep> sequence;
+    unsigned int last_idx = 0;
+    for (unsigned int i = 0; i < seqString.length(); i++)
+    {
+        if (seqString.charAt(i) == ';')
+        {
+            String stepStr = seqString.substring(last_idx, i);
+            int comma_idx = stepStr.indexOf(',');
+            if (comma_idx != -1)
+            {
+                int button = stepStr.substring(0, comma_idx).toInt();
+                int duration = stepStr.substring(comma_idx + 1).toInt();
+                sequence.push_back({button, duration});
+            }
+            last_idx = i + 1;
+        }
+    }
+    return sequence;
+}
+
+void macro_load()
+{
+    currentSlot = storage_get_uchar(PREFERENCES_NAMESPACE_GENERAL, ACTIVE_SLOT_KEY, 0);
+    if (!is_valid_slot(currentSlot))
+        currentSlot = 0;
+
+    currentSequence = load_slot_from_flash(currentSlot);
+    sequenceRevision++;
+    blocks_collect(slot_values()); // Left over by a power cut in the middle of a flush
+}
+
+const std::vector<MacroStep> &macro_get_sequence() { return currentSequence; }
+int macro_get_slot() { return currentSlot; }
+uint32_t macro_get_revision() { return sequenceRevision; }
+
+void macro_restore(int slot, const std::vector<MacroStep> &sequence)
+{
+    currentSlot = is_valid_slot(slot) ? slot : 0;
+    currentSequence = sequence;
+    sequenceRevision++;
+}
+
+bool macro_store(int slot, const std::vector<MacroStep> &sequence, MacroAnalysis *analysis)
+{
+    if (!is_valid_slot(slot))
+        return false;
+
+    MacroAnalysis result;
+    std::vector<MacroStep> optimized = macro_optimize(sequence, result, joystick_get_frame_rate());
+    if (analysis)
+        *analysis = result;
+    if (result.rejection)
+    {
+        Serial.printf("Macro rejected: %s\n", result.rejection);
+        return false;
+    }
+    Serial.printf("Macro optimized: %u -> %u steps, cycle %u ms, %.1f reports/s, %u steps under %d ms\n",
+                  (unsigned)result.stepsIn, (unsigned)result.stepsOut, (unsigned)result.cycleMs,
+                  result.reportsPerSecond, (unsigned)result.belowResolution.size(), HID_REPORT_INTERVAL_MS);
+
+    // Queued, flushed in the background. Blocks the old macro no longer shares with any
+    // slot are deleted in the same batch.
+    String previous = storage_get_string(PREFERENCES_NAMESPACE_GENERAL, slot_key(slot).c_str(), "");
+    String refs = blocks_put(optimized);
+    storage_put_string(PREFERENCES_NAMESPACE_GENERAL, slot_key(slot).c_str(), refs);
+    blocks_release(previous, slot_values());
+
+    if (slot == currentSlot)
+    {
+        currentSequence = optimized;
+        sequenceRevision++;
+    }
+    return true;
+}
+
+bool macro_select_slot(int slot, bool persist)
+{
+    if (!is_valid_slot(slot))
+        return false;
+    if (slot == currentSlot)
+        return true;
+
+    if (persist)
+        storage_put_uchar(PREFERENCES_NAMESPACE_GENERAL, ACTIVE_SLOT_KEY, slot);
+
+    currentSlot = slot;
+    currentSequence = load_slot_from_flash(slot);
+    sequenceRevision++;
+    Serial.printf("Selected macro slot %d (%u steps)\n", slot, (unsigned)currentSequence.size());
+    return true;
+}
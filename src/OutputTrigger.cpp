@@ -0,0 +1,158 @@
+#include <atomic>
+#include "OutputTrigger.h"
+#include "JoystickController.h"
+#include "config.h"
+
+// A rule fires when its byte of the output report starts to match (or, with equal = false,
+// starts to differ from) value under mask. Rules are edge-triggered, so a host that keeps
+// resending the same report does not restart the macro every time.
+struct OutputTriggerRule
+{
+    uint8_t byteIndex; // Byte of the output report to watch
+    uint8_t mask;
+    uint8_t value;
+    bool equal;
+    TriggerAction action;
+    uint8_t slot; // BRANCH target
+};
+
+constexpr OutputTriggerRule OUTPUT_TRIGGER_RULES[] = {
+    // Byte 0, rumble strength: play the macro while the host rumbles
+    {0, 0xFF, 0x00, false, TriggerAction::START, 0},
+    {0, 0xFF, 0x00, true, TriggerAction::STOP, 0},
+    // Byte 1, player LEDs (one bit per player): player N plays the macro of slot N - 1
+    {1, 0x0F, 0x01, true, TriggerAction::BRANCH, 0},
+    {1, 0x0F, 0x02, true, TriggerAction::BRANCH, 1},
+    {1, 0x0F, 0x04, true, TriggerAction::BRANCH, 2},
+    {1, 0x0F, 0x08, true, TriggerAction::BRANCH, 3},
+};
+constexpr size_t OUTPUT_TRIGGER_RULE_COUNT = sizeof(OUTPUT_TRIGGER_RULES) / sizeof(OUTPUT_TRIGGER_RULES[0]);
+
+static_assert((OUTPUT_TRIGGER_QUEUE_SIZE & (OUTPUT_TRIGGER_QUEUE_SIZE - 1)) == 0, "The trigger queue size must be a power of two");
+
+// --- Lock-free queue ---
+// The watcher task only writes queueHead, the loop task only writes queueTail; each side
+// publishes its slot with a release store and reads the other index with an acquire load.
+TriggerEvent triggerQueue[OUTPUT_TRIGGER_QUEUE_SIZE];
+std::atomic<uint32_t> queueHead{0};
+std::atomic<uint32_t> queueTail{0};
+
+// --- Producer state (watcher task) ---
+bool ruleMatched[OUTPUT_TRIGGER_RULE_COUNT]; // Match state of each rule on the previous report
+uint8_t outputReport[OUTPUT_REPORT_LENGTH];
+
+TaskHandle_t loopTask = nullptr;
+TaskHandle_t triggerTask = nullptr;
+TriggerMetrics triggerMetrics = {};
+
+static bool rule_matches(const OutputTriggerRule &rule, const uint8_t *report, size_t len)
+{
+    uint8_t byte = rule.byteIndex < len ? report[rule.byteIndex] : 0;
+    return ((byte & rule.mask) == rule.value) == rule.equal;
+}
+
+static bool push(const TriggerEvent &event)
+{
+    uint32_t head = queueHead.load(std::memory_order_relaxed);
+    if (head - queueTail.load(std::memory_order_acquire) == OUTPUT_TRIGGER_QUEUE_SIZE)
+        return false;
+    triggerQueue[head & (OUTPUT_TRIGGER_QUEUE_SIZE - 1)] = event;
+    queueHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+static void watcher_task(void *)
+{
+    for (;;)
+    {
+        trigger_poll();
+        vTaskDelay(pdMS_TO_TICKS(OUTPUT_TRIGGER_POLL_MS));
+    }
+}
+
+void trigger_init()
+{
+    // Rules that match an all-zero report are armed, so they do not fire before the host
+    // has written anything
+    uint8_t idle[OUTPUT_REPORT_LENGTH] = {};
+    for (size_t i = 0; i < OUTPUT_TRIGGER_RULE_COUNT; i++)
+        ruleMatched[i] = rule_matches(OUTPUT_TRIGGER_RULES[i], idle, sizeof(idle));
+
+    loopTask = xTaskGetCurrentTaskHandle(); // setup() and loop() share the Arduino loop task
+    xTaskCreatePinnedToCore(watcher_task, "trigger", 2048, nullptr, 2, &triggerTask, tskNO_AFFINITY);
+}
+
+void trigger_poll()
+{
+    if (joystick_take_output_report(outputReport, sizeof(outputReport)))
+        trigger_on_output_report(outputReport, sizeof(outputReport));
+}
+
+void trigger_on_output_report(const uint8_t *report, size_t len)
+{
+    uint32_t now = micros();
+    bool queued = false;
+    triggerMetrics.reports++;
+    for (size_t i = 0; i < OUTPUT_TRIGGER_RULE_COUNT; i++)
+    {
+        const OutputTriggerRule &rule = OUTPUT_TRIGGER_RULES[i];
+        bool matched = rule_matches(rule, report, len);
+        bool fired = matched && !ruleMatched[i];
+        ruleMatched[i] = matched;
+        if (!fired)
+            continue;
+
+        if (push({now, rule.action, rule.slot}))
+        {
+            triggerMetrics.events++;
+            queued = true;
+        }
+        else
+        {
+            triggerMetrics.dropped++;
+        }
+    }
+    if (queued)
+        xTaskNotifyGive(loopTask); // Ends trigger_wait_us() early
+}
+
+bool trigger_take(TriggerEvent &event)
+{
+    uint32_t tail = queueTail.load(std::memory_order_relaxed);
+    if (tail == queueHead.load(std::memory_order_acquire))
+        return false;
+    event = triggerQueue[tail & (OUTPUT_TRIGGER_QUEUE_SIZE - 1)];
+    queueTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void trigger_record_reaction(uint32_t receivedUs)
+{
+    uint32_t latency = micros() - receivedUs;
+    triggerMetrics.reactions++;
+    triggerMetrics.lastLatencyUs = latency;
+    triggerMetrics.latencySumUs += latency;
+    if (latency > triggerMetrics.maxLatencyUs)
+        triggerMetrics.maxLatencyUs = latency;
+}
+
+// A wait rounded up to the tick makes an edge due inside the last tick go out at its end
+static_assert(portTICK_PERIOD_MS * 1000 <= HID_TIMING_TOLERANCE_US, "An RTOS tick must be within the HID timing tolerance");
+
+void trigger_wait_us(unsigned long waitUs)
+{
+    // Whole ticks only: a notification can end any of them, a busy-wait for the remainder
+    // could not be woken
+    const unsigned long tickUs = portTICK_PERIOD_MS * 1000;
+    ulTaskNotifyTake(pdTRUE, (waitUs + tickUs - 1) / tickUs);
+}
+
+TriggerMetrics trigger_get_metrics() { return triggerMetrics; }
+
+void trigger_print_metrics(Print &out)
+{
+    const TriggerMetrics &m = triggerMetrics;
+    out.printf("Output triggers: %u reports, %u actions (%u dropped), reaction last %u us / mean %u us / max %u us\n",
+               (unsigned)m.reports, (unsigned)m.events, (unsigned)m.dropped, (unsigned)m.lastLatencyUs,
+               (unsigned)(m.reactions ? m.latencySumUs / m.reactions : 0), (unsigned)m.maxLatencyUs);
+}
@@ -0,0 +1,283 @@
+#include "SerialLink.h"
+#include "FleetSync.h"
+#include "MacroStore.h"
+#include "JoystickController.h"
+#include "config.h"
+
+// --- Frame buffers ---
+constexpr size_t SERIAL_MAX_ENCODED = SERIAL_MAX_FRAME + SERIAL_MAX_FRAME / 254 + 2;
+uint8_t rxEncoded[SERIAL_MAX_ENCODED];
+size_t rxLength = 0;
+bool rxOverflow = false; // Drop bytes until the next delimiter
+
+// --- Link state ---
+uint8_t expectedSeq = 0;
+bool ackPending = false;
+
+// --- Upload state ---
+int uploadSlot = -1; // -1 = no upload in progress
+size_t uploadCount = 0;
+std::vector<MacroStep> uploadSteps;
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+static uint16_t crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+// Returns the decoded length, or 0 if the input is not valid COBS or decodes to more
+// than outSize bytes.
+static size_t cobs_decode(const uint8_t *in, size_t len, uint8_t *out, size_t outSize)
+{
+    size_t r = 0, w = 0;
+    while (r < len)
+    {
+        uint8_t code = in[r++];
+        if (code == 0)
+            return 0;
+        for (uint8_t i = 1; i < code; i++)
+        {
+            if (r >= len || w >= outSize)
+                return 0;
+            out[w++] = in[r++];
+        }
+        if (code < 0xFF && r < len)
+        {
+            if (w >= outSize)
+                return 0;
+            out[w++] = 0;
+        }
+    }
+    return w;
+}
+
+static size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t w = 1, codeIdx = 0;
+    uint8_t code = 1;
+    for (size_t r = 0; r < len; r++)
+    {
+        if (in[r] == 0)
+        {
+            out[codeIdx] = code;
+            code = 1;
+            codeIdx = w++;
+            continue;
+        }
+        out[w++] = in[r];
+        if (++code == 0xFF)
+        {
+            out[codeIdx] = code;
+            code = 1;
+            codeIdx = w++;
+        }
+    }
+    out[codeIdx] = code;
+    return w;
+}
+
+static uint16_t read_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static void send_frame(uint8_t type, uint8_t seq, uint8_t status)
+{
+    uint8_t frame[5] = {type, seq, status, 0, 0};
+    uint16_t crc = crc16(frame, 3);
+    frame[3] = crc & 0xFF;
+    frame[4] = crc >> 8;
+
+    uint8_t encoded[8];
+    size_t n = cobs_encode(frame, sizeof(frame), encoded);
+    // Leading delimiter separates the frame from any log text printed before it
+    Serial.write((uint8_t)0);
+    Serial.write(encoded, n);
+    Serial.write((uint8_t)0);
+}
+
+static uint8_t handle_upload_data(const uint8_t *payload, size_t len)
+{
+    if (len < 2 || (len - 2) % 3 != 0)
+        return STATUS_BAD_LENGTH;
+    if (uploadSlot < 0)
+        return STATUS_BAD_STATE;
+
+    size_t offset = read_u16(payload);
+    size_t count = (len - 2) / 3;
+    if (offset != uploadSteps.size() || offset + count > uploadCount)
+        return STATUS_BAD_OFFSET;
+
+    for (const uint8_t *p = payload + 2; count > 0; count--, p += 3)
+    {
+        uploadSteps.push_back({p[0], read_u16(p + 1)});
+    }
+    return STATUS_OK;
+}
+
+static uint8_t handle_frame(uint8_t type, const uint8_t *payload, size_t len, SerialCommand &command)
+{
+    switch (type)
+    {
+    case FRAME_PING:
+        return STATUS_OK;
+
+    case FRAME_UPLOAD_BEGIN:
+    {
+        if (len != 3)
+            return STATUS_BAD_LENGTH;
+        int slot = payload[0];
+        size_t count = read_u16(payload + 1);
+        if (slot >= MACRO_SLOT_COUNT)
+            return STATUS_BAD_SLOT;
+        if (count == 0 || count > MACRO_MAX_STEPS)
+            return STATUS_EMPTY;
+        uploadSlot = slot;
+        uploadCount = count;
+        uploadSteps.clear();
+        uploadSteps.reserve(count);
+        return STATUS_OK;
+    }
+
+    case FRAME_UPLOAD_DATA:
+        return handle_upload_data(payload, len);
+
+    case FRAME_UPLOAD_COMMIT:
+    {
+        if (uploadSlot < 0 || uploadSteps.size() != uploadCount)
+            return STATUS_BAD_STATE;
+        bool stored = macro_store(uploadSlot, uploadSteps); // Logs the analysis
+        Serial.printf("Serial upload: %u steps into slot %d\n", (unsigned)uploadSteps.size(), uploadSlot);
+        uploadSlot = -1;
+        uploadSteps.clear();
+        return stored ? STATUS_OK : STATUS_REJECTED;
+    }
+
+    case FRAME_SELECT_SLOT:
+        if (len != 1)
+            return STATUS_BAD_LENGTH;
+        return macro_select_slot(payload[0]) ? STATUS_OK : STATUS_BAD_SLOT;
+
+    case FRAME_START:
+        command = SerialCommand::START;
+        return STATUS_OK;
+
+    case FRAME_STOP:
+        command = SerialCommand::STOP;
+        return STATUS_OK;
+
+    case FRAME_BUTTON:
+        if (len != 2)
+            return STATUS_BAD_LENGTH;
+        if (payload[1])
+            joystick_press(payload[0]);
+        else
+            joystick_release(payload[0]);
+        return STATUS_OK;
+
+    case FRAME_FRAME_RATE:
+        if (len != 1)
+            return STATUS_BAD_LENGTH;
+        return joystick_set_frame_rate(payload[0]) ? STATUS_OK : STATUS_REJECTED;
+
+    case FRAME_FLEET_KEY:
+        if constexpr (FEATURE_WEB_PORTAL)
+        {
+            if (len != FLEET_KEY_BYTES)
+                return STATUS_BAD_LENGTH;
+            fleet_set_key(payload);
+            Serial.println("Serial: fleet key set");
+            return STATUS_OK;
+        }
+        else
+        {
+            return STATUS_UNKNOWN_TYPE; // No Wi-Fi in this build, so no fleet
+        }
+
+    default:
+        return STATUS_UNKNOWN_TYPE;
+    }
+}
+
+static void process_frame(SerialCommand &command)
+{
+    uint8_t frame[SERIAL_MAX_FRAME];
+    size_t len = cobs_decode(rxEncoded, rxLength, frame, sizeof(frame));
+    if (len < 4)
+        return; // Too short, or log text from the host side of a shared line
+    if (crc16(frame, len - 2) != read_u16(frame + len - 2))
+        return; // Corrupt: the host will retransmit after its timeout
+
+    uint8_t type = frame[0];
+    uint8_t seq = frame[1];
+
+    if (type == FRAME_SYNC)
+    {
+        expectedSeq = seq + 1;
+        uploadSlot = -1;
+        ackPending = true;
+        return;
+    }
+
+    if (seq != expectedSeq)
+    {
+        // Duplicate or ahead of a lost frame: re-acknowledge the last in-order frame
+        ackPending = true;
+        return;
+    }
+
+    expectedSeq++;
+    uint8_t status = handle_frame(type, frame + 2, len - 4, command);
+    if (status != STATUS_OK)
+    {
+        send_frame(FRAME_NAK, seq, status);
+        ackPending = false; // The NAK also acknowledges everything up to seq
+    }
+    else
+    {
+        ackPending = true;
+    }
+}
+
+void serial_init()
+{
+    Serial.setRxBufferSize(SERIAL_RX_BUFFER); // Must be called before begin()
+    Serial.begin(SERIAL_BAUD);
+}
+
+SerialCommand serial_loop()
+{
+    SerialCommand command = SerialCommand::NONE;
+
+    while (Serial.available() > 0)
+    {
+        uint8_t c = Serial.read();
+        if (c == 0)
+        {
+            if (!rxOverflow && rxLength > 0)
+                process_frame(command);
+            rxLength = 0;
+            rxOverflow = false;
+        }
+        else if (rxLength < sizeof(rxEncoded))
+        {
+            rxEncoded[rxLength++] = c;
+        }
+        else
+        {
+            rxOverflow = true;
+        }
+    }
+
+    // One cumulative ACK per pass instead of one per frame
+    if (ackPending)
+    {
+        send_frame(FRAME_ACK, expectedSeq - 1, STATUS_OK);
+        ackPending = false;
+    }
+    return command;
+}
@@ -0,0 +1,361 @@
+#include <Preferences.h>
+#include <esp_system.h>
+#include <nvs.h>
+#include "Storage.h"
+#include "config.h"
+
+enum class StoredType : uint8_t
+{
+    STRING,
+    UCHAR,
+    REMOVED // Key is erased at the flush; reads see the default until then
+};
+
+struct PendingWrite
+{
+    String ns;
+    String key;
+    StoredType type;
+    String text;
+    uint8_t byteValue;
+};
+
+struct WearCounter
+{
+    String key;
+    bool loaded;        // saved has been read from PREFERENCES_NAMESPACE_WEAR
+    uint32_t saved;     // Lifetime flash writes as last saved
+    uint32_t unsaved;   // Flash writes since then; lifetime is saved + unsaved
+    uint32_t session;   // Flash writes since boot
+    uint32_t coalesced; // Writes absorbed by a newer value before reaching flash
+};
+
+// --- Global objects ---
+std::vector<PendingWrite> pendingWrites; // In queue order; one entry per ns/key
+std::vector<WearCounter> wearCounters;
+unsigned long firstPendingAt = 0;
+unsigned long lastPendingAt = 0;
+unsigned long lastWearSaveAt = 0;
+
+SemaphoreHandle_t queueMutex = nullptr; // Guards pendingWrites and wearCounters
+SemaphoreHandle_t flushMutex = nullptr; // Serializes flushes and NVS reads (shared Preferences object)
+TaskHandle_t storageTask = nullptr;
+
+Preferences storagePreferences;
+
+// Caller holds queueMutex
+static WearCounter &find_counter(const String &key)
+{
+    for (auto &counter : wearCounters)
+    {
+        if (counter.key == key)
+            return counter;
+    }
+    wearCounters.push_back({key, false, 0, 0, 0, 0});
+    return wearCounters.back();
+}
+
+// Macro blocks are content-addressed, so each key is written once and deleted once: no
+// counter to keep, and none left behind in flash after the block is gone
+static bool tracks_wear(const char *ns) { return strcmp(ns, PREFERENCES_NAMESPACE_BLOCKS) != 0; }
+
+// Caller holds queueMutex
+static PendingWrite *find_pending(const char *ns, const char *key)
+{
+    for (auto &write : pendingWrites)
+    {
+        if (write.key == key && write.ns == ns)
+            return &write;
+    }
+    return nullptr;
+}
+
+static void enqueue(const PendingWrite &write)
+{
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    PendingWrite *existing = find_pending(write.ns.c_str(), write.key.c_str());
+    bool tracked = tracks_wear(write.ns.c_str());
+    if (existing)
+    {
+        // Coalesce: only the newest value reaches flash, and at the position of the newest
+        // write. Callers order dependent writes (a macro's blocks before the slot that refers
+        // to them), so a power cut between two flash writes never leaves a reference to
+        // something not written yet; keeping the first write's position could. The flush
+        // erases last for the writes this moves past.
+        pendingWrites.erase(pendingWrites.begin() + (existing - pendingWrites.data()));
+        pendingWrites.push_back(write);
+        if (tracked)
+            find_counter(write.key).coalesced++;
+    }
+    else
+    {
+        if (pendingWrites.empty())
+            firstPendingAt = millis();
+        pendingWrites.push_back(write);
+        if (tracked)
+            find_counter(write.key);
+    }
+    lastPendingAt = millis();
+    xSemaphoreGive(queueMutex);
+
+    xTaskNotifyGive(storageTask);
+}
+
+// Flush task: sleeps until something is queued, then waits for the writes to go idle.
+static void storage_task(void *)
+{
+    for (;;)
+    {
+        xSemaphoreTake(queueMutex, portMAX_DELAY);
+        bool empty = pendingWrites.empty();
+        unsigned long now = millis();
+        bool due = !empty && (now - lastPendingAt >= STORAGE_IDLE_FLUSH_MS || now - firstPendingAt >= STORAGE_MAX_DELAY_MS);
+        xSemaphoreGive(queueMutex);
+
+        if (due)
+            storage_flush();
+        else
+            ulTaskNotifyTake(pdTRUE, empty ? portMAX_DELAY : pdMS_TO_TICKS(STORAGE_IDLE_FLUSH_MS));
+    }
+}
+
+// Caller holds flushMutex. Writes the counters of the keys flushed since the last save, one
+// u32 each. Flash I/O stays outside queueMutex so that writers are never stalled behind it.
+static void save_wear()
+{
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    std::vector<String> keys;
+    for (const auto &counter : wearCounters)
+    {
+        if (counter.unsaved > 0)
+            keys.push_back(counter.key);
+    }
+    xSemaphoreGive(queueMutex);
+    lastWearSaveAt = millis();
+    if (keys.empty())
+        return;
+
+    storagePreferences.begin(PREFERENCES_NAMESPACE_WEAR, false);
+    for (const auto &key : keys)
+    {
+        uint32_t stored = storagePreferences.getUInt(key.c_str(), 0);
+
+        xSemaphoreTake(queueMutex, portMAX_DELAY);
+        WearCounter &counter = find_counter(key);
+        if (!counter.loaded)
+        {
+            counter.saved = stored;
+            counter.loaded = true;
+        }
+        counter.saved += counter.unsaved;
+        counter.unsaved = 0;
+        uint32_t lifetime = counter.saved;
+        xSemaphoreGive(queueMutex);
+
+        storagePreferences.putUInt(key.c_str(), lifetime);
+    }
+    storagePreferences.end();
+}
+
+// Runs inside ESP.restart(): the queue, then the wear counters
+static void storage_shutdown()
+{
+    storage_flush();
+    xSemaphoreTake(flushMutex, portMAX_DELAY);
+    save_wear();
+    xSemaphoreGive(flushMutex);
+}
+
+void storage_init()
+{
+    queueMutex = xSemaphoreCreateMutex();
+    flushMutex = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(storage_task, "storage", 4096, nullptr, 1, &storageTask, tskNO_AFFINITY);
+    esp_register_shutdown_handler(storage_shutdown);
+}
+
+String storage_get_string(const char *ns, const char *key, const String &defaultValue)
+{
+    xSemaphoreTake(flushMutex, portMAX_DELAY);
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    PendingWrite *pending = find_pending(ns, key);
+    if (tracks_wear(ns))
+        find_counter(key); // Every key in use shows up in the wear report
+    String value = !pending ? String() : pending->type == StoredType::REMOVED ? defaultValue : pending->text;
+    xSemaphoreGive(queueMutex);
+
+    if (!pending)
+    {
+        storagePreferences.begin(ns, true); // read-only
+        value = storagePreferences.getString(key, defaultValue);
+        storagePreferences.end();
+    }
+    xSemaphoreGive(flushMutex);
+    return value;
+}
+
+uint8_t storage_get_uchar(const char *ns, const char *key, uint8_t defaultValue)
+{
+    xSemaphoreTake(flushMutex, portMAX_DELAY);
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    PendingWrite *pending = find_pending(ns, key);
+    if (tracks_wear(ns))
+        find_counter(key);
+    uint8_t value = pending && pending->type == StoredType::UCHAR ? pending->byteValue : defaultValue;
+    xSemaphoreGive(queueMutex);
+
+    if (!pending)
+    {
+        storagePreferences.begin(ns, true);
+        value = storagePreferences.getUChar(key, defaultValue);
+        storagePreferences.end();
+    }
+    xSemaphoreGive(flushMutex);
+    return value;
+}
+
+std::vector<String> storage_list_keys(const char *ns)
+{
+    xSemaphoreTake(flushMutex, portMAX_DELAY);
+    std::vector<String> keys;
+    for (nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, ns, NVS_TYPE_ANY); it; it = nvs_entry_next(it))
+    {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        keys.push_back(info.key);
+    }
+
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    for (const auto &write : pendingWrites)
+    {
+        if (write.ns != ns)
+            continue;
+        auto found = std::find(keys.begin(), keys.end(), write.key);
+        if (write.type == StoredType::REMOVED && found != keys.end())
+            keys.erase(found);
+        else if (write.type != StoredType::REMOVED && found == keys.end())
+            keys.push_back(write.key);
+    }
+    xSemaphoreGive(queueMutex);
+    xSemaphoreGive(flushMutex);
+    return keys;
+}
+
+void storage_put_string(const char *ns, const char *key, const String &value)
+{
+    enqueue({ns, key, StoredType::STRING, value, 0});
+}
+
+void storage_put_uchar(const char *ns, const char *key, uint8_t value)
+{
+    enqueue({ns, key, StoredType::UCHAR, String(), value});
+}
+
+void storage_remove(const char *ns, const char *key)
+{
+    enqueue({ns, key, StoredType::REMOVED, String(), 0});
+}
+
+void storage_flush()
+{
+    xSemaphoreTake(flushMutex, portMAX_DELAY); // Readers wait here until the batch is in flash
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    std::vector<PendingWrite> batch;
+    batch.swap(pendingWrites);
+    xSemaphoreGive(queueMutex);
+
+    if (batch.empty())
+    {
+        xSemaphoreGive(flushMutex);
+        return;
+    }
+
+    unsigned long start = millis();
+    String openNs = "";
+    // Values first, then erases. A coalesced value moves past erases queued after its older
+    // value, and those erases may only be safe once the older value is gone (a block its
+    // slot no longer refers to): erasing last keeps every point of the batch consistent.
+    for (bool erases : {false, true})
+    {
+        for (const auto &write : batch)
+        {
+            if ((write.type == StoredType::REMOVED) != erases)
+                continue;
+            // Queue order is kept, so consecutive keys of one namespace share a begin/end
+            if (write.ns != openNs)
+            {
+                if (openNs.length() > 0)
+                    storagePreferences.end();
+                storagePreferences.begin(write.ns.c_str(), false); // read-write
+                openNs = write.ns;
+            }
+            if (write.type == StoredType::STRING)
+                storagePreferences.putString(write.key.c_str(), write.text);
+            else if (write.type == StoredType::UCHAR)
+                storagePreferences.putUChar(write.key.c_str(), write.byteValue);
+            else
+                storagePreferences.remove(write.key.c_str());
+        }
+    }
+    storagePreferences.end();
+
+    // Wear is counted in RAM: writing a counter next to every value would double the flash
+    // writes this queue saves. The counters reach flash together, at most every
+    // STORAGE_WEAR_SAVE_MS and at shutdown.
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    for (const auto &write : batch)
+    {
+        if (!tracks_wear(write.ns.c_str()))
+            continue;
+        WearCounter &counter = find_counter(write.key);
+        counter.unsaved++;
+        counter.session++;
+    }
+    xSemaphoreGive(queueMutex);
+    if (millis() - lastWearSaveAt >= STORAGE_WEAR_SAVE_MS)
+        save_wear();
+
+    Serial.printf("NVS flush: %u keys in %lu ms\n", (unsigned)batch.size(), millis() - start);
+    xSemaphoreGive(flushMutex);
+}
+
+uint32_t storage_write_count(const char *key)
+{
+    xSemaphoreTake(flushMutex, portMAX_DELAY);
+    storagePreferences.begin(PREFERENCES_NAMESPACE_WEAR, true);
+    uint32_t stored = storagePreferences.getUInt(key, 0);
+    storagePreferences.end();
+
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    WearCounter &counter = find_counter(key);
+    if (!counter.loaded)
+    {
+        counter.saved = stored;
+        counter.loaded = true;
+    }
+    uint32_t lifetime = counter.saved + counter.unsaved;
+    xSemaphoreGive(queueMutex);
+    xSemaphoreGive(flushMutex);
+    return lifetime;
+}
+
+void storage_print_wear(Print &out)
+{
+    // Touch every counter first so that lifetimes are loaded
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    std::vector<String> keys;
+    for (const auto &counter : wearCounters)
+        keys.push_back(counter.key);
+    xSemaphoreGive(queueMutex);
+    for (const auto &key : keys)
+        storage_write_count(key.c_str());
+
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    out.println("NVS wear (key: lifetime / this boot / coalesced):");
+    for (const auto &counter : wearCounters)
+    {
+        out.printf("  %s: %u / %u / %u\n", counter.key.c_str(), (unsigned)(counter.saved + counter.unsaved), (unsigned)counter.session,
+                   (unsigned)counter.coalesced);
+    }
+    xSemaphoreGive(queueMutex);
+}
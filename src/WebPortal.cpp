@@ -1,18 +1,16 @@
 #include <WiFi.h>
-#include <WebServer.h>
 #include <DNSServer.h>
-#include <Preferences.h> // Keep this for NVS access
 #include "WebPortal.h"
+#include "HttpServer.h"
+#include "MacroStore.h"
+#include "MacroOptimizer.h"
+#include "JoystickController.h"
+#include "Storage.h"
 #include "config.h"
 
 // --- Global objects ---
 DNSServer dnsServer;
-WebServer server(80);
-std::vector<MacroStep> currentSequence; // Macro definition (managed by WebPortal, used by JoystickController)
-
-// --- Preferences instances ---
-Preferences macroPreferences; // For macro storage
-Preferences wifiPreferences;  // For Wi-Fi STA credentials storage
+HttpServer server(HTTP_PORT);
 
 // --- Wi-Fi Station Variables ---
 String saved_ssid = "";
@@ -22,62 +20,19 @@ bool is_sta_connected = false;  // Tracks if ESP is successfully connected to an
 
 // --- HELPER FUNCTIONS FOR NVS (Preferences) ---
 
-// Saves the macro sequence to NVS
-void save_sequence_to_flash(const std::vector<MacroStep> &seq)
-{
-    String seqString = "";
-    for (const auto &step : seq)
-    {
-        seqString += String(step.button) + "," + String(step.duration) + ";";
-    }
-    macroPreferences.begin(PREFERENCES_NAMESPACE_GENERAL, false); // false = read-write
-    macroPreferences.putString(MACRO_KEY, seqString);
-    macroPreferences.end();
-}
-
-// Loads the macro sequence from NVS
-void load_sequence_from_flash()
-{
-    currentSequence.clear();
-    macroPreferences.begin(PREFERENCES_NAMESPACE_GENERAL, true);              // true = read-only
-    String seqString = macroPreferences.getString(MACRO_KEY, "1,200;2,200;"); // Default macro if none saved
-    macroPreferences.end();
-
-    int last_idx = 0;
-    for (int i = 0; i < seqString.length(); i++)
-    {
-        if (seqString.charAt(i) == ';')
-        {
-            String stepStr = seqString.substring(last_idx, i);
-            int comma_idx = stepStr.indexOf(',');
-            if (comma_idx != -1)
-            {
-                int button = stepStr.substring(0, comma_idx).toInt();
-                int duration = stepStr.substring(comma_idx + 1).toInt();
-                currentSequence.push_back({button, duration});
-            }
-            last_idx = i + 1;
-        }
-    }
-}
-
 // Loads saved STA Wi-Fi credentials from NVS
 void load_station_credentials()
 {
-    wifiPreferences.begin(PREFERENCES_NAMESPACE_WIFI, true); // read-only
-    saved_ssid = wifiPreferences.getString(WIFI_SSID_KEY, "");
-    saved_password = wifiPreferences.getString(WIFI_PASS_KEY, "");
-    wifiPreferences.end();
+    saved_ssid = storage_get_string(PREFERENCES_NAMESPACE_WIFI, WIFI_SSID_KEY, "");
+    saved_password = storage_get_string(PREFERENCES_NAMESPACE_WIFI, WIFI_PASS_KEY, "");
     Serial.printf("Loaded Wi-Fi: SSID='%s', Pass='%s'\n", saved_ssid.c_str(), saved_password.c_str());
 }
 
 // Saves STA Wi-Fi credentials to NVS
 void save_station_credentials(const String &ssid, const String &password)
 {
-    wifiPreferences.begin(PREFERENCES_NAMESPACE_WIFI, false); // read-write
-    wifiPreferences.putString(WIFI_SSID_KEY, ssid);
-    wifiPreferences.putString(WIFI_PASS_KEY, password);
-    wifiPreferences.end();
+    storage_put_string(PREFERENCES_NAMESPACE_WIFI, WIFI_SSID_KEY, ssid);
+    storage_put_string(PREFERENCES_NAMESPACE_WIFI, WIFI_PASS_KEY, password);
     saved_ssid = ssid;
     saved_password = password;
     Serial.printf("Saved Wi-Fi: SSID='%s', Pass='%s'\n", saved_ssid.c_str(), saved_password.c_str());
@@ -140,6 +95,17 @@ const char index_html[] PROGMEM = R"rawliteral(
             <p id="empty-macro-msg">The macro is empty. Add steps above.</p>
         </div>
         
+        <div class="card">
+            <h2>3. Timing</h2>
+            <label for="frame-rate">Sync edges to game frames:</label>
+            <select id="frame-rate">
+                <option value="0">Off (millisecond timing)</option>
+                <option value="30">30 Hz</option>
+                <option value="60">60 Hz</option>
+                <option value="120">120 Hz</option>
+            </select>
+        </div>
+
         <form id="save-form" class="main-form">
             <button class="btn" type="submit">Save Macro & Restart</button>
         </form>
@@ -160,6 +126,7 @@ const char index_html[] PROGMEM = R"rawliteral(
         const sequenceList = document.getElementById('sequence-list');
         const emptyMacroMsg = document.getElementById('empty-macro-msg');
         const saveForm = document.getElementById('save-form');
+        const frameRateSelect = document.getElementById('frame-rate');
 
         // --- EVENT LISTENERS & INITIALIZATION ---
 
@@ -216,8 +183,9 @@ const char index_html[] PROGMEM = R"rawliteral(
             btn.textContent = "Saving...";
             btn.disabled = true;
 
-            const formData = new FormData();
+            const formData = new URLSearchParams();
             formData.append("seq", payload);
+            formData.append("frame_hz", frameRateSelect.value);
 
             // Send the data to the server
             fetch('/save', {
@@ -237,7 +205,10 @@ const char index_html[] PROGMEM = R"rawliteral(
                         </div>
                     `;
                 } else {
-                    alert("Error: Could not save macro.");
+                    // 400 carries the analysis of a rejected macro
+                    response.json()
+                        .then(analysis => alert(`Macro rejected: ${analysis.rejection}.`))
+                        .catch(() => alert("Error: Could not save macro."));
                     btn.textContent = originalText;
                     btn.disabled = false;
                 }
@@ -293,6 +264,10 @@ const char index_html[] PROGMEM = R"rawliteral(
                     }
                 })
                 .catch(error => console.error('Error loading initial macro:', error));
+            fetch('/frame_rate')
+                .then(response => response.text())
+                .then(hz => frameRateSelect.value = hz)
+                .catch(error => console.error('Error loading frame rate:', error));
         });
     </script>
 </body>
@@ -430,7 +405,7 @@ const char wifi_config_html[] PROGMEM = R"rawliteral(
             connectBtn.disabled = true;
             scanBtn.disabled = true; // Disable scan during connection attempt
 
-            const formData = new FormData();
+            const formData = new URLSearchParams();
             formData.append('ssid', ssid);
             formData.append('password', password);
 
@@ -482,56 +457,125 @@ const char wifi_config_html[] PROGMEM = R"rawliteral(
 </html>
 )rawliteral";
 
+// --- Captive-portal probes ---
+// While a phone or laptop joins the AP, its OS keeps fetching a few well-known URLs to find
+// out whether it is online. Each used to fall through to onNotFound and pull the whole
+// index_html over the soft-AP. Probes now get an empty 302, 204 or 404 on their keep-alive
+// connection. Every probe is answered, repeats included: Windows follows connecttest.txt
+// with /redirect and iOS reloads hotspot-detect.html, and the portal only opens once those
+// are answered.
+enum class ProbeReply : uint8_t
+{
+    REDIRECT,   // 302 to the portal: makes the OS open its captive-portal browser
+    NO_CONTENT, // 204, for requests browsers make on their own
+    NOT_FOUND   // 404 without a body, for proxy auto-discovery
+};
+
+struct CaptiveProbe
+{
+    const char *path;
+    ProbeReply reply;
+};
+
+const CaptiveProbe CAPTIVE_PROBES[] = {
+    {"/generate_204", ProbeReply::REDIRECT},              // Android, ChromeOS
+    {"/gen_204", ProbeReply::REDIRECT},                   // Android
+    {"/hotspot-detect.html", ProbeReply::REDIRECT},       // iOS, macOS
+    {"/library/test/success.html", ProbeReply::REDIRECT}, // Older iOS
+    {"/ncsi.txt", ProbeReply::REDIRECT},                  // Windows
+    {"/connecttest.txt", ProbeReply::REDIRECT},           // Windows 10 and later
+    {"/redirect", ProbeReply::REDIRECT},                  // Windows, after connecttest.txt
+    {"/canonical.html", ProbeReply::REDIRECT},            // Firefox
+    {"/success.txt", ProbeReply::REDIRECT},               // Firefox
+    {"/favicon.ico", ProbeReply::NO_CONTENT},
+    {"/wpad.dat", ProbeReply::NOT_FOUND},
+};
+
+String portalUrl = ""; // Built in web_init() once the AP address is known
+uint32_t probesAnswered = 0;
+
+// Answers the request if it is a captive-portal probe
+static bool handle_probe()
+{
+    String uri = server.uri();
+    for (const auto &probe : CAPTIVE_PROBES)
+    {
+        if (uri != probe.path)
+            continue;
+
+        if (probe.reply == ProbeReply::REDIRECT)
+        {
+            server.sendHeader("Location", portalUrl);
+            server.send(302, "text/plain", "");
+        }
+        else
+        {
+            server.send(probe.reply == ProbeReply::NO_CONTENT ? 204 : 404, "text/plain", "");
+        }
+        probesAnswered++;
+        return true;
+    }
+    return false;
+}
+
 // --- FUNÇÃO PRIVADA para registrar todas as rotas do servidor ---
 void register_server_handlers()
 {
     // Macro Config Endpoints
-    server.on("/", HTTP_GET, []()
+    server.on("/", HttpMethod::GET, []()
               { server.send(200, "text/html", index_html); });
-    server.on("/get_macro", HTTP_GET, []()
+    server.on("/get_macro", HttpMethod::GET, []()
+              { server.send(200, "text/plain", macro_to_string(macro_get_sequence())); });
+    server.on("/analyze", []()
               {
-        String seqString = "";
-        for (const auto& step : currentSequence) {
-            seqString += String(step.button) + "," + String(step.duration) + ";";
-        }
-        server.send(200, "text/plain", seqString); });
-    server.on("/save", HTTP_POST, []()
+                  // Optimizer and cost model for the posted macro, or the stored one without "seq"
+                  std::vector<MacroStep> sequence = server.hasArg("seq") ? macro_parse(server.arg("seq")) : macro_get_sequence();
+                  MacroAnalysis analysis;
+                  std::vector<MacroStep> optimized = macro_optimize(sequence, analysis, joystick_get_frame_rate());
+                  server.send(200, "application/json", macro_analysis_to_json(analysis, optimized));
+              });
+    server.on("/frame_rate", HttpMethod::GET, []()
+              { server.send(200, "text/plain", String(joystick_get_frame_rate())); });
+    server.on("/save", HttpMethod::POST, []()
               {
-                  if (server.hasArg("seq"))
+                  // Range-checked as an int: narrowed to uint8_t first, 300 would pass as 44
+                  long frameHz = server.hasArg("frame_hz") ? server.arg("frame_hz").toInt() : 0;
+                  if (frameHz < 0 || frameHz > FRAME_RATE_MAX_HZ)
                   {
-                      std::vector<MacroStep> newSequence;
-                      String seqString = server.arg("seq");
-                      int last_idx = 0;
-                      for (int i = 0; i < seqString.length(); i++)
-                      {
-                          if (seqString.charAt(i) == ';')
-                          {
-                              String stepStr = seqString.substring(last_idx, i);
-                              int comma_idx = stepStr.indexOf(',');
-                              if (comma_idx != -1)
-                              {
-                                  int button = stepStr.substring(0, comma_idx).toInt();
-                                  int duration = stepStr.substring(comma_idx + 1).toInt();
-                                  newSequence.push_back({button, duration});
-                              }
-                              last_idx = i + 1;
-                          }
-                      }
-                      if (!newSequence.empty())
+                      server.send(400, "text/plain", "frame_hz must be 0-" + String((unsigned)FRAME_RATE_MAX_HZ));
+                      return;
+                  }
+                  // The macro is costed at the rate it will play at, and nothing is stored if it
+                  // is rejected: keep running so the user can fix it
+                  uint8_t playHz = server.hasArg("frame_hz") ? frameHz : joystick_get_frame_rate();
+                  std::vector<MacroStep> newSequence = macro_parse(server.arg("seq"));
+                  if (!newSequence.empty())
+                  {
+                      MacroAnalysis analysis;
+                      std::vector<MacroStep> optimized = macro_optimize(newSequence, analysis, playHz);
+                      if (analysis.rejection)
                       {
-                          currentSequence = newSequence;
-                          save_sequence_to_flash(currentSequence);
+                          server.send(400, "application/json", macro_analysis_to_json(analysis, optimized));
+                          return;
                       }
                   }
+                  if (server.hasArg("frame_hz"))
+                  {
+                      joystick_set_frame_rate(frameHz);
+                  }
+                  if (!newSequence.empty())
+                  {
+                      macro_store(macro_get_slot(), newSequence);
+                  }
                   server.send(200, "text/plain", "OK");
                   delay(100);
-                  ESP.restart(); // Restart after saving macro
+                  ESP.restart(); // Restart after saving macro (the storage shutdown handler flushes it first)
               });
 
     // Wi-Fi Config Endpoints
-    server.on("/wifi", HTTP_GET, []()
+    server.on("/wifi", HttpMethod::GET, []()
               { server.send(200, "text/html", wifi_config_html); });
-    server.on("/scan", HTTP_GET, []()
+    server.on("/scan", HttpMethod::GET, []()
               {
         WiFi.mode(WIFI_AP_STA);
         Serial.println("Scanning Wi-Fi networks in AP_STA mode...");
@@ -555,7 +599,7 @@ void register_server_handlers()
         WiFi.scanDelete(); // Clear results to free memory
 
         server.send(200, "application/json", json); });
-    server.on("/set_wifi", HTTP_POST, []()
+    server.on("/set_wifi", HttpMethod::POST, []()
               {
                   String ssid = server.arg("ssid");
                   String password = server.arg("password");
@@ -572,7 +616,11 @@ void register_server_handlers()
               });
 
     server.onNotFound([]()
-                      { server.send(200, "text/html", index_html); }); // Default fallback to macro config
+                      {
+                          if (is_ap_mode_active && handle_probe())
+                              return;
+                          server.send(200, "text/html", index_html); // Default fallback to macro config
+                      });
 }
 
 // --- CORE WEB SERVER INITIALIZATION AND LOOP ---
@@ -584,6 +632,8 @@ void web_init()
     WiFi.softAP(AP_SSID, AP_PASS);
 
     dnsServer.start(53, "*", WiFi.softAPIP());
+    portalUrl = "http://" + WiFi.softAPIP().toString() + "/";
+    probesAnswered = 0;
     register_server_handlers(); // Registra as rotas
     server.begin();             // Inicia o servidor
 
@@ -614,11 +664,17 @@ void web_stop()
 {
     if (is_ap_mode_active)
     {
+        HttpStats http = server.stats();
+        Serial.printf("HTTP: %u requests on %u connections (%u reused, %u pipelined), %u idle-closed, %u evicted, %u backlogged\n",
+                      (unsigned)http.requests, (unsigned)http.accepted, (unsigned)http.reused, (unsigned)http.pipelined,
+                      (unsigned)http.closedIdle, (unsigned)http.evicted, (unsigned)http.backlogged);
         server.stop();
         dnsServer.stop();
         WiFi.mode(WIFI_OFF); // Turn off Wi-Fi completely when stopping AP
         is_ap_mode_active = false;
         Serial.println("Stopped Wi-Fi Access Point and Web Server.");
+        Serial.printf("Captive probes: %u answered without the portal page (%u bytes)\n", (unsigned)probesAnswered,
+                      (unsigned)strlen(index_html));
     }
     // Also disconnect from STA if connected
     if (is_sta_connected)
@@ -629,9 +685,6 @@ void web_stop()
     }
 }
 
-std::vector<MacroStep> web_get_sequence() { return currentSequence; }
-void web_load_default_sequence() { load_sequence_from_flash(); }
-
 // --- NEW Wi-Fi Management Function Implementations ---
 
 // Attempts to load saved credentials and connect to a station Wi-Fi network.
@@ -675,3 +728,5 @@ bool web_is_in_sta_mode()
     is_sta_connected = (WiFi.status() == WL_CONNECTED);
     return is_sta_connected;
 }
+
+String web_local_ip() { return WiFi.localIP().toString(); }
@@ -1,9 +1,14 @@
 #include <Arduino.h>
-#include <WiFi.h>
 #include "config.h"
+#include "Checkpoint.h"
+#include "FleetSync.h"
 #include "InputManager.h"
 #include "WebPortal.h"
 #include "JoystickController.h"
+#include "MacroStore.h"
+#include "OutputTrigger.h"
+#include "SerialLink.h"
+#include "Storage.h"
 
 // New System Modes:
 // MODE_BLUETOOTH_IDLE: BLE ready, not running macro, not connected to STA
@@ -18,63 +23,166 @@ enum SystemMode
     MODE_STA_CONNECTED_BLE
 };
 SystemMode currentMode = MODE_BLUETOOTH_IDLE; // Initial state, will be updated in setup
+unsigned long lastMetricsLog = 0;
 
-void setup()
+// Applies one output-report trigger. Runs before the mode switch in loop(), so a macro
+// that is started here sends its first press in the same pass.
+void handle_trigger(const TriggerEvent &event)
 {
-    Serial.begin(115200);
-    pinMode(LED_PIN, OUTPUT);
-    input_init();
+    bool running = currentMode == MODE_BLUETOOTH_RUNNING;
+    bool canStart = running || currentMode == MODE_BLUETOOTH_IDLE || currentMode == MODE_STA_CONNECTED_BLE;
+    switch (event.action)
+    {
+    case TriggerAction::START:
+        if (canStart)
+            currentMode = MODE_BLUETOOTH_RUNNING;
+        break;
 
-    // Load macro and Wi-Fi credentials on boot
-    web_load_default_sequence(); // Loads the saved macro from NVS
+    case TriggerAction::STOP:
+        if (running)
+        {
+            joystick_run_macro(macro_get_sequence(), false); // Release any held button
+            currentMode = MODE_BLUETOOTH_IDLE;
+        }
+        break;
 
-    // Attempt to connect to a saved external Wi-Fi network (Station Mode)
-    web_init_sta_mode();
+    case TriggerAction::BRANCH:
+        if (!canStart)
+            break;
+        if (running)
+            joystick_run_macro(macro_get_sequence(), false); // The new macro starts from its first step
+        macro_select_slot(event.slot, false);
+        currentMode = MODE_BLUETOOTH_RUNNING;
+        break;
 
-    // Wait briefly for STA connection to establish if credentials were valid
-    unsigned long sta_connect_start = millis();
-    while (!web_is_in_sta_mode() && millis() - sta_connect_start < 5000)
-    { // Try for 5 seconds
-        delay(100);
-        Serial.print(".");
+    default:
+        break;
     }
+}
+
+void setup()
+{
+    serial_init(); // Opens Serial at SERIAL_BAUD for both logs and the binary control link
+    pinMode(LED_PIN, OUTPUT);
+    input_init();
+
+    storage_init(); // Write-behind NVS layer, must come before anything that reads settings
 
-    // Decide initial system mode based on STA connection attempt
-    if (web_is_in_sta_mode())
+    // Fast path after a watchdog, panic or brownout reset in the middle of a macro: the macro
+    // and its position come from RTC memory and Wi-Fi stays off until the next normal boot,
+    // so playback continues as soon as BLE reconnects.
+    bool resumed = checkpoint_restore(MODE_BLUETOOTH_RUNNING);
+    if (resumed)
     {
-        currentMode = MODE_STA_CONNECTED_BLE;
-        Serial.printf("\nStarting in STA-connected BLE mode. IP: %s\n", WiFi.localIP().toString().c_str());
-        // Se conectou ao Wi-Fi, inicie o servidor web permanente.
-        web_server_start();
+        currentMode = MODE_BLUETOOTH_RUNNING;
+        CheckpointMetrics checkpoint = checkpoint_get_metrics();
+        Serial.printf("Unexpected reset during playback: resuming slot %d at step %d (%u of %u resumes)\n", macro_get_slot(),
+                      checkpoint.resumedStep, (unsigned)checkpoint.resumes, (unsigned)CHECKPOINT_MAX_RESUMES);
     }
     else
     {
-        currentMode = MODE_BLUETOOTH_IDLE;
-        Serial.println("\nStarting in BLE (idle) mode. No STA connection or failed.");
+        // Load macro and Wi-Fi credentials on boot
+        macro_load(); // Loads the active macro slot from NVS
+
+        if constexpr (FEATURE_WEB_PORTAL)
+        {
+            // Attempt to connect to a saved external Wi-Fi network (Station Mode)
+            web_init_sta_mode();
+
+            // Wait briefly for STA connection to establish if credentials were valid
+            unsigned long sta_connect_start = millis();
+            while (!web_is_in_sta_mode() && millis() - sta_connect_start < 5000)
+            { // Try for 5 seconds
+                delay(100);
+                Serial.print(".");
+            }
+
+            // Decide initial system mode based on STA connection attempt
+            if (web_is_in_sta_mode())
+            {
+                currentMode = MODE_STA_CONNECTED_BLE;
+                Serial.printf("\nStarting in STA-connected BLE mode. IP: %s\n", web_local_ip().c_str());
+                // Se conectou ao Wi-Fi, inicie o servidor web permanente.
+                web_server_start();
+            }
+            else
+            {
+                currentMode = MODE_BLUETOOTH_IDLE;
+                Serial.println("\nStarting in BLE (idle) mode. No STA connection or failed.");
+            }
+        }
+        else
+        {
+            // BLE-only build: no Wi-Fi to wait for, configuration comes over the serial link
+            currentMode = MODE_BLUETOOTH_IDLE;
+            Serial.println("BLE-only build. Use the serial link to configure macros.");
+        }
     }
 
     joystick_init(); // Initialize BLE Gamepad
+    if constexpr (FEATURE_OUTPUT_TRIGGERS)
+        trigger_init(); // Watches the host's output reports
+    if (!resumed)
+        storage_print_wear(Serial); // Reads every wear counter from NVS, not worth it on the fast path
     Serial.println("--- PatroSmartController Initialized ---");
 }
 
 void loop()
 {
+    input_scan(); // One register read per GPIO bank, debounced across scans
     bool btnMode = input_is_mode_btn_pressed();
     bool btnAction = input_is_action_btn_pressed();
+    SerialCommand serialCommand = serial_loop();
+
+    TriggerEvent trigger;
+    bool triggered = false;
+    uint32_t firstTriggerUs = 0;
+    while (trigger_take(trigger))
+    {
+        if (!triggered)
+            firstTriggerUs = trigger.receivedUs;
+        triggered = true;
+        handle_trigger(trigger);
+    }
+
+    // Like a trigger, the action button starts the macro before the mode switch: its
+    // interrupt has just woken this pass, which then sends the first press
+    bool actionStarted = false;
+    if (btnAction && (currentMode == MODE_BLUETOOTH_IDLE || currentMode == MODE_STA_CONNECTED_BLE))
+    {
+        currentMode = MODE_BLUETOOTH_RUNNING;
+        btnAction = false; // Consumed, the running case would take it as a stop
+        actionStarted = true;
+    }
+
+    // Matrix key n selects macro slot n; presses while a macro plays are dropped
+    for (int slot = 0; slot < MACRO_SLOT_COUNT; slot++)
+    {
+        if (input_matrix_was_pressed(slot) && currentMode != MODE_BLUETOOTH_RUNNING)
+            macro_select_slot(slot);
+    }
 
     switch (currentMode)
     {
     case MODE_BLUETOOTH_IDLE:
         digitalWrite(LED_PIN, LOW); // LED off
-        if (btnAction)
+        if (serialCommand == SerialCommand::START)
         {
             currentMode = MODE_BLUETOOTH_RUNNING;
         }
         if (btnMode)
         {
-            // Transition to Wi-Fi AP Config Mode
-            web_init(); // This starts the ESP32's AP and web server
-            currentMode = MODE_CONFIG_WIFI_AP;
+            if constexpr (FEATURE_WEB_PORTAL)
+            {
+                // Transition to Wi-Fi AP Config Mode
+                web_init(); // This starts the ESP32's AP and web server
+                currentMode = MODE_CONFIG_WIFI_AP;
+            }
+            else
+            {
+                // No portal in this build: the Mode button cycles through the macro slots
+                macro_select_slot((macro_get_slot() + 1) % MACRO_SLOT_COUNT);
+            }
         }
         break;
 
@@ -84,61 +192,99 @@ void loop()
         else
             digitalWrite(LED_PIN, LOW); // Slow blink to indicate macro running
 
-        joystick_run_macro(web_get_sequence(), true); // Execute macro
+        joystick_run_macro(macro_get_sequence(), true); // Execute macro
 
-        if (btnAction)
+        if (millis() - lastMetricsLog >= METRICS_INTERVAL_MS)
         {
+            joystick_print_metrics(Serial);
+            if constexpr (FEATURE_OUTPUT_TRIGGERS)
+                trigger_print_metrics(Serial);
+            input_print_latency(Serial);
+            lastMetricsLog = millis();
+        }
+
+        if (btnAction || serialCommand == SerialCommand::STOP)
+        {
+            joystick_run_macro(macro_get_sequence(), false); // Release any held button
             currentMode = MODE_BLUETOOTH_IDLE;
         } // Stop macro
         break;
 
     case MODE_CONFIG_WIFI_AP: // ESP32 is in Access Point mode, serving config pages
-        if ((millis() / 100) % 2 == 0)
-            digitalWrite(LED_PIN, HIGH);
-        else
-            digitalWrite(LED_PIN, LOW); // Fast blink for config mode
-
-        web_loop(); // Process web server requests (DNS, HTTP)
-
-        if (btnMode)
+        if constexpr (FEATURE_WEB_PORTAL)
         {
-            // Exit Config Mode
-            web_stop(); // Stop AP and web server. Also disconnects STA if connected.
-
-            // After exiting config, check if STA is now connected.
-            if (web_is_in_sta_mode())
-            { // Check if a station connection was established
-                currentMode = MODE_STA_CONNECTED_BLE;
-            }
+            if ((millis() / 100) % 2 == 0)
+                digitalWrite(LED_PIN, HIGH);
             else
+                digitalWrite(LED_PIN, LOW); // Fast blink for config mode
+
+            web_loop(); // Process web server requests (DNS, HTTP)
+
+            if (btnMode)
             {
-                currentMode = MODE_BLUETOOTH_IDLE;
+                // Exit Config Mode
+                web_stop(); // Stop AP and web server. Also disconnects STA if connected.
+
+                // After exiting config, check if STA is now connected.
+                if (web_is_in_sta_mode())
+                { // Check if a station connection was established
+                    currentMode = MODE_STA_CONNECTED_BLE;
+                }
+                else
+                {
+                    currentMode = MODE_BLUETOOTH_IDLE;
+                }
+                Serial.printf("Exiting config mode. New state: %s\n", (currentMode == MODE_STA_CONNECTED_BLE ? "STA_CONNECTED_BLE" : "BLUETOOTH_IDLE"));
             }
-            Serial.printf("Exiting config mode. New state: %s\n", (currentMode == MODE_STA_CONNECTED_BLE ? "STA_CONNECTED_BLE" : "BLUETOOTH_IDLE"));
         }
         break;
 
-    case MODE_STA_CONNECTED_BLE:     // ESP32 is connected to an external Wi-Fi network AND BLE is active
-        digitalWrite(LED_PIN, HIGH); // LED solid ON to indicate STA connection
+    case MODE_STA_CONNECTED_BLE: // ESP32 is connected to an external Wi-Fi network AND BLE is active
+        if constexpr (FEATURE_WEB_PORTAL)
+        {
+            digitalWrite(LED_PIN, HIGH); // LED solid ON to indicate STA connection
 
-        // Run web server loop to handle any incoming requests
-        web_server_loop();
+            // Run web server loop to handle any incoming requests
+            web_server_loop();
+            fleet_loop(); // mDNS announcement and multicast macro bundles
 
-        // Allow transition to Config Mode (AP) from STA mode
-        if (btnMode)
-        {
-            Serial.println("Entering config mode from STA. Disconnecting STA and starting AP...");
-            web_stop_sta_mode(); // Explicitly disconnect STA
-            web_init();          // Start the AP and web server for config
-            currentMode = MODE_CONFIG_WIFI_AP;
-        }
+            // Allow transition to Config Mode (AP) from STA mode
+            if (btnMode)
+            {
+                Serial.println("Entering config mode from STA. Disconnecting STA and starting AP...");
+                web_stop_sta_mode(); // Explicitly disconnect STA
+                web_init();          // Start the AP and web server for config
+                currentMode = MODE_CONFIG_WIFI_AP;
+            }
 
-        // Allow starting/stopping macro
-        if (btnAction)
-        {
-            currentMode = MODE_BLUETOOTH_RUNNING;
+            // Allow starting the macro from the serial link (the action button is handled above)
+            if (serialCommand == SerialCommand::START)
+            {
+                currentMode = MODE_BLUETOOTH_RUNNING;
+            }
         }
         break;
     }
-    delay(10); // Small delay to prevent watchdog timer from resetting the ESP32
+
+    if constexpr (FEATURE_WEB_PORTAL)
+    {
+        if (currentMode != MODE_STA_CONNECTED_BLE)
+            fleet_stop(); // Only announced while on the external network
+    }
+
+    if (triggered)
+        trigger_record_reaction(firstTriggerUs); // The player has acted on it by now
+    // Only once a report went out: not while BLE is down, nor for a macro that opens with a pause
+    if (actionStarted && (int32_t)((uint32_t)joystick_last_report_us() - input_press_time_us(BTN_ACTION_PIN)) >= 0)
+        input_record_reaction(input_press_time_us(BTN_ACTION_PIN), joystick_last_report_us());
+
+    checkpoint_update(currentMode); // RTC memory, only written when something changed
+
+    // Small delay to prevent watchdog timer from resetting the ESP32. While a macro runs,
+    // wake up early enough to send its next edge on time instead of on the next 10 ms pass.
+    // An output-report trigger or a button press ends the wait at once.
+    unsigned long waitUs = LOOP_PERIOD_MS * 1000;
+    if (currentMode == MODE_BLUETOOTH_RUNNING)
+        waitUs = std::min(waitUs, joystick_us_until_next_edge());
+    trigger_wait_us(waitUs);
 }
\ No newline at end of file
@@ -0,0 +1,153 @@
+// RTC checkpoint across simulated resets. The tests run in order on one device, as a run of
+// boots would: RTC memory and the resume count carry over from one test to the next.
+#include <Arduino.h>
+#include <BleGamepad.h>
+#include <esp_system.h>
+#include <unity.h>
+#include "config.h"
+#include "Checkpoint.h"
+#include "JoystickController.h"
+#include "MacroStore.h"
+#include "Storage.h"
+
+extern BleGamepad bleGamepad;
+
+constexpr uint8_t MODE_RUNNING = 1; // MODE_BLUETOOTH_RUNNING in main.cpp
+const char *MACRO_TEXT = "1,100;2,150;3,200;4,250;";
+
+void setUp() {}
+void tearDown() {}
+
+// Same calls per pass as loop(): play, checkpoint, wait
+static void play_until(uint64_t endUs)
+{
+    while (sim_now_us() < endUs)
+    {
+        joystick_run_macro(macro_get_sequence(), true);
+        checkpoint_update(MODE_RUNNING);
+        sim_advance_us(std::min<uint64_t>(LOOP_PERIOD_MS * 1000, joystick_us_until_next_edge()));
+    }
+}
+
+// Watchdog-style reset: RAM is gone, RTC memory is not
+static void crash(esp_reset_reason_t reason)
+{
+    joystick_run_macro(macro_get_sequence(), false);
+    macro_restore(0, {});
+    bleGamepad.reports.clear();
+    sim_set_reset_reason(reason);
+}
+
+void test_watchdog_reset_resumes_interrupted_step()
+{
+    std::vector<MacroStep> sequence = macro_parse(MACRO_TEXT);
+    macro_restore(0, sequence);
+    sim_reset_clock();
+    play_until(59600000); // 66 cycles of 900 ms, then 200 ms into the next: step 1 is held
+    int interruptedStep = joystick_step_index();
+    TEST_ASSERT_EQUAL_INT(1, interruptedStep);
+    TEST_ASSERT_TRUE(joystick_is_pressing());
+
+    crash(ESP_RST_TASK_WDT);
+    TEST_ASSERT_TRUE(checkpoint_restore(MODE_RUNNING));
+    TEST_ASSERT_EQUAL_STRING(MACRO_TEXT, macro_to_string(macro_get_sequence()).c_str());
+
+    // BLE reconnects: the first press is the interrupted step
+    joystick_run_macro(macro_get_sequence(), true);
+    TEST_ASSERT_FALSE(bleGamepad.reports.empty());
+    TEST_ASSERT_EQUAL_UINT32(1UL << (sequence[interruptedStep].button - 1), bleGamepad.reports[0].buttons);
+    TEST_ASSERT_EQUAL_INT(interruptedStep, checkpoint_get_metrics().resumedStep);
+    joystick_run_macro(macro_get_sequence(), false);
+}
+
+// The macro crashes again right after each resume: after the last one the next boot gives up
+void test_crash_loop_is_given_up()
+{
+    for (int i = 1; i < CHECKPOINT_MAX_RESUMES; i++)
+    {
+        crash(ESP_RST_TASK_WDT);
+        TEST_ASSERT_TRUE(checkpoint_restore(MODE_RUNNING));
+    }
+    crash(ESP_RST_TASK_WDT);
+    TEST_ASSERT_FALSE(checkpoint_restore(MODE_RUNNING));
+}
+
+// Once a resumed macro has played for CHECKPOINT_STABLE_MS, a crash is a new one
+void test_stable_playback_resets_resume_count()
+{
+    macro_restore(0, macro_parse(MACRO_TEXT));
+    play_until(sim_now_us() + (CHECKPOINT_STABLE_MS + 1000) * 1000);
+    crash(ESP_RST_PANIC);
+    TEST_ASSERT_TRUE(checkpoint_restore(MODE_RUNNING));
+    TEST_ASSERT_EQUAL_UINT8(1, checkpoint_get_metrics().resumes);
+}
+
+// Crashes again while BLE is still down after the resume: the loop keeps running in the
+// meantime, and the next boot must still resume the held step, not the one after it
+void test_second_crash_before_reconnect_resumes_same_step()
+{
+    std::vector<MacroStep> sequence = macro_parse(MACRO_TEXT);
+    macro_restore(0, sequence);
+    play_until(sim_now_us() + (CHECKPOINT_STABLE_MS + 1000) * 1000); // Clears the resume count
+    while (!joystick_is_pressing() || joystick_step_index() != 2)
+        play_until(sim_now_us() + 1);
+
+    crash(ESP_RST_TASK_WDT);
+    TEST_ASSERT_TRUE(checkpoint_restore(MODE_RUNNING));
+    bleGamepad.connected = false;
+    play_until(sim_now_us() + 2000000);
+    TEST_ASSERT_TRUE(bleGamepad.reports.empty());
+
+    crash(ESP_RST_BROWNOUT);
+    bleGamepad.connected = true;
+    TEST_ASSERT_TRUE(checkpoint_restore(MODE_RUNNING));
+    TEST_ASSERT_EQUAL_UINT8(2, checkpoint_get_metrics().resumes);
+    TEST_ASSERT_EQUAL_INT(2, checkpoint_get_metrics().resumedStep);
+    joystick_run_macro(macro_get_sequence(), true);
+    TEST_ASSERT_FALSE(bleGamepad.reports.empty());
+    TEST_ASSERT_EQUAL_UINT32(1UL << (sequence[2].button - 1), bleGamepad.reports[0].buttons);
+    joystick_run_macro(macro_get_sequence(), false);
+}
+
+// A macro longer than the RTC copy, as older firmware could save
+void test_oversized_macro_is_not_checkpointed()
+{
+    std::vector<MacroStep> longMacro(MACRO_MAX_STEPS + 44, MacroStep{1, 100});
+    macro_restore(0, longMacro);
+    joystick_run_macro(longMacro, true);
+    checkpoint_update(MODE_RUNNING);
+    crash(ESP_RST_TASK_WDT);
+    TEST_ASSERT_FALSE(checkpoint_restore(MODE_RUNNING));
+}
+
+void test_power_on_ignores_checkpoint()
+{
+    macro_restore(0, macro_parse(MACRO_TEXT));
+    play_until(sim_now_us() + 500000);
+    crash(ESP_RST_POWERON);
+    TEST_ASSERT_FALSE(checkpoint_restore(MODE_RUNNING));
+}
+
+void test_other_mode_ignores_checkpoint()
+{
+    macro_restore(0, macro_parse(MACRO_TEXT));
+    play_until(sim_now_us() + 500000);
+    crash(ESP_RST_TASK_WDT);
+    TEST_ASSERT_FALSE(checkpoint_restore(MODE_RUNNING + 1));
+}
+
+int main(int argc, char **argv)
+{
+    storage_init();
+    joystick_init();
+    macro_load();
+    UNITY_BEGIN();
+    RUN_TEST(test_watchdog_reset_resumes_interrupted_step);
+    RUN_TEST(test_crash_loop_is_given_up);
+    RUN_TEST(test_stable_playback_resets_resume_count);
+    RUN_TEST(test_second_crash_before_reconnect_resumes_same_step);
+    RUN_TEST(test_oversized_macro_is_not_checkpointed);
+    RUN_TEST(test_power_on_ignores_checkpoint);
+    RUN_TEST(test_other_mode_ignores_checkpoint);
+    return UNITY_END();
+}
@@ -0,0 +1,227 @@
+// Button debounce: the interrupt edge, the scan fallback, the matrix lane and the reaction
+// metric.
+#include <Arduino.h>
+#include <BleGamepad.h>
+#include <unity.h>
+#include "config.h"
+#include "InputManager.h"
+#include "JoystickController.h"
+#include "MacroStore.h"
+
+extern BleGamepad bleGamepad;
+
+static std::vector<MacroStep> sequence;
+static bool running = false;
+
+// One loop() pass, recording the reaction as loop() does: returns true when it saw a press
+static bool pass()
+{
+    input_scan();
+    bool pressed = input_is_action_btn_pressed();
+    bool started = pressed && !running;
+    running |= pressed;
+    joystick_run_macro(sequence, running);
+    uint32_t pressUs = input_press_time_us(BTN_ACTION_PIN);
+    if (started && (int32_t)((uint32_t)joystick_last_report_us() - pressUs) >= 0)
+        input_record_reaction(pressUs, joystick_last_report_us());
+    return pressed;
+}
+
+// Passes every LOOP_PERIOD_MS for `ms`; returns the presses seen
+static int idle(uint32_t ms)
+{
+    int seen = 0;
+    for (uint32_t t = 0; t < ms; t += LOOP_PERIOD_MS)
+    {
+        sim_advance_us(LOOP_PERIOD_MS * 1000);
+        seen += pass();
+    }
+    return seen;
+}
+
+// Flips the line `flips` times, 300 us apart with a pass after each, and leaves it at `high`
+static int bounce(bool high, int flips)
+{
+    int seen = 0;
+    for (int i = 0; i < flips; i++)
+    {
+        sim_advance_us(300);
+        sim_set_pin(BTN_ACTION_PIN, i % 2 ? high : !high);
+        seen += pass();
+    }
+    return seen;
+}
+
+// Released, macro stopped and the line quiet again
+void setUp()
+{
+    sim_set_pin(BTN_ACTION_PIN, true);
+    running = false;
+    joystick_run_macro(sequence, false);
+    idle(100);
+    bleGamepad.reports.clear();
+}
+
+void tearDown() {}
+
+void test_press_counts_at_the_edge()
+{
+    sim_set_pin(BTN_ACTION_PIN, false);
+    sim_advance_us(50);
+    TEST_ASSERT_TRUE(pass());
+    TEST_ASSERT_EQUAL_size_t(1, bleGamepad.reports.size());
+    TEST_ASSERT_EQUAL_INT(0, idle(200));
+}
+
+void test_press_bounces_count_once()
+{
+    sim_set_pin(BTN_ACTION_PIN, false);
+    sim_advance_us(50);
+    int seen = pass();
+    seen += bounce(false, 6);
+    seen += idle(200);
+    TEST_ASSERT_EQUAL_INT(1, seen);
+    TEST_ASSERT_TRUE(input_is_held(BTN_ACTION_PIN));
+}
+
+void test_release_bounces_do_not_count()
+{
+    sim_set_pin(BTN_ACTION_PIN, false);
+    sim_advance_us(50);
+    int seen = pass() + idle(200);
+    sim_set_pin(BTN_ACTION_PIN, true);
+    seen += pass();
+    seen += bounce(true, 6);
+    seen += idle(100);
+    TEST_ASSERT_EQUAL_INT(1, seen);
+    TEST_ASSERT_FALSE(input_is_held(BTN_ACTION_PIN));
+}
+
+// The line bounces back high before the interrupt samples it: only the scan sees the press
+void test_missed_edge_is_caught_by_scan()
+{
+    sim_defer_interrupts(true);
+    sim_set_pin(BTN_ACTION_PIN, false);
+    sim_advance_us(2);
+    sim_set_pin(BTN_ACTION_PIN, true);
+    sim_advance_us(20);
+    sim_defer_interrupts(false);
+    TEST_ASSERT_FALSE(pass());
+    int seen = bounce(false, 4) + idle(200);
+    TEST_ASSERT_EQUAL_INT(1, seen);
+    TEST_ASSERT_FALSE(bleGamepad.reports.empty());
+    sim_set_pin(BTN_ACTION_PIN, true);
+    TEST_ASSERT_EQUAL_INT(0, idle(100));
+}
+
+void test_reaction_recorded_after_first_report()
+{
+    uint32_t before = input_get_latency().presses;
+    sim_set_pin(BTN_ACTION_PIN, false);
+    sim_advance_us(50);
+    pass();
+    TEST_ASSERT_EQUAL_UINT32(before + 1, input_get_latency().presses);
+    TEST_ASSERT_EQUAL_UINT32(50, input_get_latency().lastLatencyUs);
+}
+
+// BLE down: the press still starts the macro, but no report goes out, so nothing is recorded
+void test_no_reaction_without_report()
+{
+    uint32_t before = input_get_latency().presses;
+    bleGamepad.connected = false;
+    sim_set_pin(BTN_ACTION_PIN, false);
+    sim_advance_us(50);
+    int seen = pass() + idle(200);
+    bleGamepad.connected = true;
+    TEST_ASSERT_EQUAL_INT(1, seen);
+    TEST_ASSERT_EQUAL_UINT32(before, input_get_latency().presses);
+}
+
+// 2x2 matrix, keys 0-1 on row GPIO25 and 2-3 on row GPIO26. Column GPIO35 is in the high lane.
+constexpr int ROW_PINS[] = {25, 26};
+constexpr int COL_PINS[] = {27, 35};
+static int matrixPresses[4];
+
+static void use_matrix(const int *rowPins, size_t rows)
+{
+    input_init(INPUT_PINS, sizeof(INPUT_PINS) / sizeof(INPUT_PINS[0]), rowPins, rows, COL_PINS, 2);
+    for (int &presses : matrixPresses)
+        presses = 0;
+}
+
+// idle(), also counting the presses of each matrix key
+static void matrix_idle(uint32_t ms)
+{
+    for (uint32_t t = 0; t < ms; t += LOOP_PERIOD_MS)
+    {
+        sim_advance_us(LOOP_PERIOD_MS * 1000);
+        pass();
+        for (int key = 0; key < 4; key++)
+            matrixPresses[key] += input_matrix_was_pressed(key);
+    }
+}
+
+void test_matrix_key_counts_once_on_its_own_bit()
+{
+    use_matrix(ROW_PINS, 2);
+    sim_set_matrix_key(26, 35, true);
+    matrix_idle(200);
+    sim_set_matrix_key(26, 35, false);
+    matrix_idle(100);
+    sim_set_matrix_key(25, 27, true);
+    matrix_idle(200);
+    sim_set_matrix_key(25, 27, false);
+    input_init();
+
+    TEST_ASSERT_EQUAL_INT(1, matrixPresses[0]);
+    TEST_ASSERT_EQUAL_INT(0, matrixPresses[1]);
+    TEST_ASSERT_EQUAL_INT(0, matrixPresses[2]);
+    TEST_ASSERT_EQUAL_INT(1, matrixPresses[3]);
+}
+
+// A contact that changes on every scan never holds still for four samples
+void test_matrix_bouncing_key_does_not_count()
+{
+    use_matrix(ROW_PINS, 2);
+    for (int i = 0; i < 20; i++)
+    {
+        sim_set_matrix_key(25, 35, i % 2 == 0);
+        matrix_idle(LOOP_PERIOD_MS);
+    }
+    sim_set_matrix_key(25, 35, false);
+    matrix_idle(100);
+    input_init();
+
+    TEST_ASSERT_EQUAL_INT(0, matrixPresses[1]);
+}
+
+// GPIO33 cannot be driven through W1TS/W1TC, so the whole matrix stays off
+void test_matrix_with_row_above_31_is_left_out()
+{
+    constexpr int rowPins[] = {25, 33};
+    use_matrix(rowPins, 2);
+    sim_set_matrix_key(25, 27, true);
+    matrix_idle(200);
+    sim_set_matrix_key(25, 27, false);
+    input_init();
+
+    TEST_ASSERT_EQUAL_INT(0, matrixPresses[0]);
+}
+
+int main(int argc, char **argv)
+{
+    input_init();
+    joystick_init();
+    sequence = macro_parse("1,100;2,100;");
+    UNITY_BEGIN();
+    RUN_TEST(test_press_counts_at_the_edge);
+    RUN_TEST(test_press_bounces_count_once);
+    RUN_TEST(test_release_bounces_do_not_count);
+    RUN_TEST(test_missed_edge_is_caught_by_scan);
+    RUN_TEST(test_reaction_recorded_after_first_report);
+    RUN_TEST(test_no_reaction_without_report);
+    RUN_TEST(test_matrix_key_counts_once_on_its_own_bit);
+    RUN_TEST(test_matrix_bouncing_key_does_not_count);
+    RUN_TEST(test_matrix_with_row_above_31_is_left_out);
+    return UNITY_END();
+}
@@ -0,0 +1,105 @@
+// Applying a fleet bundle: its macros are checked at the frame rate the bundle sets, and
+// either every slot is stored and the rate changed, or nothing is.
+#include <Arduino.h>
+#include <Preferences.h>
+#include <unity.h>
+#include "config.h"
+#include "FleetSync.h"
+#include "JoystickController.h"
+#include "MacroBlocks.h"
+#include "MacroOptimizer.h"
+#include "MacroStore.h"
+#include "Storage.h"
+
+constexpr uint8_t KEEP = 0xFF;
+
+void setUp()
+{
+    storage_flush();
+    sim_nvs_clear();
+    blocks_drop_cache();
+    macro_load();
+    joystick_set_frame_rate(0);
+}
+
+void tearDown() {}
+
+// Header, then slot u8, text length u16, text per macro (see FleetSync.h)
+static std::vector<uint8_t> bundle(uint8_t activeSlot, uint8_t frameRate, const std::vector<std::pair<int, const char *>> &macros)
+{
+    std::vector<uint8_t> data = {activeSlot, frameRate};
+    for (const auto &macro : macros)
+    {
+        size_t length = strlen(macro.second);
+        data.push_back(macro.first);
+        data.push_back(length);
+        data.push_back(length >> 8);
+        data.insert(data.end(), macro.second, macro.second + length);
+    }
+    return data;
+}
+
+static FleetStatus apply(const std::vector<uint8_t> &data) { return fleet_apply_bundle(data.data(), data.size()); }
+
+static String loaded(int slot)
+{
+    macro_select_slot(slot, false);
+    return macro_to_string(macro_get_sequence());
+}
+
+static String optimized(const char *macroText, uint8_t frameRateHz)
+{
+    MacroAnalysis analysis;
+    return macro_to_string(macro_optimize(macro_parse(macroText), analysis, frameRateHz));
+}
+
+// 5 ms presses are refused at the device's 0 Hz, but the bundle switches to 60 Hz, where
+// frame sync holds them long enough
+void test_macros_are_checked_at_the_bundle_rate()
+{
+    TEST_ASSERT_EQUAL(FLEET_APPLIED, apply(bundle(KEEP, 60, {{1, "1,5;2,5;"}})));
+    TEST_ASSERT_EQUAL_UINT8(60, joystick_get_frame_rate());
+    TEST_ASSERT_EQUAL_STRING(optimized("1,5;2,5;", 60).c_str(), loaded(1).c_str());
+}
+
+void test_rejected_at_the_bundle_rate_changes_nothing()
+{
+    joystick_set_frame_rate(60);
+    TEST_ASSERT_TRUE(macro_store(1, macro_parse("1,100;")));
+
+    TEST_ASSERT_EQUAL(FLEET_REJECTED, apply(bundle(KEEP, 240, {{1, "1,5;2,5;"}})));
+    TEST_ASSERT_EQUAL_UINT8(60, joystick_get_frame_rate());
+    TEST_ASSERT_EQUAL_STRING("1,100;", loaded(1).c_str());
+}
+
+// The bad macro comes last: the good one before it must not have been stored
+void test_one_bad_macro_rejects_the_bundle()
+{
+    TEST_ASSERT_TRUE(macro_store(0, macro_parse("1,100;")));
+    String slot1 = loaded(1);
+    macro_select_slot(0, false);
+
+    TEST_ASSERT_EQUAL(FLEET_REJECTED, apply(bundle(2, KEEP, {{0, "2,100;"}, {1, "0,100;"}})));
+    TEST_ASSERT_EQUAL_INT(0, macro_get_slot());
+    TEST_ASSERT_EQUAL_STRING("1,100;", loaded(0).c_str());
+    TEST_ASSERT_EQUAL_STRING(slot1.c_str(), loaded(1).c_str());
+}
+
+void test_applied_bundle_stores_every_slot()
+{
+    TEST_ASSERT_EQUAL(FLEET_APPLIED, apply(bundle(2, KEEP, {{0, "2,100;"}, {2, "3,80;0,40;"}})));
+    TEST_ASSERT_EQUAL_INT(2, macro_get_slot());
+    TEST_ASSERT_EQUAL_STRING("3,80;0,40;", macro_to_string(macro_get_sequence()).c_str());
+    TEST_ASSERT_EQUAL_STRING("2,100;", loaded(0).c_str());
+}
+
+int main(int argc, char **argv)
+{
+    storage_init();
+    UNITY_BEGIN();
+    RUN_TEST(test_macros_are_checked_at_the_bundle_rate);
+    RUN_TEST(test_rejected_at_the_bundle_rate_changes_nothing);
+    RUN_TEST(test_one_bad_macro_rejects_the_bundle);
+    RUN_TEST(test_applied_bundle_stores_every_slot);
+    return UNITY_END();
+}
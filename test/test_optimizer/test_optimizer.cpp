@@ -0,0 +1,165 @@
+// Save-time optimizer and cost model: what it folds, what it flags and what it rejects.
+#include <Arduino.h>
+#include <Preferences.h>
+#include <unity.h>
+#include "config.h"
+#include "JoystickController.h"
+#include "MacroBlocks.h"
+#include "MacroOptimizer.h"
+#include "MacroStore.h"
+#include "Storage.h"
+
+void setUp() {}
+void tearDown() {}
+
+static String optimize(const char *macroText, MacroAnalysis &analysis, uint8_t frameRateHz = 0)
+{
+    return macro_to_string(macro_optimize(macro_parse(macroText), analysis, frameRateHz));
+}
+
+void test_plain_macro_is_unchanged()
+{
+    MacroAnalysis analysis;
+    TEST_ASSERT_EQUAL_STRING("1,200;2,200;", optimize("1,200;2,200;", analysis).c_str());
+    TEST_ASSERT_EQUAL_size_t(0, analysis.mergedSteps);
+    TEST_ASSERT_EQUAL_size_t(0, analysis.noOpSteps);
+    TEST_ASSERT_EQUAL_UINT32(400 + 2 * DELAY_BETWEEN_STEPS_MS, analysis.cycleMs);
+    TEST_ASSERT_EQUAL_UINT32(4, analysis.reportsPerCycle);
+    TEST_ASSERT_NULL(analysis.rejection);
+}
+
+// Invalid button, zero hold and back-to-back pauses all become one pause of the same length
+void test_silent_steps_fold_into_one_pause()
+{
+    MacroAnalysis analysis;
+    String optimized = optimize("1,200;0,100;0,100;40,50;2,0;3,10;1,200;", analysis);
+    TEST_ASSERT_EQUAL_STRING("1,200;0,400;3,10;1,200;", optimized.c_str());
+    TEST_ASSERT_EQUAL_size_t(7, analysis.stepsIn);
+    TEST_ASSERT_EQUAL_size_t(4, analysis.stepsOut);
+    TEST_ASSERT_EQUAL_size_t(3, analysis.mergedSteps);
+    TEST_ASSERT_EQUAL_size_t(2, analysis.noOpSteps);
+    TEST_ASSERT_LESS_THAN(analysis.storageBytesIn, analysis.storageBytesOut);
+}
+
+void test_cycle_time_is_kept()
+{
+    MacroAnalysis analysis;
+    optimize("1,200;0,100;0,100;40,50;2,0;3,10;1,200;", analysis);
+    TEST_ASSERT_EQUAL_UINT32(660 + 7 * DELAY_BETWEEN_STEPS_MS, analysis.cycleMs);
+}
+
+void test_short_holds_are_flagged()
+{
+    MacroAnalysis analysis;
+    optimize("1,200;0,400;3,10;1,200;", analysis);
+    TEST_ASSERT_EQUAL_size_t(1, analysis.belowResolution.size());
+    TEST_ASSERT_EQUAL_size_t(2, analysis.belowResolution[0]);
+    TEST_ASSERT_NULL(analysis.rejection);
+}
+
+void test_rejects_macros_that_cannot_play()
+{
+    MacroAnalysis analysis;
+    optimize("", analysis);
+    TEST_ASSERT_EQUAL_STRING("empty macro", analysis.rejection);
+    optimize("0,100;0,200;", analysis);
+    TEST_ASSERT_EQUAL_STRING("macro never presses a button", analysis.rejection);
+
+    std::vector<MacroStep> tooLong;
+    for (size_t i = 0; i <= MACRO_MAX_STEPS; i++)
+        tooLong.push_back({(int)(i % 2) + 1, 100});
+    macro_optimize(tooLong, analysis, 0);
+    TEST_ASSERT_EQUAL_STRING("too many steps", analysis.rejection);
+}
+
+// Costs are those of the player: at 60 Hz the 16 ms hold lasts FRAME_MIN_HELD frames and
+// every gap is rounded to whole frames
+void test_cycle_follows_frame_sync()
+{
+    MacroAnalysis analysis;
+    optimize("1,30;2,45;3,16;", analysis);
+    TEST_ASSERT_EQUAL_UINT32(91 + 3 * DELAY_BETWEEN_STEPS_MS, analysis.cycleMs);
+    optimize("1,30;2,45;3,16;", analysis, 60);
+    uint32_t cycleUs = 0;
+    for (const MacroStep &step : macro_parse("1,30;2,45;3,16;"))
+        cycleUs += joystick_hold_us(step, 60) + joystick_gap_us(60);
+    TEST_ASSERT_EQUAL_UINT32((cycleUs + 500) / 1000, analysis.cycleMs);
+    TEST_ASSERT_GREATER_THAN(91 + 3 * DELAY_BETWEEN_STEPS_MS, analysis.cycleMs);
+    TEST_ASSERT_EQUAL_UINT32(FRAME_MIN_HELD * 1000000 / 60, joystick_hold_us({3, 16}, 60));
+}
+
+// Every hold shorter than one report interval: the host might not see a single press. Frame
+// sync stretches them to FRAME_MIN_HELD frames, which is long enough at 60 Hz but not at 240.
+void test_rejects_presses_the_host_cannot_see()
+{
+    MacroAnalysis analysis;
+    optimize("1,5;2,5;", analysis);
+    TEST_ASSERT_EQUAL_STRING("no press is held long enough for the host to see it", analysis.rejection);
+    TEST_ASSERT_EQUAL_size_t(2, analysis.belowResolution.size());
+
+    optimize("1,5;2,5;", analysis, 60);
+    TEST_ASSERT_NULL(analysis.rejection);
+    TEST_ASSERT_EQUAL_size_t(0, analysis.belowResolution.size());
+
+    optimize("1,5;2,5;", analysis, 240);
+    TEST_ASSERT_NOT_NULL(analysis.rejection);
+
+    // One press the host sees is enough
+    optimize("1,5;2,40;", analysis);
+    TEST_ASSERT_NULL(analysis.rejection);
+    TEST_ASSERT_EQUAL_size_t(1, analysis.belowResolution.size());
+}
+
+// Why there is no per-macro check for unseen releases or the link budget: at every frame
+// rate the player's gap outlasts a report interval, and its fastest step stays in budget
+void test_player_gap_keeps_releases_seen_and_rate_in_budget()
+{
+    for (unsigned hz = 0; hz <= FRAME_RATE_MAX_HZ; hz++)
+    {
+        uint32_t gapUs = joystick_gap_us(hz);
+        uint32_t fastestStepUs = joystick_hold_us({1, 1}, hz) + gapUs;
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(HID_REPORT_INTERVAL_MS * 1000UL, gapUs);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(HID_MAX_REPORTS_PER_S, 2 * 1000000UL / fastestStepUs);
+    }
+}
+
+// The storage cost is what macro_store leaves in NVS: the slot's reference list and its blocks
+void test_storage_cost_is_the_stored_blocks()
+{
+    sim_nvs_clear();
+    blocks_drop_cache();
+    String text;
+    for (int i = 0; i < 120; i++)
+        text += String(1 + i % 5) + "," + String(40 + (i * 37) % 200) + ";";
+
+    MacroAnalysis analysis;
+    macro_optimize(macro_parse(text), analysis, 0);
+    TEST_ASSERT_TRUE(macro_store(0, macro_parse(text)));
+    storage_flush();
+
+    size_t stored = 0;
+    for (const auto &entry : sim_nvs_namespace(PREFERENCES_NAMESPACE_GENERAL))
+    {
+        if (entry.second[0] == '@')
+            stored += entry.second.size() + 1;
+    }
+    for (const auto &entry : sim_nvs_namespace(PREFERENCES_NAMESPACE_BLOCKS))
+        stored += entry.second.size() + 1;
+    TEST_ASSERT_EQUAL_size_t(stored, analysis.storageBytesOut);
+}
+
+int main(int argc, char **argv)
+{
+    storage_init();
+    UNITY_BEGIN();
+    RUN_TEST(test_plain_macro_is_unchanged);
+    RUN_TEST(test_silent_steps_fold_into_one_pause);
+    RUN_TEST(test_cycle_time_is_kept);
+    RUN_TEST(test_short_holds_are_flagged);
+    RUN_TEST(test_rejects_macros_that_cannot_play);
+    RUN_TEST(test_cycle_follows_frame_sync);
+    RUN_TEST(test_rejects_presses_the_host_cannot_see);
+    RUN_TEST(test_player_gap_keeps_releases_seen_and_rate_in_budget);
+    RUN_TEST(test_storage_cost_is_the_stored_blocks);
+    return UNITY_END();
+}
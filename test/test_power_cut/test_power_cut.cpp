@@ -0,0 +1,165 @@
+// Power cut at every point of a flush. Whatever reached flash, the next boot must load each
+// slot's macro from before the flush or from after it, never the default through a
+// reference to a block that is missing, and the boot sweep must leave no orphan blocks.
+#include <Arduino.h>
+#include <Preferences.h>
+#include <unity.h>
+#include <functional>
+#include "config.h"
+#include "JoystickController.h"
+#include "MacroBlocks.h"
+#include "MacroOptimizer.h"
+#include "MacroStore.h"
+#include "Storage.h"
+
+void setUp() {}
+void tearDown() {}
+
+// A recorded-looking macro of `count` steps; changedStep gets another hold time
+static String recorded_steps(uint32_t seed, int count, int changedStep = -1)
+{
+    String text;
+    for (int i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int button = 1 + (int)((seed >> 16) % 8);
+        int duration = 40 + (int)((seed >> 8) % 400) + (i == changedStep ? 7 : 0);
+        text += String(button) + "," + String(duration) + ";";
+    }
+    // The optimizer's form of it, which is what a slot loads back
+    MacroAnalysis analysis;
+    return macro_to_string(macro_optimize(macro_parse(text), analysis, joystick_get_frame_rate()));
+}
+
+static String loaded(int slot)
+{
+    macro_select_slot(slot, false);
+    return macro_to_string(macro_get_sequence());
+}
+
+// The RAM queue and cache are gone; setup() loads the active slot and sweeps the blocks,
+// and the storage task flushes the sweep
+static void reboot()
+{
+    blocks_drop_cache();
+    macro_load();
+    storage_flush();
+}
+
+static size_t orphan_blocks()
+{
+    std::vector<String> refs;
+    for (const auto &entry : sim_nvs_namespace(PREFERENCES_NAMESPACE_GENERAL))
+        refs.push_back(entry.second.c_str());
+    size_t orphans = 0;
+    for (const auto &entry : sim_nvs_namespace(PREFERENCES_NAMESPACE_BLOCKS))
+    {
+        bool used = false;
+        for (const auto &value : refs)
+            used |= value.indexOf(entry.first.c_str() + 1) >= 0;
+        orphans += !used;
+    }
+    return orphans;
+}
+
+// Stores `before` and flushes it, runs `edit`, then cuts the power after each possible
+// number of flash writes of the next flush
+static void check_every_cut(const std::vector<String> &before, const std::function<void()> &edit, const std::vector<String> &after)
+{
+    uint32_t flushWrites = 0;
+    for (int cut = -1; cut < (int)flushWrites; cut++)
+    {
+        sim_nvs_clear();
+        blocks_drop_cache();
+        for (int slot = 0; slot < MACRO_SLOT_COUNT; slot++)
+            TEST_ASSERT_TRUE(macro_store(slot, macro_parse(before[slot])));
+        storage_flush();
+        edit();
+
+        uint32_t writesBefore = sim_nvs_write_count();
+        sim_nvs_cut_power_after(cut);
+        storage_flush();
+        sim_nvs_cut_power_after(-1);
+        if (cut < 0)
+            flushWrites = sim_nvs_write_count() - writesBefore;
+        reboot();
+
+        char message[64];
+        snprintf(message, sizeof(message), "power cut after %d of %u writes", cut, (unsigned)flushWrites);
+        for (int slot = 0; slot < MACRO_SLOT_COUNT; slot++)
+        {
+            String macro = loaded(slot);
+            if (cut < 0)
+                TEST_ASSERT_EQUAL_STRING_MESSAGE(after[slot].c_str(), macro.c_str(), message);
+            else
+                TEST_ASSERT_TRUE_MESSAGE(macro == before[slot] || macro == after[slot], message);
+        }
+        TEST_ASSERT_EQUAL_size_t_MESSAGE(0, orphan_blocks(), message);
+    }
+    TEST_ASSERT_GREATER_THAN_UINT32(1, flushWrites);
+}
+
+static std::vector<String> initial_slots()
+{
+    return {recorded_steps(1, 40), recorded_steps(2, 30), recorded_steps(3, 20), recorded_steps(4, 10)};
+}
+
+void test_cut_during_new_macro()
+{
+    std::vector<String> before = initial_slots();
+    std::vector<String> after = before;
+    after[2] = recorded_steps(5, 50);
+    check_every_cut(before, [&]() { macro_store(2, macro_parse(after[2])); }, after);
+}
+
+// The second save coalesces with the first: its blocks, the slot and the erases of both
+// older macros reach flash in one batch
+void test_cut_after_two_saves_into_one_slot()
+{
+    std::vector<String> before = initial_slots();
+    std::vector<String> after = before;
+    after[0] = recorded_steps(7, 40);
+    check_every_cut(before, [&]()
+    {
+        macro_store(0, macro_parse(recorded_steps(6, 40)));
+        macro_store(0, macro_parse(after[0]));
+    }, after);
+}
+
+// A block erased by the first save is stored again by the second
+void test_cut_after_save_and_undo()
+{
+    std::vector<String> before = initial_slots();
+    check_every_cut(before, [&]()
+    {
+        macro_store(1, macro_parse(recorded_steps(8, 30)));
+        macro_store(1, macro_parse(before[1]));
+    }, before);
+}
+
+// Edited copy of one slot saved into another, which shares its unchanged blocks, then that
+// slot made active
+void test_cut_after_shared_save_and_select()
+{
+    std::vector<String> before = initial_slots();
+    std::vector<String> after = before;
+    after[3] = recorded_steps(1, 40, 35);
+    after[0] = before[2];
+    check_every_cut(before, [&]()
+    {
+        macro_store(3, macro_parse(after[3]));
+        macro_store(0, macro_parse(after[0]));
+        macro_select_slot(3);
+    }, after);
+}
+
+int main(int argc, char **argv)
+{
+    storage_init();
+    UNITY_BEGIN();
+    RUN_TEST(test_cut_during_new_macro);
+    RUN_TEST(test_cut_after_two_saves_into_one_slot);
+    RUN_TEST(test_cut_after_save_and_undo);
+    RUN_TEST(test_cut_after_shared_save_and_select);
+    return UNITY_END();
+}
@@ -0,0 +1,120 @@
+// Write-behind NVS queue: reads see queued values, repeated writes coalesce into one flash
+// write, erases read as the default, and key listings merge flash with the queue.
+#include <Arduino.h>
+#include <Preferences.h>
+#include <unity.h>
+#include <algorithm>
+#include "config.h"
+#include "Storage.h"
+
+const char *TEST_NS = "test_ns";
+
+void setUp()
+{
+    storage_flush();
+    sim_nvs_clear();
+}
+
+void tearDown() {}
+
+static bool has_key(const std::vector<String> &keys, const char *key)
+{
+    return std::find(keys.begin(), keys.end(), String(key)) != keys.end();
+}
+
+void test_reads_see_queued_values()
+{
+    storage_put_string(TEST_NS, "text", "queued");
+    storage_put_uchar(TEST_NS, "byte", 7);
+    TEST_ASSERT_EQUAL_UINT32(0, sim_nvs_write_count());
+    TEST_ASSERT_EQUAL_STRING("queued", storage_get_string(TEST_NS, "text", "").c_str());
+    TEST_ASSERT_EQUAL_UINT8(7, storage_get_uchar(TEST_NS, "byte", 0));
+
+    storage_flush();
+    TEST_ASSERT_EQUAL_STRING("queued", storage_get_string(TEST_NS, "text", "").c_str());
+    TEST_ASSERT_EQUAL_UINT8(7, storage_get_uchar(TEST_NS, "byte", 0));
+}
+
+void test_repeated_writes_flush_once()
+{
+    for (int i = 0; i < 100; i++)
+        storage_put_string(TEST_NS, "text", String(i));
+    storage_flush();
+    TEST_ASSERT_EQUAL_UINT32(1, sim_nvs_namespace(TEST_NS).size());
+    TEST_ASSERT_EQUAL_STRING("99", sim_nvs_namespace(TEST_NS)["text"].c_str());
+    // Only the value: wear counters stay in RAM until they are saved
+    TEST_ASSERT_EQUAL_UINT32(1, sim_nvs_write_count());
+}
+
+void test_remove_reads_default()
+{
+    storage_put_string(TEST_NS, "text", "stored");
+    storage_flush();
+    storage_remove(TEST_NS, "text");
+    TEST_ASSERT_EQUAL_STRING("default", storage_get_string(TEST_NS, "text", "default").c_str());
+    storage_flush();
+    TEST_ASSERT_EQUAL_UINT32(0, sim_nvs_namespace(TEST_NS).count("text"));
+    TEST_ASSERT_EQUAL_STRING("default", storage_get_string(TEST_NS, "text", "default").c_str());
+}
+
+void test_write_after_remove_restores_key()
+{
+    storage_put_string(TEST_NS, "text", "first");
+    storage_flush();
+    storage_remove(TEST_NS, "text");
+    storage_put_string(TEST_NS, "text", "second");
+    storage_flush();
+    TEST_ASSERT_EQUAL_STRING("second", storage_get_string(TEST_NS, "text", "").c_str());
+}
+
+void test_list_keys_merges_queue()
+{
+    storage_put_string(TEST_NS, "flashed", "1");
+    storage_put_string(TEST_NS, "erased", "2");
+    storage_flush();
+    storage_put_string(TEST_NS, "queued", "3");
+    storage_remove(TEST_NS, "erased");
+    storage_put_string("other_ns", "elsewhere", "4");
+
+    std::vector<String> keys = storage_list_keys(TEST_NS);
+    TEST_ASSERT_EQUAL_size_t(2, keys.size());
+    TEST_ASSERT_TRUE(has_key(keys, "flashed"));
+    TEST_ASSERT_TRUE(has_key(keys, "queued"));
+    TEST_ASSERT_FALSE(has_key(keys, "erased"));
+}
+
+// Flushes write only values; the wear counters reach flash together at shutdown, one per key
+void test_wear_counters_are_saved_at_shutdown()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        storage_put_string(TEST_NS, "worn_text", String(i));
+        storage_put_uchar(TEST_NS, "worn_byte", i);
+        storage_flush();
+    }
+    TEST_ASSERT_EQUAL_UINT32(6, sim_nvs_write_count());
+    TEST_ASSERT_EQUAL_UINT32(0, sim_nvs_namespace(PREFERENCES_NAMESPACE_WEAR).size());
+    TEST_ASSERT_EQUAL_UINT32(3, storage_write_count("worn_text"));
+
+    ESP.restart();
+    TEST_ASSERT_EQUAL_UINT32(6 + sim_nvs_namespace(PREFERENCES_NAMESPACE_WEAR).size(), sim_nvs_write_count());
+    Preferences wear;
+    wear.begin(PREFERENCES_NAMESPACE_WEAR, true);
+    TEST_ASSERT_EQUAL_UINT32(3, wear.getUInt("worn_text"));
+    TEST_ASSERT_EQUAL_UINT32(3, wear.getUInt("worn_byte"));
+    wear.end();
+    TEST_ASSERT_EQUAL_UINT32(3, storage_write_count("worn_text"));
+}
+
+int main(int argc, char **argv)
+{
+    storage_init();
+    UNITY_BEGIN();
+    RUN_TEST(test_reads_see_queued_values);
+    RUN_TEST(test_repeated_writes_flush_once);
+    RUN_TEST(test_remove_reads_default);
+    RUN_TEST(test_write_after_remove_restores_key);
+    RUN_TEST(test_list_keys_merges_queue);
+    RUN_TEST(test_wear_counters_are_saved_at_shutdown);
+    return UNITY_END();
+}
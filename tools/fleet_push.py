@@ -0,0 +1,264 @@
+#!/usr/bin/env python3
+"""Pushes a signed macro bundle to every device on the network over UDP multicast.
+
+Devices in STA mode join the group (see include/FleetSync.h for the protocol). The bundle
+is multicast once, then the MANIFEST is repeated as a poll: each device answers with a
+NACK of the chunks it is missing, or DONE once it has applied (or refused) the bundle.
+The union of all NACKs is multicast again, so the cost grows with the chunks lost, not
+with the number of devices.
+
+Examples:
+    fleet_push.py --keygen                                   # new fleet key, set it with
+    patro_serial.py -p /dev/ttyUSB0 fleet-key <key>          # ...on every device
+    fleet_push.py --key <key> --slot 0="1,100;2,150;" --slot 1="3,80;0,40;" --active 0
+    fleet_push.py --key <key> --demo --expect 12 --iface 192.168.1.20
+    fleet_push.py --simulate 1,10,50 --node .pio/build/native_fleet/program --loss 0.05
+
+--simulate starts that many native_fleet nodes on loopback for each count, pushes the demo
+bundle to them and prints how long it took. With --forge, unsigned MANIFESTs (one for the
+highest id, one for the real id with a wrong HMAC) are multicast first, as an attacker on
+the network could; the push must still reach every node.
+"""
+import argparse
+import hashlib
+import hmac
+import os
+import random
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+MAGIC = b"PFB1"
+MANIFEST, CHUNK, NACK, DONE = 1, 2, 3, 4
+STATUS_NAMES = ["APPLIED", "BAD_SIGNATURE", "REJECTED", "NO_KEY", "STALE"]
+
+GROUP = "239.80.84.67"  # Must match FLEET_MULTICAST_GROUP
+PORT = 47800            # Must match FLEET_PORT
+KEY_BYTES = 32          # Must match FLEET_KEY_BYTES
+CHUNK_BYTES = 1024      # Must match FLEET_CHUNK_BYTES
+MAX_CHUNKS = 32         # Must match FLEET_MAX_CHUNKS
+SLOT_COUNT = 4          # Must match MACRO_SLOT_COUNT
+NACK_JITTER = 0.040     # Must match FLEET_NACK_JITTER_MS
+KEEP = 0xFF
+
+
+def build_bundle(macros, active=None, frame_rate=None):
+    """macros: {slot: "button,duration;..."}"""
+    bundle = bytearray([KEEP if active is None else active, KEEP if frame_rate is None else frame_rate])
+    for slot, text in sorted(macros.items()):
+        data = text.encode()
+        bundle += struct.pack("<BH", slot, len(data)) + data
+    if len(bundle) > MAX_CHUNKS * CHUNK_BYTES:
+        raise SystemExit("bundle is %d bytes, the limit is %d" % (len(bundle), MAX_CHUNKS * CHUNK_BYTES))
+    return bytes(bundle)
+
+
+def demo_macros(steps=200):
+    """One macro of `steps` steps per slot, at a rate the device accepts."""
+    rng = random.Random(1)
+    macros = {}
+    for slot in range(SLOT_COUNT):
+        seq = []
+        for i in range(steps):
+            button = 0 if i % 5 == 4 else rng.randint(1, 16)  # Every fifth step a pause
+            seq.append("%d,%d;" % (button, rng.randint(40, 250)))
+        macros[slot] = "".join(seq)
+    return macros
+
+
+def packet(ptype, bundle_id, payload=b""):
+    return MAGIC + struct.pack("<BI", ptype, bundle_id) + payload
+
+
+class Push:
+    """One bundle transfer to whoever is listening on the group."""
+
+    def __init__(self, sock, key, bundle_id, bundle, gap):
+        self.sock = sock
+        self.bundle_id = bundle_id
+        self.chunks = [bundle[i:i + CHUNK_BYTES] for i in range(0, len(bundle), CHUNK_BYTES)]
+        head = MAGIC + struct.pack("<IH", bundle_id, len(bundle))
+        mac = hmac.new(key, head + bundle, hashlib.sha256).digest()
+        self.manifest = packet(MANIFEST, bundle_id, struct.pack("<BH", len(self.chunks), len(bundle)) + mac)
+        self.gap = gap
+        self.done = {}  # Device name -> status
+        self.rounds = 0
+        self.sent_chunks = 0
+
+    def _send(self, data):
+        self.sock.sendto(data, (GROUP, PORT))
+
+    def _send_chunks(self, indexes):
+        for index in indexes:
+            self._send(packet(CHUNK, self.bundle_id, bytes([index]) + self.chunks[index]))
+            self.sent_chunks += 1
+            time.sleep(self.gap)  # A device's lwIP receive queue only holds a few datagrams
+
+    def _collect(self, window):
+        """Reads answers for `window` seconds; returns the union of the chunks NACKed."""
+        missing = 0
+        deadline = time.monotonic() + window
+        while True:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return missing
+            self.sock.settimeout(remaining)
+            try:
+                data, _ = self.sock.recvfrom(2048)
+            except socket.timeout:
+                return missing
+            if len(data) < 9 or data[:4] != MAGIC:
+                continue
+            ptype, bundle_id = struct.unpack_from("<BI", data, 4)
+            if bundle_id != self.bundle_id:
+                continue
+            if ptype == NACK and len(data) >= 13:
+                missing |= struct.unpack_from("<I", data, 9)[0]
+            elif ptype == DONE and len(data) >= 10:
+                self.done[data[10:].decode(errors="replace")] = data[9]
+
+    def run(self, expect, timeout, window):
+        start = time.monotonic()
+        self._send(self.manifest)
+        self._send_chunks(range(len(self.chunks)))
+        quiet = 0
+        while time.monotonic() - start < timeout:
+            self.rounds += 1
+            self._send(self.manifest)  # Poll
+            missing = self._collect(window)
+            if missing:
+                quiet = 0
+                self._send_chunks([i for i in range(len(self.chunks)) if missing >> i & 1])
+                continue
+            quiet += 1
+            # Without --expect the fleet size is unknown: stop once nobody has spoken up
+            # for a few polls (a device that missed everything NACKs at the next one)
+            if (expect and len(self.done) >= expect) or (not expect and quiet >= 3 and self.done):
+                break
+        return time.monotonic() - start
+
+
+def open_socket(iface):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+    if iface:
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(iface))
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)  # DONEs from a whole fleet
+    sock.bind(("", 0))
+    return sock
+
+
+def push(args, key, bundle, expect):
+    sock = open_socket(args.iface)
+    try:
+        bundle_id = args.id if args.id is not None else int(time.time())  # Must increase per push
+        job = Push(sock, key, bundle_id, bundle, args.gap_ms / 1000)
+        elapsed = job.run(expect, args.timeout, args.window_ms / 1000)
+        return job, elapsed
+    finally:
+        sock.close()
+
+
+def forge_manifests(iface, bundle_id, length):
+    """MANIFESTs nobody signed: they must not keep a device from taking the real push."""
+    sock = open_socket(iface)
+    try:
+        chunks = (length + CHUNK_BYTES - 1) // CHUNK_BYTES
+        for forged_id in (bundle_id, 0xFFFFFFFF):
+            sock.sendto(packet(MANIFEST, forged_id, struct.pack("<BH", chunks, length) + os.urandom(32)), (GROUP, PORT))
+        time.sleep(0.05)  # Let the nodes take them before the real MANIFEST
+    finally:
+        sock.close()
+
+
+def simulate(args):
+    key = os.urandom(KEY_BYTES)
+    bundle = build_bundle(demo_macros(), active=0)
+    args.iface = args.iface or "127.0.0.1"
+    results = []
+    for count in [int(n) for n in args.simulate.split(",")]:
+        nodes = [subprocess.Popen([args.node, "--node", str(i + 1), "--key", key.hex(), "--loss", str(args.loss)],
+                                  stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True) for i in range(count)]
+        try:
+            for node in nodes:
+                line = node.stdout.readline()
+                if "ready" not in line:
+                    raise SystemExit("unexpected output from %s: %r" % (args.node, line))
+            args.id = int(time.time() * 1000) & 0x7FFFFFFF
+            if args.forge:
+                forge_manifests(args.iface, args.id, len(bundle))
+            job, elapsed = push(args, key, bundle, count)
+        finally:
+            for node in nodes:
+                node.kill()
+                node.wait()
+        applied = sum(1 for status in job.done.values() if status == 0)
+        results.append((count, applied, elapsed, job.rounds, job.sent_chunks - len(job.chunks)))
+
+    print("bundle: %d bytes in %d chunks, loss %.0f%%" % (len(bundle), len(job.chunks), args.loss * 100))
+    print("%6s %8s %9s %7s %12s" % ("nodes", "applied", "seconds", "polls", "retransmits"))
+    for count, applied, elapsed, rounds, resent in results:
+        print("%6d %8d %9.3f %7d %12d" % (count, applied, elapsed, rounds, resent))
+    if any(applied != count for count, applied, _, _, _ in results):
+        raise SystemExit("some nodes did not apply the bundle")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--key", help="fleet key, %d hex digits" % (KEY_BYTES * 2))
+    parser.add_argument("--keygen", action="store_true", help="print a new random fleet key and exit")
+    parser.add_argument("--slot", action="append", default=[], metavar="N=MACRO", help='e.g. 1="1,100;2,150;"')
+    parser.add_argument("--demo", action="store_true", help="push %d macros of 200 steps" % SLOT_COUNT)
+    parser.add_argument("--active", type=int, help="slot to make active")
+    parser.add_argument("--frame-rate", type=int, help="frame-synchronous playback rate (0 = off)")
+    parser.add_argument("--id", type=int, help="bundle id, must exceed the last one applied (default: Unix time)")
+    parser.add_argument("--expect", type=int, help="stop once this many devices have answered")
+    parser.add_argument("--iface", help="address of the local interface to multicast on")
+    parser.add_argument("--timeout", type=float, default=10.0, help="give up after this many seconds")
+    parser.add_argument("--window-ms", type=float, default=NACK_JITTER * 1000 + 60, help="how long each poll collects answers")
+    parser.add_argument("--gap-ms", type=float, default=1.0, help="pause between chunks")
+    parser.add_argument("--simulate", metavar="COUNTS", help="comma-separated node counts to simulate on loopback")
+    parser.add_argument("--node", metavar="PROGRAM", help="native_fleet program for --simulate")
+    parser.add_argument("--loss", type=float, default=0.0, help="datagram loss at each simulated node (0..1)")
+    parser.add_argument("--forge", action="store_true", help="with --simulate, multicast forged MANIFESTs before the push")
+    args = parser.parse_args()
+
+    if args.keygen:
+        print(os.urandom(KEY_BYTES).hex())
+        return
+    if args.simulate:
+        if not args.node:
+            parser.error("--simulate needs --node")
+        simulate(args)
+        return
+
+    try:
+        key = bytes.fromhex(args.key or "")
+    except ValueError:
+        key = b""
+    if len(key) != KEY_BYTES:
+        parser.error("--key takes %d hex digits" % (KEY_BYTES * 2))
+    macros = demo_macros() if args.demo else {}
+    for item in args.slot:
+        slot, _, text = item.partition("=")
+        if not slot.isdigit() or int(slot) >= SLOT_COUNT:
+            parser.error("bad --slot %r" % item)
+        macros[int(slot)] = text
+    if not macros and args.active is None and args.frame_rate is None:
+        parser.error("nothing to push: give --slot, --demo, --active or --frame-rate")
+
+    bundle = build_bundle(macros, args.active, args.frame_rate)
+    job, elapsed = push(args, key, bundle, args.expect)
+    for name, status in sorted(job.done.items()):
+        print("%-16s %s" % (name, STATUS_NAMES[status] if status < len(STATUS_NAMES) else status))
+    print("%d devices answered in %.2f s (%d chunks, %d polls, %d retransmitted)" %
+          (len(job.done), elapsed, len(job.chunks), job.rounds, job.sent_chunks - len(job.chunks)))
+    if (args.expect and len(job.done) < args.expect) or any(status != 0 for status in job.done.values()):
+        raise SystemExit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,397 @@
+#!/usr/bin/env python3
+"""Host tool for the PatroSmartController binary serial link (see include/SerialLink.h).
+
+Examples:
+    patro_serial.py -p /dev/ttyUSB0 upload --slot 1 "1,200;2,150;"
+    patro_serial.py -p /dev/ttyUSB0 select 1
+    patro_serial.py -p /dev/ttyUSB0 start
+    patro_serial.py -p /dev/ttyUSB0 button 3 --hold-ms 100
+    patro_serial.py -p /dev/ttyUSB0 frame-rate 60
+    patro_serial.py -p /dev/ttyUSB0 fleet-key $(tools/fleet_push.py --keygen)
+    patro_serial.py -p /dev/ttyUSB0 -b 921600 bench
+    patro_serial.py -p /dev/ttyUSB0 selftest
+    patro_serial.py --spawn .pio/build/native_serial/program selftest
+
+--spawn starts the native_serial stand-in (src/SerialLink.cpp on a pty, its UART paced at
+SERIAL_BAUD) and talks to it. selftest checks the replies to valid and invalid commands,
+and that oversized and corrupt frames are dropped without disturbing the link.
+
+Linux only: the port is driven through termios, no pyserial needed.
+"""
+import argparse
+import os
+import random
+import re
+import select
+import statistics
+import subprocess
+import termios
+import time
+import tty
+
+FRAME_SYNC, FRAME_PING = 0x01, 0x02
+FRAME_UPLOAD_BEGIN, FRAME_UPLOAD_DATA, FRAME_UPLOAD_COMMIT = 0x03, 0x04, 0x05
+FRAME_SELECT_SLOT, FRAME_START, FRAME_STOP, FRAME_BUTTON = 0x06, 0x07, 0x08, 0x09
+FRAME_FRAME_RATE, FRAME_FLEET_KEY = 0x0A, 0x0B
+FRAME_ACK, FRAME_NAK = 0x80, 0x81
+
+STATUS_NAMES = ["OK", "BAD_LENGTH", "BAD_SLOT", "BAD_STATE", "BAD_OFFSET", "EMPTY", "UNKNOWN_TYPE", "REJECTED"]
+
+WINDOW = 8             # Must match SERIAL_WINDOW
+MAX_FRAME = 256        # Must match SERIAL_MAX_FRAME
+STEPS_PER_FRAME = (MAX_FRAME - 4 - 2) // 3
+SLOT_COUNT = 4         # Must match MACRO_SLOT_COUNT
+MAX_STEPS = 256        # Must match MACRO_MAX_STEPS
+MAX_FRAME_RATE = 240   # Must match FRAME_RATE_MAX_HZ
+FLEET_KEY_BYTES = 32   # Must match FLEET_KEY_BYTES
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_idx, code = 0, 1
+    for b in data:
+        if b == 0:
+            out[code_idx] = code
+            code_idx, code = len(out), 1
+            out.append(0)
+            continue
+        out.append(b)
+        code += 1
+        if code == 0xFF:
+            out[code_idx] = code
+            code_idx, code = len(out), 1
+            out.append(0)
+    out[code_idx] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        i += 1
+        if code == 0 or i + code - 1 > len(data):
+            return None
+        out += data[i:i + code - 1]
+        i += code - 1
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def build_frame(ftype, seq, payload=b""):
+    body = bytes([ftype, seq & 0xFF]) + payload
+    crc = crc16(body)
+    return b"\x00" + cobs_encode(body + bytes([crc & 0xFF, crc >> 8])) + b"\x00"
+
+
+def parse_frame(encoded):
+    raw = cobs_decode(encoded)
+    if raw is None or len(raw) < 4:
+        return None
+    if crc16(raw[:-2]) != raw[-2] | (raw[-1] << 8):
+        return None
+    return raw[0], raw[1], raw[2:-2]
+
+
+def parse_macro(text):
+    steps = []
+    for part in text.split(";"):
+        if "," in part:
+            button, duration = part.split(",", 1)
+            steps.append((int(button), int(duration)))
+    return steps
+
+
+class FrameReader:
+    """Splits a byte stream on 0x00 and yields valid frames."""
+
+    def __init__(self):
+        self.buf = bytearray()
+
+    def feed(self, data):
+        frames = []
+        for b in data:
+            if b == 0:
+                if self.buf:
+                    frame = parse_frame(bytes(self.buf))
+                    if frame:
+                        frames.append(frame)
+                self.buf.clear()
+            else:
+                self.buf.append(b)
+        return frames
+
+
+def open_port(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attrs = termios.tcgetattr(fd)
+    speed = getattr(termios, "B%d" % baud)
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+class NakError(Exception):
+    def __init__(self, index, status):
+        name = STATUS_NAMES[status] if status < len(STATUS_NAMES) else status
+        super().__init__("frame %d rejected: %s" % (index, name))
+        self.status = status
+
+
+class Link:
+    def __init__(self, fd, timeout=0.2):
+        self.fd = fd
+        self.timeout = timeout
+        self.reader = FrameReader()
+        self.seq = random.randrange(256)
+        self.pending = []
+        self.tx_bytes = 0
+        self.retransmits = 0
+
+    def _write(self, data):
+        self.tx_bytes += len(data)
+        view = memoryview(data)
+        while view:
+            n = os.write(self.fd, view)
+            view = view[n:]
+
+    def _poll(self, timeout):
+        """Next frame, or None after timeout. A real UART delivers a frame in pieces."""
+        deadline = time.monotonic() + timeout
+        while not self.pending:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            ready, _, _ = select.select([self.fd], [], [], remaining)
+            if ready:
+                self.pending = self.reader.feed(os.read(self.fd, 4096))
+        return self.pending.pop(0)
+
+    def sync(self):
+        for _ in range(10):
+            self._write(build_frame(FRAME_SYNC, self.seq))
+            deadline = time.monotonic() + self.timeout
+            while time.monotonic() < deadline:
+                frame = self._poll(deadline - time.monotonic())
+                if frame and frame[0] == FRAME_ACK and frame[1] == self.seq:
+                    self.seq = (self.seq + 1) & 0xFF
+                    return
+        raise TimeoutError("device did not answer SYNC")
+
+    def send(self, frames):
+        """Go-back-N transfer of [(type, payload)] with up to WINDOW frames in flight."""
+        first = self.seq
+        wire = [build_frame(t, first + i, p) for i, (t, p) in enumerate(frames)]
+        base = nxt = 0
+        while base < len(wire):
+            while nxt < len(wire) and nxt - base < WINDOW:
+                self._write(wire[nxt])
+                nxt += 1
+            frame = self._poll(self.timeout)
+            if frame is None:
+                self.retransmits += nxt - base
+                nxt = base
+                continue
+            ftype, seq, payload = frame
+            idx = (seq - first) & 0xFF
+            if ftype == FRAME_NAK and base <= idx < nxt:
+                self.seq = (first + idx + 1) & 0xFF
+                raise NakError(idx, payload[0] if payload else 0xFF)
+            if ftype == FRAME_ACK and base <= idx < nxt:
+                base = idx + 1
+        self.seq = (first + len(wire)) & 0xFF
+
+    def upload(self, slot, steps):
+        frames = [(FRAME_UPLOAD_BEGIN, bytes([slot]) + len(steps).to_bytes(2, "little"))]
+        for off in range(0, len(steps), STEPS_PER_FRAME):
+            payload = bytearray(off.to_bytes(2, "little"))
+            for button, duration in steps[off:off + STEPS_PER_FRAME]:
+                payload += bytes([button]) + duration.to_bytes(2, "little")
+            frames.append((FRAME_UPLOAD_DATA, bytes(payload)))
+        frames.append((FRAME_UPLOAD_COMMIT, b""))
+        self.send(frames)
+
+
+def spawn(program):
+    """Starts the native_serial stand-in; returns the process and its pty path."""
+    process = subprocess.Popen([program], stdout=subprocess.PIPE, text=True)
+    line = process.stdout.readline()
+    match = re.search(r"serial link on (\S+) at (\d+) baud", line)
+    if not match:
+        process.kill()
+        raise SystemExit("unexpected output from %s: %r" % (program, line))
+    return process, match.group(1), int(match.group(2))
+
+
+def percentile(values, pct):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+
+def run_bench(link, pings, uploads):
+    rtts = []
+    for _ in range(pings):
+        start = time.perf_counter()
+        link.send([(FRAME_PING, b"")])
+        rtts.append((time.perf_counter() - start) * 1e6)
+    print("round trip (us): min %.0f  mean %.0f  p50 %.0f  p99 %.0f  max %.0f" % (
+        min(rtts), statistics.mean(rtts), percentile(rtts, 50), percentile(rtts, 99), max(rtts)))
+
+    steps = [(random.randint(1, 8), random.randint(20, 2000)) for _ in range(MAX_STEPS)]
+    link.tx_bytes = 0
+    start = time.perf_counter()
+    for _ in range(uploads):
+        link.upload(0, steps)
+    elapsed = time.perf_counter() - start
+    payload = uploads * len(steps) * 3
+    print("upload: %d x %d steps in %.3f s, %.1f steps/s, payload %.1f KB/s, wire %.1f KB/s, %d retransmits" % (
+        uploads, len(steps), elapsed, uploads * len(steps) / elapsed, payload / elapsed / 1024,
+        link.tx_bytes / elapsed / 1024, link.retransmits))
+
+
+def expect_nak(link, frames, status, what, failures):
+    failures.checks += 1
+    try:
+        link.send(frames)
+        failures.append("%s: accepted, expected %s" % (what, STATUS_NAMES[status]))
+    except NakError as err:
+        if err.status != status:
+            failures.append("%s: %s, expected %s" % (what, err, STATUS_NAMES[status]))
+
+
+class Failures(list):
+    checks = 0
+
+
+def run_selftest(link):
+    """Overwrites slot 1 and selects it; the frame rate is left at 0."""
+    failures = Failures()
+    steps = [(random.randint(1, 8), random.randint(60, 500)) for _ in range(MAX_STEPS)]
+    link.upload(1, steps)  # Several DATA frames, and the device logs the analysis in between
+    link.send([(FRAME_SELECT_SLOT, bytes([1])), (FRAME_FRAME_RATE, bytes([60])), (FRAME_FRAME_RATE, bytes([0])),
+               (FRAME_PING, b"")])
+
+    expect_nak(link, [(FRAME_SELECT_SLOT, bytes([SLOT_COUNT]))], 2, "select a slot past the last", failures)
+    expect_nak(link, [(FRAME_SELECT_SLOT, b"")], 1, "select without a slot", failures)
+    expect_nak(link, [(FRAME_UPLOAD_BEGIN, bytes([0, 0, 0]))], 5, "upload of 0 steps", failures)
+    expect_nak(link, [(FRAME_UPLOAD_BEGIN, bytes([0]) + (MAX_STEPS + 1).to_bytes(2, "little"))], 5,
+               "upload past MACRO_MAX_STEPS", failures)
+    expect_nak(link, [(FRAME_UPLOAD_COMMIT, b"")], 3, "commit without an upload", failures)
+    expect_nak(link, [(FRAME_FRAME_RATE, bytes([MAX_FRAME_RATE + 1]))], 7, "frame rate past the maximum", failures)
+    expect_nak(link, [(0x7F, b"")], 6, "unknown frame type", failures)
+
+    # Frames the device must drop without answering. The first two decode to 258 and 257
+    # bytes, past MAX_FRAME; the last is a valid frame with a bad CRC.
+    ping = build_frame(FRAME_PING, link.seq)
+    for what, wire in [("259 x 0x01", b"\x00" + b"\x01" * 259 + b"\x00"),
+                       ("254-byte block + 3", b"\x00\xff" + b"\x01" * 254 + b"\x04\x01\x01\x01\x00"),
+                       ("bad CRC", ping[:-2] + bytes([ping[-2] ^ 0x55]) + b"\x00")]:
+        failures.checks += 1
+        link._write(wire)
+        frame = link._poll(0.1)
+        if frame is not None:
+            failures.append("%s: answered with %r" % (what, frame))
+    failures.checks += 1
+    try:
+        link.send([(FRAME_PING, b"")])
+    except (TimeoutError, NakError) as err:
+        failures.append("link unusable after the bad frames: %s" % err)
+
+    for failure in failures:
+        print("FAIL: %s" % failure)
+    if failures:
+        raise SystemExit(1)
+    print("selftest: %d checks passed, %d retransmits" % (failures.checks, link.retransmits))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-p", "--port", help="serial device, e.g. /dev/ttyUSB0")
+    parser.add_argument("-b", "--baud", type=int, default=115200, help="must match SERIAL_BAUD (max 921600)")
+    parser.add_argument("--spawn", metavar="PROGRAM", help="start the native_serial stand-in and talk to it")
+    parser.add_argument("--timeout", type=float, default=0.2, help="retransmit timeout in seconds")
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    up = sub.add_parser("upload", help="store a macro into a slot")
+    up.add_argument("macro", help='"button,duration;..." as used by the web portal')
+    up.add_argument("--slot", type=int, default=0)
+    sel = sub.add_parser("select", help="make a slot the active macro")
+    sel.add_argument("slot", type=int)
+    sub.add_parser("start", help="start macro playback")
+    sub.add_parser("stop", help="stop macro playback")
+    btn = sub.add_parser("button", help="press and release a gamepad button")
+    btn.add_argument("button", type=int)
+    btn.add_argument("--hold-ms", type=int, default=100)
+    rate = sub.add_parser("frame-rate", help="quantize playback to a game frame rate (0 = off)")
+    rate.add_argument("hz", type=int)
+    key = sub.add_parser("fleet-key", help="set the key that fleet bundles must be signed with")
+    key.add_argument("key", help="%d hex digits, e.g. from fleet_push.py --keygen" % (FLEET_KEY_BYTES * 2))
+    bench = sub.add_parser("bench", help="measure round-trip latency and upload throughput")
+    bench.add_argument("--pings", type=int, default=500)
+    bench.add_argument("--uploads", type=int, default=20)
+    sub.add_parser("selftest", help="check the device's answers to valid, invalid and corrupt frames")
+    args = parser.parse_args()
+
+    process = None
+    if args.spawn:
+        process, args.port, args.baud = spawn(args.spawn)
+    elif not args.port:
+        parser.error("either --port or --spawn is required")
+    try:
+        run_command(parser, args, open_port(args.port, args.baud))
+    finally:
+        if process:
+            process.kill()
+            process.wait()
+
+
+def run_command(parser, args, fd):
+    link = Link(fd, args.timeout)
+    link.sync()
+    try:
+        if args.cmd == "upload":
+            link.upload(args.slot, parse_macro(args.macro))
+        elif args.cmd == "select":
+            link.send([(FRAME_SELECT_SLOT, bytes([args.slot]))])
+        elif args.cmd == "start":
+            link.send([(FRAME_START, b"")])
+        elif args.cmd == "stop":
+            link.send([(FRAME_STOP, b"")])
+        elif args.cmd == "button":
+            link.send([(FRAME_BUTTON, bytes([args.button, 1]))])
+            time.sleep(args.hold_ms / 1000)
+            link.send([(FRAME_BUTTON, bytes([args.button, 0]))])
+        elif args.cmd == "frame-rate":
+            link.send([(FRAME_FRAME_RATE, bytes([args.hz]))])
+        elif args.cmd == "fleet-key":
+            try:
+                key = bytes.fromhex(args.key)
+            except ValueError:
+                key = b""
+            if len(key) != FLEET_KEY_BYTES:
+                parser.error("the fleet key is %d hex digits" % (FLEET_KEY_BYTES * 2))
+            link.send([(FRAME_FLEET_KEY, key)])
+        elif args.cmd == "bench":
+            run_bench(link, args.pings, args.uploads)
+        elif args.cmd == "selftest":
+            run_selftest(link)
+    except NakError as err:
+        raise SystemExit("error: %s" % err)
+    print("OK")
+
+
+if __name__ == "__main__":
+    main()
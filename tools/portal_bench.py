@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+"""Measures requests per second and latency of the configuration portal.
+
+Each page load replays what the browser does: the page, then /get_macro, /frame_rate
+and /scan, and a POST to /analyze in place of /save (which would restart the device).
+Three client strategies are compared:
+    close      a new connection per request, as the core WebServer forced
+    keepalive  one persistent connection per client, one request at a time
+    pipeline   one persistent connection per client, a whole page load sent at once
+
+Latency runs from sending a request (or its pipelined batch) to the end of its response.
+Responses are checked against the route they belong to, so a pipelined reply coming back
+out of order fails the run.
+
+Before the timed runs, requests with a bad Content-Length are sent: malformed values (a
+sign, garbage) must get a 400, values too large or overflowing a 413, each with a closed
+connection, and the portal must still answer afterwards. A /save with a frame rate out of
+range (300 would wrap to 44 as a byte) must get a 400 and leave the rate unchanged. In AP mode the captive-portal
+probes are replayed the way operating systems send them, back to back on one connection:
+every one must get its empty reply, a 302 with a Location for the OS probes.
+
+Usage (from the repository root):
+    pio run -e native_portal
+    tools/portal_bench.py --spawn .pio/build/native_portal/program   # host stand-in
+    tools/portal_bench.py --host 192.168.4.1 --port 80               # device soft-AP
+    tools/portal_bench.py --loads 200 --clients 4 --modes close,pipeline
+"""
+import argparse
+import re
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+# (method, path, body, expected content type)
+PAGE_LOAD = [
+    ("GET", "/", None, "text/html"),
+    ("GET", "/get_macro", None, "text/plain"),
+    ("GET", "/frame_rate", None, "text/plain"),
+    ("GET", "/scan", None, "application/json"),
+    ("POST", "/analyze", "seq=1%2C100%3B2%2C200%3B0%2C50%3B", "application/json"),
+]
+MODES = ("close", "keepalive", "pipeline")
+
+
+def encode(method, path, body, host, close):
+    lines = ["%s %s HTTP/1.1" % (method, path), "Host: %s" % host]
+    if close:
+        lines.append("Connection: close")
+    if body is not None:
+        lines.append("Content-Type: application/x-www-form-urlencoded")
+        lines.append("Content-Length: %d" % len(body))
+    return ("\r\n".join(lines) + "\r\n\r\n" + (body or "")).encode()
+
+
+class Connection:
+    def __init__(self, host, port, timeout):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buffer = b""
+
+    def close(self):
+        self.sock.close()
+
+    def _fill(self):
+        data = self.sock.recv(65536)
+        if not data:
+            raise ConnectionError("connection closed by the server")
+        self.buffer += data
+
+    def read_response(self):
+        """Returns (status, headers, body) of the next response on the connection."""
+        while b"\r\n\r\n" not in self.buffer:
+            self._fill()
+        head, self.buffer = self.buffer.split(b"\r\n\r\n", 1)
+        lines = head.decode("latin-1").split("\r\n")
+        status = int(lines[0].split()[1])
+        headers = {}
+        for line in lines[1:]:
+            name, _, value = line.partition(":")
+            headers[name.strip().lower()] = value.strip()
+        length = int(headers.get("content-length", "0"))
+        while len(self.buffer) < length:
+            self._fill()
+        body, self.buffer = self.buffer[:length], self.buffer[length:]
+        return status, headers, body
+
+
+class Client:
+    """Runs page loads with one strategy and records per-request latencies."""
+
+    def __init__(self, args, mode):
+        self.args = args
+        self.mode = mode
+        self.conn = None
+        self.latencies = []
+        self.connections = 0
+        self.retries = 0
+        self.errors = []
+
+    def _connect(self):
+        if self.conn is None:
+            self.conn = Connection(self.args.host, self.args.port, self.args.timeout)
+            self.connections += 1
+        return self.conn
+
+    def _drop(self):
+        if self.conn is not None:
+            self.conn.close()
+            self.conn = None
+
+    def _check(self, request, response):
+        status, headers, _ = response
+        if status != 200 or not headers.get("content-type", "").startswith(request[3]):
+            self.errors.append("%s %s: got %d %s" % (request[0], request[1], status, headers.get("content-type")))
+        if headers.get("connection", "").lower() == "close":
+            self._drop()
+
+    def _one(self, request, close):
+        conn = self._connect()
+        start = time.perf_counter()
+        conn.sock.sendall(encode(request[0], request[1], request[2], self.args.host, close))
+        response = conn.read_response()
+        self.latencies.append(time.perf_counter() - start)
+        self._check(request, response)
+
+    def page_load(self):
+        if self.mode == "close":
+            for request in PAGE_LOAD:
+                self._one(request, close=True)
+                self._drop()
+        elif self.mode == "keepalive":
+            for request in PAGE_LOAD:
+                self._retry(lambda: self._one(request, close=False))
+        else:
+            self._retry(self._pipelined)
+
+    def _pipelined(self):
+        conn = self._connect()
+        start = time.perf_counter()
+        conn.sock.sendall(b"".join(encode(m, p, b, self.args.host, False) for m, p, b, _ in PAGE_LOAD))
+        for request in PAGE_LOAD:
+            response = conn.read_response()
+            self.latencies.append(time.perf_counter() - start)
+            self._check(request, response)
+
+    def _retry(self, action, attempts=3):
+        # A kept-alive connection may have been closed by the server (idle timeout, request
+        # cap, eviction for a new client) just before it was reused: reconnect, as a browser does
+        for attempt in range(attempts):
+            try:
+                return action()
+            except (ConnectionError, socket.timeout, OSError):
+                self._drop()
+                if attempt == attempts - 1:
+                    raise
+                self.retries += 1
+
+
+# Content-Length values the server must refuse, with the status expected
+BAD_CONTENT_LENGTHS = [("-1", 400), ("+5", 400), ("12abc", 400), ("0x10", 400), ("1 2", 400), ("", 400),
+                       ("5\r\nContent-Length: 6", 400),  # Two headers that disagree
+                       ("18446744073709551615", 413), ("18446744073709551616", 413),
+                       ("99999999999999999999999999", 413)]
+
+
+def check_malformed(args):
+    """Returns the errors seen for the malformed requests."""
+    errors = []
+    body = "seq=1%2C100%3B"
+    for value, expected in BAD_CONTENT_LENGTHS:
+        request = ("POST /analyze HTTP/1.1\r\nHost: %s\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                   "Content-Length: %s\r\n\r\n%s" % (args.host, value, body)).encode()
+        conn = None
+        try:
+            conn = Connection(args.host, args.port, args.timeout)
+            conn.sock.sendall(request)
+            status, headers, _ = conn.read_response()
+            if status != expected or headers.get("connection", "").lower() != "close":
+                errors.append("Content-Length %r: got %d, connection %r" % (value, status, headers.get("connection")))
+        except (ConnectionError, socket.timeout, OSError) as error:
+            errors.append("Content-Length %r: %s" % (value, error))
+        finally:
+            if conn:
+                conn.close()
+
+    client = Client(args, "close")  # The portal must have survived all of them
+    try:
+        client._one(PAGE_LOAD[0], close=True)
+    except (ConnectionError, socket.timeout, OSError) as error:
+        client.errors.append("portal down after the malformed requests: %s" % error)
+    finally:
+        client._drop()
+    return errors + client.errors
+
+
+def check_frame_rate(args):
+    """Returns the errors seen for /save requests with a frame rate out of range."""
+    errors = []
+    try:
+        before = fetch(args, "GET", "/frame_rate", None)
+        for value in ("300", "256", "-1"):
+            status, _, _ = fetch(args, "POST", "/save", "frame_hz=" + value)
+            if status != 400:
+                errors.append("/save frame_hz=%s: got %d, expected 400" % (value, status))
+        after = fetch(args, "GET", "/frame_rate", None)
+        if after[2] != before[2]:
+            errors.append("frame rate changed from %r to %r" % (before[2], after[2]))
+    except (ConnectionError, socket.timeout, OSError) as error:
+        errors.append("/save frame_hz: %s" % error)
+    return errors
+
+
+def fetch(args, method, path, body):
+    """One request on its own connection: returns (status, headers, body)."""
+    conn = Connection(args.host, args.port, args.timeout)
+    try:
+        conn.sock.sendall(encode(method, path, body, args.host, True))
+        return conn.read_response()
+    finally:
+        conn.close()
+
+
+# Probe sequences as the OSes send them while joining the AP, with the status expected
+PROBE_SEQUENCES = [
+    [("/connecttest.txt", 302), ("/redirect", 302)],                # Windows
+    [("/hotspot-detect.html", 302), ("/hotspot-detect.html", 302)],  # iOS reloading the probe
+    [("/generate_204", 302), ("/generate_204", 302), ("/favicon.ico", 204)],
+    [("/wpad.dat", 404), ("/wpad.dat", 404)],
+]
+
+
+def check_probes(args):
+    """Returns the errors seen for the captive-portal probes (AP mode only)."""
+    errors = []
+    for sequence in PROBE_SEQUENCES:
+        conn = None
+        try:
+            conn = Connection(args.host, args.port, args.timeout)  # One keep-alive connection per OS
+            for path, expected in sequence:
+                conn.sock.sendall(encode("GET", path, None, args.host, False))
+                status, headers, body = conn.read_response()
+                if status != expected or body:
+                    errors.append("probe %s: got %d with %d bytes, expected %d without a body" % (path, status, len(body), expected))
+                if status == 302 and not headers.get("location", "").startswith("http://"):
+                    errors.append("probe %s: redirect to %r" % (path, headers.get("location")))
+        except (ConnectionError, socket.timeout, OSError) as error:
+            errors.append("probe %s: %s" % (path, error))
+        finally:
+            if conn:
+                conn.close()
+    return errors
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[index]
+
+
+def run_mode(args, mode):
+    clients = [Client(args, mode) for _ in range(args.clients)]
+    loads = [args.loads // args.clients + (1 if i < args.loads % args.clients else 0) for i in range(args.clients)]
+    failures = []
+
+    def worker(client, count):
+        try:
+            for _ in range(count):
+                client.page_load()
+        except Exception as error:  # Reported below; one failing client must not hang the run
+            failures.append("%s: %s" % (mode, error))
+        finally:
+            client._drop()
+
+    threads = [threading.Thread(target=worker, args=(c, n)) for c, n in zip(clients, loads)]
+    start = time.perf_counter()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.perf_counter() - start
+
+    latencies = sorted(l for c in clients for l in c.latencies)
+    errors = failures + [e for c in clients for e in c.errors]
+    return {
+        "mode": mode,
+        "requests": len(latencies),
+        "connections": sum(c.connections for c in clients),
+        "retries": sum(c.retries for c in clients),
+        "rps": len(latencies) / elapsed if elapsed > 0 else 0.0,
+        "p50": percentile(latencies, 50) * 1000,
+        "p99": percentile(latencies, 99) * 1000,
+        "errors": errors,
+    }
+
+
+def spawn(path, sta):
+    process = subprocess.Popen([path] + (["--sta"] if sta else []), stdout=subprocess.PIPE, text=True)
+    line = process.stdout.readline()
+    match = re.search(r"listening on ([\d.]+):(\d+)", line)
+    if not match:
+        process.kill()
+        raise SystemExit("unexpected output from %s: %r" % (path, line))
+    return process, match.group(1), int(match.group(2))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--spawn", metavar="PROGRAM", help="start the native_portal stand-in and measure it")
+    parser.add_argument("--sta", action="store_true", help="run the spawned stand-in in STA mode (no probe checks)")
+    parser.add_argument("--loads", type=int, default=100, help="page loads per mode (default 100)")
+    parser.add_argument("--clients", type=int, default=2, help="concurrent clients (default 2)")
+    parser.add_argument("--modes", default=",".join(MODES), help="comma-separated subset of " + ", ".join(MODES))
+    parser.add_argument("--timeout", type=float, default=10.0, help="socket timeout in seconds")
+    args = parser.parse_args()
+
+    process = None
+    if args.spawn:
+        process, args.host, args.port = spawn(args.spawn, args.sta)
+    try:
+        malformed = check_malformed(args) + check_frame_rate(args) + ([] if args.sta else check_probes(args))
+        results = [run_mode(args, mode) for mode in args.modes.split(",")]
+    finally:
+        if process:
+            process.kill()
+
+    print("%-10s %9s %12s %8s %10s %9s %9s" % ("mode", "requests", "connections", "retries", "req/s", "p50 ms", "p99 ms"))
+    for r in results:
+        print("%-10s %9d %12d %8d %10.1f %9.2f %9.2f" % (r["mode"], r["requests"], r["connections"], r["retries"],
+                                                        r["rps"], r["p50"], r["p99"]))
+
+    errors = malformed + [e for r in results for e in r["errors"]]
+    for error in errors[:10]:
+        sys.stderr.write("error: %s\n" % error)
+    if errors:
+        raise SystemExit("%d requests failed or came back out of order" % len(errors))
+
+
+if __name__ == "__main__":
+    main()
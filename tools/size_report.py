@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+"""Builds every PlatformIO environment and compares flash and static RAM usage.
+
+Usage (from the repository root):
+    tools/size_report.py                    # all [env:*] sections in platformio.ini
+    tools/size_report.py esp32dev esp32dev_ble_only
+
+The first environment is the baseline for the delta columns.
+"""
+import configparser
+import re
+import subprocess
+import sys
+
+USAGE_RE = re.compile(r"^(RAM|Flash):.*\(used (\d+) bytes from (\d+) bytes\)", re.MULTILINE)
+
+
+def environments():
+    config = configparser.ConfigParser(interpolation=None)
+    config.read("platformio.ini")
+    return [s[len("env:"):] for s in config.sections()
+            if s.startswith("env:") and config[s].get("platform") != "native"]
+
+
+def build(env):
+    result = subprocess.run(["pio", "run", "-e", env], capture_output=True, text=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stdout + result.stderr)
+        raise SystemExit("build of %s failed" % env)
+    usage = {kind: (int(used), int(total)) for kind, used, total in USAGE_RE.findall(result.stdout)}
+    if "RAM" not in usage or "Flash" not in usage:
+        raise SystemExit("no size summary in the output of %s" % env)
+    return usage
+
+
+def main():
+    envs = sys.argv[1:] or environments()
+    rows = [(env, build(env)) for env in envs]
+    base = rows[0][1]
+
+    print("%-24s %12s %10s %12s %10s" % ("environment", "flash", "delta", "ram", "delta"))
+    for env, usage in rows:
+        flash, ram = usage["Flash"][0], usage["RAM"][0]
+        print("%-24s %12d %+10d %12d %+10d" % (env, flash, flash - base["Flash"][0], ram, ram - base["RAM"][0]))
+
+
+if __name__ == "__main__":
+    main()